@@ -42,6 +42,11 @@
     #include <search.h>
     #include <sys/socket.h>  // For AF_UNIX, SOCK_STREAM
     #include <fcntl.h>       // For fcntl, F_SETFL, O_NONBLOCK
+    #include <errno.h>
+    #include <stdint.h>
+    #ifdef __linux__
+    #include <sys/eventfd.h>
+    #endif
 #else
     #include <search.h>
 #endif
@@ -62,36 +67,36 @@ static void aeApiFree(aeEventLoop* eventLoop);
 static int aeApiResize(aeEventLoop* eventLoop, int setsize);
 static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp);
 static int aeApiAddEvent(aeEventLoop* eventLoop, xSocket fd, int mask, aeFileEvent* fe);
-static void aeApiDelEvent(aeEventLoop* eventLoop, xSocket fd, int mask);
+static void aeApiDelEvent(aeEventLoop* eventLoop, xSocket fd, int mask, aeFileEvent* fe);
 static xSocket aeApiGetStateFD(aeEventLoop* eventLoop);
 static char* aeApiName(void);
 
-#define INITIAL_EVENT 1024
+#define AE_CHUNKS(n) (((n) + AE_EVENT_CHUNK - 1) / AE_EVENT_CHUNK)
+
 aeEventLoop *aeCreateEventLoop(int setsize) {
     aeEventLoop *eventLoop;
-    int i;
     if (_net_ae) return _net_ae;
     eventLoop = (aeEventLoop*)zmalloc(sizeof(*eventLoop));
     if (!eventLoop) return NULL;
     memset(eventLoop, 0x00, sizeof(*eventLoop));
-    eventLoop->nevents = setsize < INITIAL_EVENT ? setsize : INITIAL_EVENT;
-    eventLoop->events = zmalloc(sizeof(aeFileEvent)*eventLoop->nevents);
-    eventLoop->fired = zmalloc(sizeof(aeFiredEvent)*eventLoop->nevents);
+    /* only the chunk table up front, slots come AE_EVENT_CHUNK at a time */
+    eventLoop->events = zcalloc(sizeof(aeFileEvent*) * AE_CHUNKS(setsize));
+    eventLoop->nfired = setsize < AE_FIRED_MAX ? setsize : AE_FIRED_MAX;
+    eventLoop->fired = zmalloc(sizeof(aeFiredEvent)*eventLoop->nfired);
     if (eventLoop->events == NULL || eventLoop->fired == NULL) goto ERR_RET;
+    eventLoop->nevents = 0;
     eventLoop->setsize = setsize;
     eventLoop->stop = 0;
     eventLoop->maxfd = 0;
     eventLoop->beforesleep = NULL;
-    eventLoop->efhead = 0;
+    eventLoop->flushproc = NULL;
+    eventLoop->efhead = -1;
     eventLoop->fdWaitSlot = -1;
+    eventLoop->budget = AE_IO_BUDGET;
+#ifndef HAVE_IOCP
+    eventLoop->waker.fd[0] = eventLoop->waker.fd[1] = -1;
+#endif
     if (aeApiCreate(eventLoop) == -1) goto ERR_RET;
-    /* Events with mask == AE_NONE are not set. So let's initialize the
-     * vector with it. */
-    for (i = 0; i < eventLoop->nevents; i++) {
-        eventLoop->events[i].slot = i + 1;
-        eventLoop->events[i].mask = AE_NONE;
-    }
-    eventLoop->events[eventLoop->nevents-1].slot = -1;     // last event
 
     _net_ae = eventLoop;
     return eventLoop;
@@ -109,30 +114,71 @@ int aeGetSetSize(aeEventLoop *eventLoop) {
     return eventLoop->setsize;
 }
 
-/* Resize the maximum set size of the event loop.
- * If the requested set size is smaller than the current set size, but
- * there is already a file descriptor in use that is >= the requested
- * set size minus one, AE_ERR is returned and the operation is not
- * performed at all.
+/* Resize the maximum number of file events of the event loop.
+ * Slots already allocated are never freed, so shrinking below them
+ * returns AE_ERR and the operation is not performed at all.
  *
  * Otherwise AE_OK is returned and the operation is successful. */
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
+    aeFileEvent **events;
     if (setsize == eventLoop->setsize) return AE_OK;
-    if (eventLoop->maxfd >= setsize) return AE_ERR;
+    if (setsize < eventLoop->nevents) return AE_ERR;
     if (aeApiResize(eventLoop,setsize) == -1) return AE_ERR;
 
+    /* only the chunk table moves, events themselves stay put */
+    events = zrealloc(eventLoop->events, sizeof(aeFileEvent*) * AE_CHUNKS(setsize));
+    if (AE_CHUNKS(setsize) > AE_CHUNKS(eventLoop->setsize))
+        memset(events + AE_CHUNKS(eventLoop->setsize), 0,
+            sizeof(aeFileEvent*) * (AE_CHUNKS(setsize) - AE_CHUNKS(eventLoop->setsize)));
+    eventLoop->events = events;
     eventLoop->setsize = setsize;
+    return AE_OK;
+}
 
-    /* If the current allocated space is larger than the requested size,
-     * we need to shrink it to the requested size. */
-    if (setsize < eventLoop->nevents) {
-        eventLoop->events = zrealloc(eventLoop->events,sizeof(aeFileEvent)*setsize);
-        eventLoop->fired = zrealloc(eventLoop->fired,sizeof(aeFiredEvent)*setsize);
-        eventLoop->nevents = setsize;
+/* add one chunk of free slots, AE_ERR when setsize is reached */
+static int aeGrowEvents(aeEventLoop *eventLoop) {
+    int base = eventLoop->nevents, n, i;
+    aeFileEvent *chunk;
+
+    if (base >= eventLoop->setsize) return AE_ERR;
+    n = eventLoop->setsize - base < AE_EVENT_CHUNK ? eventLoop->setsize - base : AE_EVENT_CHUNK;
+    chunk = zmalloc(sizeof(aeFileEvent) * AE_EVENT_CHUNK);
+    if (!chunk) return AE_ERR;
+    for (i = 0; i < n; i++) {
+        chunk[i].id = base + i;
+        chunk[i].next = i + 1 < n ? base + i + 1 : eventLoop->efhead;
+        chunk[i].mask = AE_NONE;
+        chunk[i].flags = 0;
     }
+    eventLoop->events[base / AE_EVENT_CHUNK] = chunk;
+    eventLoop->efhead = base;
+    eventLoop->nevents = base + n;
     return AE_OK;
 }
 
+#ifndef HAVE_IOCP
+static void aeMapFd(aeEventLoop *eventLoop, xSocket fd, int id) {
+    if ((int)fd >= eventLoop->fdmapsize) {
+        int size = eventLoop->fdmapsize ? eventLoop->fdmapsize : 1024;
+        while (size <= (int)fd) size *= 2;
+        eventLoop->fdmap = zrealloc(eventLoop->fdmap, sizeof(int) * size);
+        memset(eventLoop->fdmap + eventLoop->fdmapsize, 0xff, sizeof(int) * (size - eventLoop->fdmapsize));
+        eventLoop->fdmapsize = size;
+    }
+    eventLoop->fdmap[fd] = id;
+}
+#endif
+
+aeFileEvent *aeGetFileEvent(aeEventLoop *eventLoop, xSocket fd) {
+#ifndef HAVE_IOCP
+    if (fd < 0 || (int)fd >= eventLoop->fdmapsize || eventLoop->fdmap[fd] < 0) return NULL;
+    return aeGetEvent(eventLoop, eventLoop->fdmap[fd]);
+#else
+    (void)eventLoop; (void)fd;
+    return NULL;
+#endif
+}
+
 /*
  * Return the current event loop.
  *
@@ -140,21 +186,26 @@ int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
  */
 aeEventLoop* aeGetCurEventLoop(void) {
     if (!_net_ae)
-        aeCreateEventLoop(INITIAL_EVENT);
+        aeCreateEventLoop(AE_SETSIZE);
     return _net_ae;
 }
 
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
     if (!eventLoop) return;
 #ifndef HAVE_IOCP
-    if (eventLoop->signal_fd[0] >= 0) {
-        close(eventLoop->signal_fd[0]);
-        close(eventLoop->signal_fd[1]);
-    }
+    aeWakerFree(&eventLoop->waker);
 #endif
     aeApiFree(eventLoop);
+    for (int i = 0; i < AE_CHUNKS(eventLoop->nevents); i++)
+        zfree(eventLoop->events[i]);
     zfree(eventLoop->events);
     zfree(eventLoop->fired);
+    zfree(eventLoop->fdmap);
+    zfree(eventLoop->pending);
+    if (eventLoop->stats) {
+        xtimer_clear_observer(eventLoop->stats);
+        zfree(eventLoop->stats);
+    }
     zfree(eventLoop);
 
     if (_net_ae == eventLoop)
@@ -168,31 +219,29 @@ void aeStop(aeEventLoop *eventLoop) {
 
 int aeCreateFileEvent(aeEventLoop *eventLoop, xSocket fd, int mask,
     aeFileProc *proc, void *clientData, aeFileEvent** ev) {
-    //if (fd >= AE_SETSIZE) return AE_ERR;
-    if (eventLoop->efhead == -1) return AE_ERR;
-    /* Resize the events and fired arrays if the file
-     * descriptor exceeds the current number of events. */
-    if (unlikely(fd >= eventLoop->nevents)) {
-        int newnevents = eventLoop->nevents;
-        newnevents = (newnevents * 2 > (int)fd + 1) ? newnevents * 2 : (int)fd + 1;
-        newnevents = (newnevents > eventLoop->setsize) ? eventLoop->setsize : newnevents;
-        eventLoop->events = zrealloc(eventLoop->events, sizeof(aeFileEvent) * newnevents);
-        eventLoop->fired = zrealloc(eventLoop->fired, sizeof(aeFiredEvent) * newnevents);
-
-        /* Initialize new slots with an AE_NONE mask */
-        for (int i = eventLoop->nevents; i < newnevents; i++)
-            eventLoop->events[i].mask = AE_NONE;
-        eventLoop->nevents = newnevents;
-    }
-    aeFileEvent *fe = &eventLoop->events[eventLoop->efhead];
-    eventLoop->efhead = fe->slot;
+    if (unlikely(eventLoop->efhead == -1) && aeGrowEvents(eventLoop) == AE_ERR)
+        return AE_ERR;
+    aeFileEvent *fe = aeGetEvent(eventLoop, eventLoop->efhead);
+    eventLoop->efhead = fe->next;
     if(ev)
         *ev = fe;
 
+    /* AE_EDGE/AE_IOCOMP are registration flags, not part of the ready mask */
+    fe->flags = (short int)(((mask | eventLoop->flags) & AE_EDGE) | (mask & AE_IOCOMP));
+    fe->kmask = AE_NONE;
+    fe->change = -1;
+    fe->fd = fd;
+    mask &= ~(AE_EDGE | AE_IOCOMP);
     if (aeApiAddEvent(eventLoop, fd, mask, fe) == -1){
+        fe->next = eventLoop->efhead;
+        eventLoop->efhead = fe->id;
         return AE_ERR;
     }
 
+#ifndef HAVE_IOCP
+    aeMapFd(eventLoop, fd, fe->id);
+#endif
+    eventLoop->count++;
     fe->mask |= mask;
     if (mask & AE_READABLE) fe->rfileProc = proc;
     if (mask & AE_WRITABLE) fe->wfileProc = proc;
@@ -202,27 +251,211 @@ int aeCreateFileEvent(aeEventLoop *eventLoop, xSocket fd, int mask,
     return AE_OK;
 }
 
+static void aeFreeFileEvent(aeEventLoop* eventLoop, xSocket fd, aeFileEvent* fe) {
+    eventLoop->count--;
+#ifndef HAVE_IOCP
+    if (eventLoop->fdmap[fd] == fe->id) eventLoop->fdmap[fd] = -1;
+    if (fd == eventLoop->maxfd) {
+        /* Update the max fd */
+        int j = 0;
+        for (j = (int)eventLoop->maxfd - 1; j >= 0; j--)
+            if (eventLoop->fdmap[j] != -1) break;
+        eventLoop->maxfd = j;
+    }
+#endif
+
+    // drop re-fire request of a dead event, the slot may be reused
+    if (fe->flags & AE_PENDING) {
+        for (int j = 0; j < eventLoop->npending; j++)
+            if (eventLoop->pending[j].fe == fe) eventLoop->pending[j].fe = NULL;
+        fe->flags &= ~AE_PENDING;
+    }
+
+    // push back to the free list
+    fe->next = eventLoop->efhead;
+    eventLoop->efhead = fe->id;
+}
+
 void aeDeleteFileEvent(aeEventLoop* eventLoop, xSocket fd, aeFileEvent* fe, int mask) {
     if (fe->mask == AE_NONE) return;
 
     fe->mask = fe->mask & (~mask);
-    if (fe->mask == AE_NONE) {
-        if (fd == eventLoop->maxfd) {
-            /* Update the max fd */
-            int j = 0;
-            for (j = (int)eventLoop->maxfd - 1; j >= 0; j--)
-                if (eventLoop->events[j].mask != AE_NONE) break;
-            eventLoop->maxfd = j;
-        }
-        aeApiDelEvent(eventLoop, fd, mask);
+    /* partial deletes must reach the backend too, or a level-triggered
+     * AE_WRITABLE left in the kernel wakes the loop on every poll */
+    aeApiDelEvent(eventLoop, fd, mask, fe);
+    if (fe->mask == AE_NONE && !(fe->flags & AE_HOLD))
+        aeFreeFileEvent(eventLoop, fd, fe);
+}
+
+/* hold: the slot survives its mask dropping to AE_NONE, so all interest can
+ * be removed for a while and brought back with aeEnableFileEvent. releasing
+ * the hold on an event with no mask left frees it. */
+void aeHoldFileEvent(aeEventLoop* eventLoop, xSocket fd, aeFileEvent* fe, int hold) {
+    if (hold) {
+        fe->flags |= AE_HOLD;
+        return;
+    }
+    if (!(fe->flags & AE_HOLD)) return;
+    fe->flags &= ~AE_HOLD;
+    if (fe->mask == AE_NONE)
+        aeFreeFileEvent(eventLoop, fd, fe);
+}
 
-        // swap to free node
-        if (fe->slot != eventLoop->efhead) {
-            short int slot = fe->slot;
-            fe->slot = eventLoop->efhead;
-            eventLoop->efhead = slot;
+int aeEnableFileEvent(aeEventLoop* eventLoop, xSocket fd, aeFileEvent* fe, int mask) {
+    mask &= AE_READABLE | AE_WRITABLE;
+    if (fe->mask == AE_NONE && !(fe->flags & AE_HOLD)) return AE_ERR;    // freed, use aeCreateFileEvent
+    if ((fe->mask & mask) == mask) return AE_OK;
+    /* completion based events: the mask only tracks the op in flight */
+#if defined(HAVE_IOURING)
+    if (!(fe->flags & AE_IOCOMP) && aeApiAddEvent(eventLoop, fd, mask, fe) == -1) return AE_ERR;
+#elif !defined(HAVE_IOCP)
+    if (aeApiAddEvent(eventLoop, fd, mask, fe) == -1) return AE_ERR;
+#endif
+    fe->mask |= mask;
+    return AE_OK;
+}
+
+static void aeFireEvent(aeEventLoop *eventLoop, aeFiredEvent *fired) {
+    aeFileEvent* fe = fired->fe;
+    int mask = fired->mask;
+    int rfired = 0;
+
+    /* note the fe->mask & mask & ... code: maybe an already processed
+     * event removed an element that fired and we still didn't
+     * processed, so we check if the event is still valid. */
+#ifdef HAVE_IOURING
+    eventLoop->rdata = fired->data;
+#endif
+    if (fe->mask & mask & AE_READABLE) {
+        rfired = 1;
+        fe->rfileProc(eventLoop, fired->fd, fe->clientData, mask, fired->trans);
+    }
+    if (fe->mask & mask & AE_WRITABLE) {
+        if (!rfired || fe->wfileProc != fe->rfileProc)
+            fe->wfileProc(eventLoop, fired->fd, fe->clientData, mask, fired->trans);
+    }
+}
+
+/* ---------------- instrumentation ---------------- */
+static unsigned long long aeMonoUs(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)(now.QuadPart / freq.QuadPart * 1000000 +
+        now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/* 0-3 exact, then 4 linear sub-buckets per power of two */
+static int aeHistIndex(unsigned long long v) {
+    int e = 0, idx;
+    if (v < 4) return (int)v;
+#if defined(__GNUC__) || defined(__clang__)
+    e = 63 - __builtin_clzll(v);
+#else
+    while (v >> (e + 1)) e++;
+#endif
+    idx = (e - 1) * 4 + (int)((v >> (e - 2)) & 3);
+    return idx < AE_HIST_BUCKETS ? idx : AE_HIST_BUCKETS - 1;
+}
+
+static void aeHistRecord(aeHist *hist, unsigned long long v) {
+    hist->count++;
+    hist->sum += v;
+    if (v > hist->max) hist->max = v;
+    hist->buckets[aeHistIndex(v)]++;
+}
+
+unsigned long long aeHistPercentile(const aeHist *hist, double percentile) {
+    unsigned long long rank, seen = 0;
+    int i;
+    if (!hist || !hist->count) return 0;
+    rank = (unsigned long long)(hist->count * percentile / 100.0);
+    if (rank >= hist->count) rank = hist->count - 1;
+    for (i = 0; i < AE_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen > rank) {
+            unsigned long long upper;
+            int e = i / 4 + 1;
+            if (i < 4) upper = (unsigned long long)i;
+            else upper = ((unsigned long long)(4 + i % 4 + 1) << (e - 2)) - 1;
+            return upper < hist->max ? upper : hist->max;
         }
     }
+    return hist->max;
+}
+
+static void aeStatsTimerLate(void *ud, long64 late_us) {
+    aeHistRecord(&((aeStats*)ud)->timer, late_us > 0 ? (unsigned long long)late_us : 0);
+}
+
+int aeEnableStats(aeEventLoop *eventLoop, int enable) {
+    if (enable && !eventLoop->stats) {
+        eventLoop->stats = zcalloc(sizeof(aeStats));
+        if (!eventLoop->stats) return AE_ERR;
+        xtimer_set_observer(aeStatsTimerLate, eventLoop->stats);
+    } else if (!enable && eventLoop->stats) {
+        /* the observer is per thread, another loop may have taken it since */
+        xtimer_clear_observer(eventLoop->stats);
+        zfree(eventLoop->stats);
+        eventLoop->stats = NULL;
+    }
+    return AE_OK;
+}
+
+const aeStats *aeGetStats(aeEventLoop *eventLoop) {
+    return eventLoop->stats;
+}
+
+void aeResetStats(aeEventLoop *eventLoop) {
+    if (eventLoop->stats) memset(eventLoop->stats, 0, sizeof(aeStats));
+}
+
+static void aeShowHist(const char *name, const aeHist *hist) {
+    printf("  %-9s n=%llu avg=%llu p50=%llu p99=%llu p999=%llu max=%llu\n", name,
+        hist->count, hist->count ? hist->sum / hist->count : 0,
+        aeHistPercentile(hist, 50), aeHistPercentile(hist, 99),
+        aeHistPercentile(hist, 99.9), hist->max);
+}
+
+void aeShowStats(aeEventLoop *eventLoop) {
+    const aeStats *st = eventLoop->stats;
+    if (!st) return;
+    printf("=== aeEventLoop %p, %llu iterations (us) ===\n", (void*)eventLoop, st->iterations);
+    aeShowHist("poll", &st->poll);
+    aeShowHist("callback", &st->callback);
+    aeShowHist("timerlate", &st->timer);
+    aeShowHist("events", &st->events);
+    if (st->spins)
+        printf("  busy-poll %llu spins, %llu hits, %llu sleeps, %.1f%% of wakeups while spinning\n",
+            st->spins, st->spinhits, st->sleeps, st->spinhits * 100.0 / (st->spinhits + st->sleeps));
+    printf("  slowest callback %lluus proc=%p fd=%d mask=%d\n", st->slowest.us,
+        (void*)(intptr_t)st->slowest.proc, (int)st->slowest.fd, st->slowest.mask);
+}
+
+/* aeFireEvent with timing, the proc is picked before the call: it may
+ * delete the event */
+static void aeFireEventTimed(aeEventLoop *eventLoop, aeFiredEvent *fired) {
+    aeStats *st = eventLoop->stats;
+    aeFileEvent *fe = fired->fe;
+    aeFileProc *proc = (fe->mask & fired->mask & AE_READABLE) ? fe->rfileProc : fe->wfileProc;
+    unsigned long long start = aeMonoUs(), us;
+
+    aeFireEvent(eventLoop, fired);
+    us = aeMonoUs() - start;
+    aeHistRecord(&st->callback, us);
+    if (us > st->slowest.us) {
+        st->slowest.us = us;
+        st->slowest.proc = proc;
+        st->slowest.fd = fired->fd;
+        st->slowest.mask = fired->mask;
+    }
 }
 
 /* Process every pending time event, then every pending file event
@@ -240,30 +473,41 @@ void aeDeleteFileEvent(aeEventLoop* eventLoop, xSocket fd, aeFileEvent* fe, int
  * The function returns the number of events processed. */
 int aeProcessEvents(aeEventLoop *eventLoop, int flags) {
     int processed = 0, numevents;
+    aeStats *st = eventLoop->stats;
 
     /* Nothing to do? return ASAP */
     if (!(flags & AE_TIME_EVENTS) && !(flags & AE_FILE_EVENTS)) return 0;
 
+    /* write out what was coalesced during the last iteration, before the
+     * timeout is chosen: a flush may queue pending events */
+    if (eventLoop->flushproc != NULL)
+        eventLoop->flushproc(eventLoop);
+
     /* Note that we want call select() even if there are no
      * file events to process as long as we want to process time
      * events, in order to sleep until the next time event is ready
      * to fire. */
-    if (eventLoop->maxfd != 0 || eventLoop->fdWaitSlot !=-1 ||
+    if (eventLoop->count != 0 || eventLoop->fdWaitSlot !=-1 || eventLoop->npending ||
         ((flags & AE_TIME_EVENTS) && !(flags & AE_DONT_WAIT))) {
         int j;
         struct timeval tv, *tvp;
 
-        int interval = -1;
+        long long interval = -1;        /* us */
         if (flags & AE_TIME_EVENTS)
-            interval = xtimer_last();
-        if (interval >= 0) {
+            interval = xtimer_last_us();
+        if (eventLoop->npending) {
+            /* edge-triggered events left unfinished, don't sleep */
+            tv.tv_sec = 0;
+            tv.tv_usec = 0;
+            tvp = &tv;
+        } else if (interval >= 0) {
             tvp = &tv;
             if (flags & AE_DONT_WAIT) {
                 tvp->tv_sec = 0;
-                tvp->tv_usec = interval > 10 ?(10000):(interval*1000);
+                tvp->tv_usec = interval > 10000 ? 10000 : (long)interval;
             } else {
-                tvp->tv_sec = interval / 1000;
-                tvp->tv_usec = (interval % 1000) * 1000;
+                tvp->tv_sec = (long)(interval / 1000000);
+                tvp->tv_usec = (long)(interval % 1000000);
             }
         } else {
             /* If we have to check for events but need to return
@@ -279,27 +523,70 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags) {
             }
         }
 
+        /* busy-poll: 刚处理过事件, 窗口内只做零超时轮询, 省掉调度唤醒的延迟 */
+        int spin = 0;
+        if (eventLoop->spinus && (!tvp || tvp->tv_sec || tvp->tv_usec) &&
+            aeMonoUs() - eventLoop->lastactive < (unsigned long long)eventLoop->spinus) {
+            tv.tv_sec = 0;
+            tv.tv_usec = 0;
+            tvp = &tv;
+            spin = 1;
+        }
+
+#ifndef HAVE_IOCP
+        /* 有人在我们醒着时投递过任务就不睡, 否则标记睡眠让aeWakerSignal写fd */
+        int waker = eventLoop->waker.fd[0] >= 0 && (!tvp || tvp->tv_sec || tvp->tv_usec);
+        if (waker && aeWakerSleep(&eventLoop->waker)) {
+            tv.tv_sec = 0;
+            tv.tv_usec = 0;
+            tvp = &tv;
+        }
+        unsigned long long start = st ? aeMonoUs() : 0;
         numevents = aeApiPoll(eventLoop, tvp);
-        for (j = 0; j < numevents; j++) {
-            aeFileEvent* fe = eventLoop->fired[j].fe;// &eventLoop->events[eventLoop->fired[j].fd];
-            int mask = eventLoop->fired[j].mask;
-            xSocket fd = eventLoop->fired[j].fd;
-            int trans = eventLoop->fired[j].trans;
-            int rfired = 0;
-
-	        /* note the fe->mask & mask & ... code: maybe an already processed
-             * event removed an element that fired and we still didn't
-             * processed, so we check if the event is still valid. */
-            if (fe->mask & mask & AE_READABLE) {
-                rfired = 1;
-                fe->rfileProc(eventLoop, fd, fe->clientData, mask, trans);
-            }
-            if (fe->mask & mask & AE_WRITABLE) {
-                if (!rfired || fe->wfileProc != fe->rfileProc)
-                    fe->wfileProc(eventLoop, fd, fe->clientData, mask, trans);
+        if (waker) aeWakerAwake(&eventLoop->waker);
+#else
+        unsigned long long start = st ? aeMonoUs() : 0;
+        numevents = aeApiPoll(eventLoop, tvp);
+#endif
+        if (st) {
+            aeHistRecord(&st->poll, aeMonoUs() - start);
+            if (spin) {
+                st->spins++;
+                if (numevents > 0) st->spinhits++;
+            } else if (!tvp || tvp->tv_sec || tvp->tv_usec) {
+                st->sleeps++;
             }
+        }
+        for (j = 0; j < numevents; j++) {
+            if (st) aeFireEventTimed(eventLoop, &eventLoop->fired[j]);
+            else aeFireEvent(eventLoop, &eventLoop->fired[j]);
+            processed++;
+        }
+
+        /* re-fire events that stopped at their budget last time. callbacks
+         * may queue again, those stay for the next iteration; copy the entry
+         * because aeMarkPending can move the array. */
+        numevents = eventLoop->npending;
+        for (j = 0; j < numevents; j++) {
+            aeFiredEvent fired = eventLoop->pending[j];
+            if (!fired.fe) continue;    // deleted meanwhile
+            fired.fe->flags &= ~AE_PENDING;
+            eventLoop->pending[j].fe = NULL;
+            if (st) aeFireEventTimed(eventLoop, &fired);
+            else aeFireEvent(eventLoop, &fired);
             processed++;
         }
+        if (numevents > 0) {
+            eventLoop->npending -= numevents;
+            memmove(eventLoop->pending, eventLoop->pending + numevents,
+                sizeof(aeFiredEvent) * eventLoop->npending);
+        }
+        if (st) {
+            st->iterations++;
+            aeHistRecord(&st->events, (unsigned long long)processed);
+        }
+        if (eventLoop->spinus && processed)
+            eventLoop->lastactive = aeMonoUs();
     }
 
     /* Check time events */
@@ -350,25 +637,134 @@ void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep
     eventLoop->beforesleep = beforesleep;
 }
 
+void aeSetFlushProc(aeEventLoop *eventLoop, aeBeforeSleepProc *flushproc) {
+    eventLoop->flushproc = flushproc;
+}
+
+void aeSetEdgeTriggered(aeEventLoop *eventLoop, int enable) {
+#if defined(HAVE_EPOLL) || defined(HAVE_KQUEUE)
+    if (enable) eventLoop->flags |= AE_EDGE;
+    else eventLoop->flags &= ~AE_EDGE;
+#else
+    (void)eventLoop; (void)enable;  // completion based backend, nothing to drain
+#endif
+}
+
+void aeSetIoBudget(aeEventLoop *eventLoop, int budget) {
+    eventLoop->budget = budget > 0 ? budget : AE_IO_BUDGET;
+}
+
+int aeGetIoBudget(aeEventLoop *eventLoop) {
+    return eventLoop->budget;
+}
+
+void aeSetBusyPoll(aeEventLoop *eventLoop, int us) {
+    eventLoop->spinus = us > 0 ? us : 0;
+    eventLoop->lastactive = 0;
+}
+
+int aeGetBusyPoll(aeEventLoop *eventLoop) {
+    return eventLoop->spinus;
+}
+
+/* Queue fe to be fired again with mask on the next aeProcessEvents, without
+ * waiting for the kernel: an edge-triggered fd that still has data after its
+ * budget won't be reported again by epoll/kqueue. */
+void aeMarkPending(aeEventLoop *eventLoop, xSocket fd, aeFileEvent *fe, int mask) {
+    aeFiredEvent *fired;
+    if (!fe || !(fe->mask & mask)) return;
+    if (fe->flags & AE_PENDING) {
+        for (int j = 0; j < eventLoop->npending; j++) {
+            if (eventLoop->pending[j].fe == fe) {
+                eventLoop->pending[j].mask |= mask;
+                return;
+            }
+        }
+    }
+    if (eventLoop->npending == eventLoop->pendingsize) {
+        int size = eventLoop->pendingsize ? eventLoop->pendingsize * 2 : 64;
+        eventLoop->pending = zrealloc(eventLoop->pending, sizeof(aeFiredEvent) * size);
+        eventLoop->pendingsize = size;
+    }
+    fired = &eventLoop->pending[eventLoop->npending++];
+    fired->fd = fd;
+    fired->mask = mask;
+    fired->trans = 0;
+    fired->fe = fe;
+#ifdef HAVE_IOURING
+    fired->data = NULL;
+#endif
+    fe->flags |= AE_PENDING;
+}
+
 #ifndef HAVE_IOCP
-static int aeSignalProc(struct aeEventLoop *eventLoop, xSocket fd, void *clientData, int mask, int trans) {
+#define AE_WAKER_SLEEPING 1
+#define AE_WAKER_SIGNALED 2
+
+int aeWakerInit(aeWaker *w) {
+    w->state = 0;
+#ifdef __linux__
+    w->fd[0] = w->fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (w->fd[0] >= 0) return AE_OK;
+#else
+    if (pipe(w->fd) == 0) {
+        fcntl(w->fd[0], F_SETFL, O_NONBLOCK);
+        fcntl(w->fd[1], F_SETFL, O_NONBLOCK);
+        return AE_OK;
+    }
+#endif
+    w->fd[0] = w->fd[1] = -1;
+    return AE_ERR;
+}
+
+void aeWakerFree(aeWaker *w) {
+    if (w->fd[0] >= 0) close(w->fd[0]);
+    if (w->fd[1] >= 0 && w->fd[1] != w->fd[0]) close(w->fd[1]);
+    w->fd[0] = w->fd[1] = -1;
+}
+
+/* only the first signal after the owner went to sleep costs a write */
+int aeWakerSignal(aeWaker *w) {
+    uint64_t one = 1;
+    int old = __atomic_fetch_or(&w->state, AE_WAKER_SIGNALED, __ATOMIC_SEQ_CST);
+    if (old != AE_WAKER_SLEEPING) return AE_OK;
+    if (write(w->fd[1], &one, sizeof(one)) < 0 && errno != EAGAIN) return AE_ERR;
+    return AE_OK;
+}
+
+int aeWakerSleep(aeWaker *w) {
+    return (__atomic_fetch_or(&w->state, AE_WAKER_SLEEPING, __ATOMIC_SEQ_CST) & AE_WAKER_SIGNALED) != 0;
+}
+
+/* returns non-zero if signaled since aeWakerSleep */
+int aeWakerAwake(aeWaker *w) {
+    return (__atomic_exchange_n(&w->state, 0, __ATOMIC_SEQ_CST) & AE_WAKER_SIGNALED) != 0;
+}
+
+void aeWakerDrain(aeWaker *w) {
     char buf[64];
-    while (read((int)clientData, buf, sizeof(buf)) > 0);
+    /* eventfd: one read resets the counter and returns 8 bytes */
+    while (read(w->fd[0], buf, sizeof(buf)) == sizeof(buf));
+}
+
+static int aeSignalProc(struct aeEventLoop *eventLoop, xSocket fd, void *clientData, int mask, int trans) {
+    aeWakerDrain((aeWaker*)clientData);
     return AE_OK;
 }
 #endif
 
 void aeCreateSignalFile(aeEventLoop* eventLoop) {
-    eventLoop->fdWaitSlot = eventLoop->efhead;
 #ifndef HAVE_IOCP
-    if (eventLoop->signal_fd[0] != 0) return;
-    if (socketpair(AF_UNIX, SOCK_STREAM, 0, eventLoop->signal_fd) == 0) {
-        fcntl(eventLoop->signal_fd[0], F_SETFL, O_NONBLOCK);
-        fcntl(eventLoop->signal_fd[1], F_SETFL, O_NONBLOCK);
-
-        aeCreateFileEvent(eventLoop, eventLoop->signal_fd[1], AE_READABLE, aeSignalProc, NULL, NULL);
+    aeFileEvent *fe;
+    if (eventLoop->waker.fd[0] >= 0) return;
+    if (aeWakerInit(&eventLoop->waker) == AE_OK) {
+        if (aeCreateFileEvent(eventLoop, eventLoop->waker.fd[0], AE_READABLE, aeSignalProc, &eventLoop->waker, &fe) == AE_OK)
+            eventLoop->fdWaitSlot = fe->id;
+        else
+            aeWakerFree(&eventLoop->waker);
     }
 #else
+    eventLoop->fdWaitSlot = 0;      // no file event, just marks the wakeup as present
     aeApiAddEvent(eventLoop, -1, 0, NULL);
 #endif
 }
@@ -379,20 +775,29 @@ void aeDeleteSignalFile(aeEventLoop* eventLoop) {
     eventLoop->fdWaitSlot = -1;
 
 #ifndef HAVE_IOCP
-    aeDeleteFileEvent(eventLoop, eventLoop->signal_fd[1], &eventLoop->events[slot], AE_READABLE);
+    aeDeleteFileEvent(eventLoop, eventLoop->waker.fd[0], aeGetEvent(eventLoop, slot), AE_READABLE);
+    aeWakerFree(&eventLoop->waker);
 #else
-    aeApiDelEvent(eventLoop, -1, 0);
+    aeApiDelEvent(eventLoop, -1, 0, NULL);
 #endif
 }
 
 void aeGetSignalFile(aeEventLoop *eventLoop, xSocket* fdSignal){
 #ifndef HAVE_IOCP
-    *fdSignal = eventLoop->signal_fd[0];
+    *fdSignal = eventLoop->waker.fd[1];     /* eventfd: write 8 bytes */
 #else
     *fdSignal = aeApiGetStateFD(eventLoop);
 #endif
 }
 
+void *aeGetWakeHandle(aeEventLoop *eventLoop) {
+#ifndef HAVE_IOCP
+    return eventLoop->waker.fd[0] >= 0 ? &eventLoop->waker : NULL;
+#else
+    return (void*)aeApiGetStateFD(eventLoop);
+#endif
+}
+
 
 // all ae implementation
 //
@@ -453,14 +858,15 @@ static int aeApiAddEvent(aeEventLoop* eventLoop, xSocket fd, int mask, aeFileEve
     return 0;
 }
 
-static void aeApiDelEvent(aeEventLoop* eventLoop, xSocket fd, int mask) {
+static void aeApiDelEvent(aeEventLoop* eventLoop, xSocket fd, int mask, aeFileEvent* fe) {
     aeApiState* state = eventLoop->apidata;
+    if (fe && fe->mask != AE_NONE) return;     // partial, completion ports have no interest mask
     state->eventCount--;
 }
 
 static int aeApiPoll(aeEventLoop* eventLoop, struct timeval* tvp) {
     aeApiState* state = eventLoop->apidata;
-    DWORD timeout = tvp ? (tvp->tv_sec * 1000 + tvp->tv_usec / 1000) : INFINITE;
+    DWORD timeout = tvp ? (tvp->tv_sec * 1000 + (tvp->tv_usec + 999) / 1000) : INFINITE;
     int numevents = 0;
 
     if (state->eventCount == 0 && state) {
@@ -571,34 +977,13 @@ void panic(const char* fmt, ...) {
 typedef struct aeApiState {
     int kqfd;
     struct kevent* events;
-
-    /* Events mask for merge read and write event.
-     * To reduce memory consumption, we use 2 bits to store the mask
-     * of an event, so that 1 byte will store the mask of 4 events. */
-    char* eventsMask;
 } aeApiState;
 
-#define EVENT_MASK_MALLOC_SIZE(sz) (((sz) + 3) / 4)
-#define EVENT_MASK_OFFSET(fd) ((fd) % 4 * 2)
-#define EVENT_MASK_ENCODE(fd, mask) (((mask) & 0x3) << EVENT_MASK_OFFSET(fd))
-
-static inline int getEventMask(const char* eventsMask, int fd) {
-    return (eventsMask[fd / 4] >> EVENT_MASK_OFFSET(fd)) & 0x3;
-}
-
-static inline void addEventMask(char* eventsMask, int fd, int mask) {
-    eventsMask[fd / 4] |= EVENT_MASK_ENCODE(fd, mask);
-}
-
-static inline void resetEventMask(char* eventsMask, int fd) {
-    eventsMask[fd / 4] &= ~EVENT_MASK_ENCODE(fd, 0x3);
-}
-
 static int aeApiCreate(aeEventLoop* eventLoop) {
     aeApiState* state = zmalloc(sizeof(aeApiState));
 
     if (!state) return -1;
-    state->events = zmalloc(sizeof(struct kevent) * eventLoop->setsize);
+    state->events = zmalloc(sizeof(struct kevent) * eventLoop->nfired);
     if (!state->events) {
         zfree(state);
         return -1;
@@ -610,18 +995,13 @@ static int aeApiCreate(aeEventLoop* eventLoop) {
         return -1;
     }
     //anetCloexec(state->kqfd);
-    state->eventsMask = zmalloc(EVENT_MASK_MALLOC_SIZE(eventLoop->setsize));
-    memset(state->eventsMask, 0, EVENT_MASK_MALLOC_SIZE(eventLoop->setsize));
     eventLoop->apidata = state;
     return 0;
 }
 
 static int aeApiResize(aeEventLoop* eventLoop, int setsize) {
-    aeApiState* state = eventLoop->apidata;
-
-    state->events = zrealloc(state->events, sizeof(struct kevent) * setsize);
-    state->eventsMask = zrealloc(state->eventsMask, EVENT_MASK_MALLOC_SIZE(setsize));
-    memset(state->eventsMask, 0, EVENT_MASK_MALLOC_SIZE(setsize));
+    (void)(eventLoop);
+    (void)(setsize);
     return 0;
 }
 
@@ -630,7 +1010,6 @@ static void aeApiFree(aeEventLoop* eventLoop) {
 
     close(state->kqfd);
     zfree(state->events);
-    zfree(state->eventsMask);
     zfree(state);
 }
 
@@ -639,17 +1018,17 @@ static int aeApiAddEvent(aeEventLoop* eventLoop, int fd, int mask, aeFileEvent*
     struct kevent ke;
 
     if (mask & AE_READABLE) {
-        EV_SET(&ke, fd, EVFILT_READ, EV_ADD, 0, 0, (void*)fe);
+        EV_SET(&ke, fd, EVFILT_READ, EV_ADD | ((fe->flags & AE_EDGE) ? EV_CLEAR : 0), 0, 0, (void*)fe);
         if (kevent(state->kqfd, &ke, 1, NULL, 0, NULL) == -1) return -1;
     }
     if (mask & AE_WRITABLE) {
-        EV_SET(&ke, fd, EVFILT_WRITE, EV_ADD, 0, 0, (void*)fe);
+        EV_SET(&ke, fd, EVFILT_WRITE, EV_ADD | ((fe->flags & AE_EDGE) ? EV_CLEAR : 0), 0, 0, (void*)fe);
         if (kevent(state->kqfd, &ke, 1, NULL, 0, NULL) == -1) return -1;
     }
     return 0;
 }
 
-static void aeApiDelEvent(aeEventLoop* eventLoop, int fd, int mask) {
+static void aeApiDelEvent(aeEventLoop* eventLoop, int fd, int mask, aeFileEvent* fe) {
     aeApiState* state = eventLoop->apidata;
     struct kevent ke;
 
@@ -671,11 +1050,11 @@ static int aeApiPoll(aeEventLoop* eventLoop, struct timeval* tvp) {
         struct timespec timeout;
         timeout.tv_sec = tvp->tv_sec;
         timeout.tv_nsec = tvp->tv_usec * 1000;
-        retval = kevent(state->kqfd, NULL, 0, state->events, eventLoop->setsize,
+        retval = kevent(state->kqfd, NULL, 0, state->events, eventLoop->nfired,
             &timeout);
     }
     else {
-        retval = kevent(state->kqfd, NULL, 0, state->events, eventLoop->setsize,
+        retval = kevent(state->kqfd, NULL, 0, state->events, eventLoop->nfired,
             NULL);
     }
 
@@ -687,34 +1066,28 @@ static int aeApiPoll(aeEventLoop* eventLoop, struct timeval* tvp) {
          *
          * However, under kqueue, read and write events would be separate
          * events, which would make it impossible to control the order of
-         * reads and writes. So we store the event's mask we've got and merge
-         * the same fd events later. */
+         * reads and writes. So we merge the events of the same file event,
+         * fe->change holds its index in fired meanwhile. */
         for (j = 0; j < retval; j++) {
             struct kevent* e = state->events + j;
-            int fd = e->ident;
+            aeFileEvent* fe = (aeFileEvent*)e->udata;
             int mask = 0;
 
             if (e->filter == EVFILT_READ) mask = AE_READABLE;
             else if (e->filter == EVFILT_WRITE) mask = AE_WRITABLE;
-            addEventMask(state->eventsMask, fd, mask);
-        }
-
-        /* Re-traversal to merge read and write events, and set the fd's mask to
-         * 0 so that events are not added again when the fd is encountered again. */
-        numevents = 0;
-        for (j = 0; j < retval; j++) {
-            struct kevent* e = state->events + j;
-            int fd = e->ident;
-            int mask = getEventMask(state->eventsMask, fd);
-            if (mask) {
-                eventLoop->fired[numevents].fd = fd;
-                eventLoop->fired[numevents].mask = mask;
-                eventLoop->fired[numevents].trans = (int)e->data;
-                eventLoop->fired[numevents].fe = (aeFileEvent*)e->udata;
-                resetEventMask(state->eventsMask, fd);
-                numevents++;
+            if (fe->change >= 0) {
+                eventLoop->fired[fe->change].mask |= mask;
+                continue;
             }
+            fe->change = numevents;
+            eventLoop->fired[numevents].fd = (xSocket)e->ident;
+            eventLoop->fired[numevents].mask = mask;
+            eventLoop->fired[numevents].trans = (int)e->data;
+            eventLoop->fired[numevents].fe = fe;
+            numevents++;
         }
+        for (j = 0; j < numevents; j++)
+            eventLoop->fired[j].fe->change = -1;
     }
     else if (retval == -1 && errno != EINTR) {
         panic("aeApiPoll: kevent, %s", strerror(errno));
@@ -726,12 +1099,419 @@ static int aeApiPoll(aeEventLoop* eventLoop, struct timeval* tvp) {
 static char* aeApiName(void) {
     return "kqueue";
 }
+#elif defined(HAVE_IOURING)
+/* Linux io_uring(7) based ae.c module, build with liburing >= 2.4.
+ *
+ * Two kinds of file events live on the same ring:
+ *  - plain events are multishot POLL_ADD, readiness like epoll. every wakeup
+ *    is reported once, so they are flagged AE_EDGE and callbacks must drain.
+ *  - AE_IOCOMP events are completion based like iocp: the owner posts
+ *    aeUringAccept/aeUringRecv/aeUringSend and gets the result in trans
+ *    (accepted fd, bytes received/sent, 0 for EOF or error). multishot recv
+ *    lands in a provided buffer ring, aeUringRecvData() points at the bytes
+ *    while the callback runs and the buffer goes back to the ring on the
+ *    next poll.
+ * SQEs are only queued here and submitted once per loop iteration together
+ * with the wait, so a busy loop costs one io_uring_enter per round. */
+
+#include <liburing.h>
+#include <poll.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+__attribute__((noreturn))
+void panic(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "PANIC: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(EXIT_FAILURE);
+}
+
+#ifndef AE_URING_DEPTH
+#define AE_URING_DEPTH      4096        /* SQ entries, CQ is 4 times */
+#endif
+#ifndef AE_URING_NBUFS
+#define AE_URING_NBUFS      1024        /* provided recv buffers, power of 2 */
+#endif
+#ifndef AE_URING_BUFSIZE
+#define AE_URING_BUFSIZE    (16*1024)
+#endif
+#define AE_URING_BGID       0
+
+/* user_data: gen(32) | slot(29) | op(3) */
+#define AE_URING_NONE       0
+#define AE_URING_POLL       1
+#define AE_URING_ACCEPT     2
+#define AE_URING_RECV       3
+#define AE_URING_SEND       4
+
+typedef struct aeUringSlot {
+    unsigned int gen;           /* bumped on delete, stale CQEs are dropped */
+    int     fd;
+    short   mask;
+    short   sending;
+    short   polling;            /* a multishot poll for mask is armed */
+} aeUringSlot;
+
+typedef struct aeApiState {
+    struct io_uring ring;
+    struct io_uring_buf_ring* br;
+    char*   bufs;
+    int*    recycle;            /* buffer ids handed to callbacks last round */
+    int     nrecycle;
+    aeUringSlot* slots;         /* indexed by aeFileEvent.id */
+    int     nslots;
+} aeApiState;
+
+static inline uint64_t aeUringData(aeApiState* state, int idx, int op) {
+    return ((uint64_t)state->slots[idx].gen << 32) | ((uint64_t)idx << 3) | (uint64_t)op;
+}
+
+static struct io_uring_sqe* aeUringGetSqe(aeApiState* state) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&state->ring);
+    if (!sqe) {
+        /* SQ full, flush the batch early */
+        io_uring_submit(&state->ring);
+        sqe = io_uring_get_sqe(&state->ring);
+    }
+    return sqe;
+}
+
+static aeUringSlot* aeUringSlotOf(aeEventLoop* eventLoop, aeFileEvent* fe, int* idx) {
+    aeApiState* state = eventLoop->apidata;
+    int i = fe->id;
+    if (i >= state->nslots) {
+        int n = state->nslots ? state->nslots : 1024;
+        while (n <= i) n *= 2;
+        state->slots = zrealloc(state->slots, sizeof(aeUringSlot) * n);
+        memset(state->slots + state->nslots, 0, sizeof(aeUringSlot) * (n - state->nslots));
+        state->nslots = n;
+    }
+    *idx = i;
+    return &state->slots[i];
+}
+
+static int aeApiCreate(aeEventLoop* eventLoop) {
+    aeApiState* state = zmalloc(sizeof(aeApiState));
+    struct io_uring_params params;
+    int ret, i;
+
+    if (!state) return -1;
+    memset(state, 0, sizeof(*state));
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = AE_URING_DEPTH * 4;
+    ret = io_uring_queue_init_params(AE_URING_DEPTH, &state->ring, &params);
+    if (ret == -EINVAL) {
+        /* kernel < 5.19 */
+        memset(&params, 0, sizeof(params));
+        ret = io_uring_queue_init_params(AE_URING_DEPTH, &state->ring, &params);
+    }
+    if (ret < 0) {
+        fprintf(stderr, "io_uring_queue_init failed: %s\n", strerror(-ret));
+        zfree(state);
+        return -1;
+    }
+
+    state->br = io_uring_setup_buf_ring(&state->ring, AE_URING_NBUFS, AE_URING_BGID, 0, &ret);
+    state->bufs = zmalloc((size_t)AE_URING_NBUFS * AE_URING_BUFSIZE);
+    state->recycle = zmalloc(sizeof(int) * AE_URING_NBUFS);
+    if (!state->br || !state->bufs || !state->recycle) {
+        fprintf(stderr, "io_uring provided buffers failed: %s\n", strerror(-ret));
+        if (state->br) io_uring_free_buf_ring(&state->ring, state->br, AE_URING_NBUFS, AE_URING_BGID);
+        io_uring_queue_exit(&state->ring);
+        zfree(state->bufs);
+        zfree(state->recycle);
+        zfree(state);
+        return -1;
+    }
+    for (i = 0; i < AE_URING_NBUFS; i++)
+        io_uring_buf_ring_add(state->br, state->bufs + (size_t)i * AE_URING_BUFSIZE, AE_URING_BUFSIZE,
+            i, io_uring_buf_ring_mask(AE_URING_NBUFS), i);
+    io_uring_buf_ring_advance(state->br, AE_URING_NBUFS);
+
+    eventLoop->apidata = state;
+    return 0;
+}
+
+static int aeApiResize(aeEventLoop* eventLoop, int setsize) {
+    (void)(eventLoop);
+    (void)(setsize);
+    return 0;
+}
+
+static void aeApiFree(aeEventLoop* eventLoop) {
+    aeApiState* state = eventLoop->apidata;
+    if (!state) return;
+    io_uring_free_buf_ring(&state->ring, state->br, AE_URING_NBUFS, AE_URING_BGID);
+    io_uring_queue_exit(&state->ring);
+    zfree(state->bufs);
+    zfree(state->recycle);
+    zfree(state->slots);
+    zfree(state);
+}
+
+static int aeUringArmPoll(aeApiState* state, int idx) {
+    aeUringSlot* slot = &state->slots[idx];
+    struct io_uring_sqe* sqe = aeUringGetSqe(state);
+    unsigned int events = 0;
+    if (!sqe) return -1;
+    if (slot->mask & AE_READABLE) events |= POLLIN;
+    if (slot->mask & AE_WRITABLE) events |= POLLOUT;
+    io_uring_prep_poll_multishot(sqe, slot->fd, events);
+    io_uring_sqe_set_data64(sqe, aeUringData(state, idx, AE_URING_POLL));
+    slot->polling = 1;
+    return 0;
+}
+
+/* a multishot poll can't change its events: remove the armed one, whose
+ * late CQEs the gen bump drops, and arm a new one for slot->mask */
+static int aeUringRepoll(aeApiState* state, int idx) {
+    aeUringSlot* slot = &state->slots[idx];
+    if (slot->polling) {
+        struct io_uring_sqe* sqe = aeUringGetSqe(state);
+        if (!sqe) return -1;
+        io_uring_prep_poll_remove(sqe, aeUringData(state, idx, AE_URING_POLL));
+        io_uring_sqe_set_data64(sqe, AE_URING_NONE);
+        slot->gen++;
+        slot->polling = 0;
+    }
+    return slot->mask ? aeUringArmPoll(state, idx) : 0;
+}
+
+static int aeUringArmAccept(aeApiState* state, int idx) {
+    struct io_uring_sqe* sqe = aeUringGetSqe(state);
+    if (!sqe) return -1;
+    io_uring_prep_multishot_accept(sqe, state->slots[idx].fd, NULL, NULL, 0);
+    io_uring_sqe_set_data64(sqe, aeUringData(state, idx, AE_URING_ACCEPT));
+    return 0;
+}
+
+static int aeUringArmRecv(aeApiState* state, int idx) {
+    struct io_uring_sqe* sqe = aeUringGetSqe(state);
+    if (!sqe) return -1;
+    io_uring_prep_recv_multishot(sqe, state->slots[idx].fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = AE_URING_BGID;
+    io_uring_sqe_set_data64(sqe, aeUringData(state, idx, AE_URING_RECV));
+    return 0;
+}
+
+static int aeApiAddEvent(aeEventLoop* eventLoop, xSocket fd, int mask, aeFileEvent* fe) {
+    aeApiState* state = eventLoop->apidata;
+    int idx;
+    aeUringSlot* slot = aeUringSlotOf(eventLoop, fe, &idx);
+
+    slot->fd = fd;
+    slot->mask = (short)(mask | fe->mask);
+    slot->sending = 0;
+    if (fe->flags & AE_IOCOMP) return 0;   /* ops posted by the owner */
+
+    fe->flags |= AE_EDGE;
+    return aeUringRepoll(state, idx);
+}
+
+static void aeApiDelEvent(aeEventLoop* eventLoop, int fd, int mask, aeFileEvent* fe) {
+    aeApiState* state = eventLoop->apidata;
+    struct io_uring_sqe* sqe;
+    int idx;
+    aeUringSlot* slot;
+    (void)mask;
+
+    if (!fe) return;
+    if (fe->mask != AE_NONE) {
+        if (fe->flags & AE_IOCOMP) return;      // partial: ops posted by the owner decide
+        slot = aeUringSlotOf(eventLoop, fe, &idx);
+        slot->mask = (short)fe->mask;
+        aeUringRepoll(state, idx);
+        return;
+    }
+    slot = aeUringSlotOf(eventLoop, fe, &idx);
+    slot->gen++;
+    slot->mask = 0;
+    slot->sending = 0;
+    slot->polling = 0;
+    /* cancel now, not with the next batch: the ring holds a reference on
+     * the socket, close() alone would neither stop a pending send from
+     * reading a freed buffer nor send the FIN. */
+    sqe = aeUringGetSqe(state);
+    if (sqe) {
+        io_uring_prep_cancel_fd(sqe, fd, IORING_ASYNC_CANCEL_ALL);
+        io_uring_sqe_set_data64(sqe, AE_URING_NONE);
+    }
+    io_uring_submit(&state->ring);
+}
+
+static void aeUringRecycle(aeApiState* state) {
+    int i;
+    if (!state->nrecycle) return;
+    for (i = 0; i < state->nrecycle; i++) {
+        int bid = state->recycle[i];
+        io_uring_buf_ring_add(state->br, state->bufs + (size_t)bid * AE_URING_BUFSIZE, AE_URING_BUFSIZE,
+            bid, io_uring_buf_ring_mask(AE_URING_NBUFS), i);
+    }
+    io_uring_buf_ring_advance(state->br, state->nrecycle);
+    state->nrecycle = 0;
+}
+
+/* translate one CQE into fired, returns 1 if the event must be dispatched */
+static int aeUringComplete(aeEventLoop* eventLoop, struct io_uring_cqe* cqe, aeFiredEvent* fired) {
+    aeApiState* state = eventLoop->apidata;
+    uint64_t data = io_uring_cqe_get_data64(cqe);
+    int op = (int)(data & 7);
+    int idx = (int)((data >> 3) & 0x1fffffff);
+    unsigned int gen = (unsigned int)(data >> 32);
+    int res = cqe->res;
+    int more = cqe->flags & IORING_CQE_F_MORE;
+    aeUringSlot* slot;
+    char* buf = NULL;
+
+    if (op == AE_URING_NONE) return 0;
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        int bid = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        buf = state->bufs + (size_t)bid * AE_URING_BUFSIZE;
+        state->recycle[state->nrecycle++] = bid;
+    }
+    if (idx >= state->nslots || state->slots[idx].gen != gen) {
+        /* event deleted after the op was queued */
+        if (op == AE_URING_ACCEPT && res >= 0) close(res);
+        return 0;
+    }
+    slot = &state->slots[idx];
+
+    fired->fd = slot->fd;
+    fired->fe = aeGetEvent(eventLoop, idx);
+    fired->trans = 0;
+    fired->data = buf;
+    switch (op) {
+    case AE_URING_POLL:
+        if (res == -ECANCELED) {
+            /* removed by us, a replacement is armed if the mask needs one */
+            if (!more) slot->polling = 0;
+            return 0;
+        }
+        if (!more) aeUringArmPoll(state, idx);
+        if (res < 0) {
+            /* the poll itself failed: report it like POLLERR, the owner's
+             * read or write sees the error and closes */
+            fired->mask = AE_READABLE | AE_WRITABLE;
+            return 1;
+        }
+        fired->mask = 0;
+        if (res & POLLIN) fired->mask |= AE_READABLE;
+        if (res & POLLOUT) fired->mask |= AE_WRITABLE;
+        if (res & (POLLERR | POLLHUP)) fired->mask |= AE_READABLE | AE_WRITABLE;
+        return fired->mask != 0;
+    case AE_URING_ACCEPT:
+        if (!more) aeUringArmAccept(state, idx);
+        if (res < 0) return 0;
+        fired->mask = AE_READABLE;
+        fired->trans = res;
+        return 1;
+    case AE_URING_RECV:
+        if (res == -ENOBUFS) {
+            /* all buffers in flight, rearmed after this round recycles */
+            aeUringArmRecv(state, idx);
+            return 0;
+        }
+        if (!more && res > 0) aeUringArmRecv(state, idx);
+        fired->mask = AE_READABLE;
+        fired->trans = res > 0 ? res : 0;
+        return 1;
+    case AE_URING_SEND:
+        slot->sending = 0;
+        fired->mask = AE_WRITABLE;
+        fired->trans = res > 0 ? res : 0;
+        return 1;
+    }
+    return 0;
+}
+
+static int aeApiPoll(aeEventLoop* eventLoop, struct timeval* tvp) {
+    aeApiState* state = eventLoop->apidata;
+    struct io_uring_cqe* cqe;
+    unsigned head;
+    int ret, count = 0, numevents = 0;
+
+    /* callbacks of the last round are done with their recv buffers */
+    aeUringRecycle(state);
+
+    if (tvp && tvp->tv_sec == 0 && tvp->tv_usec == 0) {
+        ret = io_uring_submit(&state->ring);
+    } else if (tvp) {
+        struct __kernel_timespec ts;
+        ts.tv_sec = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec * 1000;
+        ret = io_uring_submit_and_wait_timeout(&state->ring, &cqe, 1, &ts, NULL);
+    } else {
+        ret = io_uring_submit_and_wait(&state->ring, 1);
+    }
+    if (ret < 0 && ret != -ETIME && ret != -EINTR && ret != -EBUSY && ret != -EAGAIN)
+        panic("aeApiPoll: io_uring_enter, %s", strerror(-ret));
+
+    io_uring_for_each_cqe(&state->ring, head, cqe) {
+        if (numevents == eventLoop->nfired) break;
+        count++;
+        numevents += aeUringComplete(eventLoop, cqe, &eventLoop->fired[numevents]);
+    }
+    io_uring_cq_advance(&state->ring, count);
+    return numevents;
+}
+
+int aeUringAccept(aeEventLoop* eventLoop, xSocket fd, aeFileEvent* fe) {
+    int idx;
+    aeUringSlot* slot = aeUringSlotOf(eventLoop, fe, &idx);
+    slot->fd = fd;
+    return aeUringArmAccept(eventLoop->apidata, idx) == 0 ? AE_OK : AE_ERR;
+}
+
+int aeUringRecv(aeEventLoop* eventLoop, xSocket fd, aeFileEvent* fe) {
+    int idx;
+    aeUringSlot* slot = aeUringSlotOf(eventLoop, fe, &idx);
+    slot->fd = fd;
+    return aeUringArmRecv(eventLoop->apidata, idx) == 0 ? AE_OK : AE_ERR;
+}
+
+int aeUringSend(aeEventLoop* eventLoop, xSocket fd, aeFileEvent* fe, const char* buf, int len) {
+    aeApiState* state = eventLoop->apidata;
+    struct io_uring_sqe* sqe;
+    int idx;
+    aeUringSlot* slot = aeUringSlotOf(eventLoop, fe, &idx);
+
+    if (slot->sending) return AE_ERR;   /* one send in flight per event */
+    sqe = aeUringGetSqe(state);
+    if (!sqe) return AE_ERR;
+    slot->fd = fd;
+    slot->sending = 1;
+    io_uring_prep_send(sqe, fd, buf, len, MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, aeUringData(state, idx, AE_URING_SEND));
+    return AE_OK;
+}
+
+char* aeUringRecvData(aeEventLoop* eventLoop) {
+    return eventLoop->rdata;
+}
+
+static xSocket aeApiGetStateFD(aeEventLoop* eventLoop) {
+    aeApiState* state = (aeApiState*)eventLoop->apidata;
+    return (xSocket)state->ring.ring_fd;
+}
+
+static char* aeApiName(void) {
+    return (char*)"io_uring";
+}
 #elif defined(HAVE_EPOLL)
 /* Linux epoll(2) based ae.c module
 * Copyright (C) 2009-2010 Salvatore Sanfilippo - antirez@gmail.com
 * Released under the BSD license. See the COPYING file for more info. */
 
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <errno.h>
 
 
@@ -749,15 +1529,31 @@ void panic(const char* fmt, ...) {
     exit(EXIT_FAILURE);
 }
 
+/* interest changes are journaled per file event and applied right before
+ * epoll_wait, so R|W then -W in one iteration costs a single ADD */
+typedef struct aeChange {
+    int fd;
+    aeFileEvent* fe;                    /* NULL: event freed, EPOLL_CTL_DEL fd */
+} aeChange;
+
 typedef struct aeApiState {
     int epfd;
     struct epoll_event* events;
+    aeChange* changes;
+    int nchanges;
+    int changesize;
+    int pwait2;                         /* epoll_pwait2 usable, cleared on ENOSYS */
+    int tfd;                            /* timerfd for sub-ms timeouts without pwait2, lazy */
 } aeApiState;
 
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#define AE_HAVE_PWAIT2 1
+#endif
+
 static int aeApiCreate(aeEventLoop* eventLoop) {
     aeApiState* state = zmalloc(sizeof(aeApiState));
     if (!state) return -1;
-    state->events = zmalloc(sizeof(struct epoll_event) * eventLoop->setsize);
+    state->events = zmalloc(sizeof(struct epoll_event) * eventLoop->nfired);
     if (!state->events) {
         zfree(state);
         return -1;
@@ -769,80 +1565,179 @@ static int aeApiCreate(aeEventLoop* eventLoop) {
         zfree(state);
         return -1;
     }
+    state->changes = NULL;
+    state->nchanges = 0;
+    state->changesize = 0;
+#ifdef AE_HAVE_PWAIT2
+    state->pwait2 = 1;
+#else
+    state->pwait2 = 0;
+#endif
+    state->tfd = -1;
     eventLoop->apidata = state;
     return 0;
 }
 
 static int aeApiResize(aeEventLoop* eventLoop, int setsize) {
-    aeApiState* state = eventLoop->apidata;
-
-    state->events = zrealloc(state->events, sizeof(struct epoll_event) * setsize);
+    (void)(eventLoop);      /* events is sized by nfired, which doesn't follow setsize */
+    (void)(setsize);
     return 0;
 }
 
 static void aeApiFree(aeEventLoop* eventLoop) {
     aeApiState* state = (aeApiState*)eventLoop->apidata;
     close(state->epfd);
+    if (state->tfd != -1) close(state->tfd);
     zfree(state->events);
+    zfree(state->changes);
     zfree(state);
 }
 
+static aeChange* aeApiJournal(aeApiState* state, int fd, aeFileEvent* fe) {
+    aeChange* c;
+    if (state->nchanges == state->changesize) {
+        int size = state->changesize ? state->changesize * 2 : 64;
+        state->changes = zrealloc(state->changes, sizeof(aeChange) * size);
+        state->changesize = size;
+    }
+    c = &state->changes[state->nchanges];
+    c->fd = fd;
+    c->fe = fe;
+    if (fe) fe->change = state->nchanges;
+    state->nchanges++;
+    return c;
+}
+
+/* called before fe->mask is merged, the journal reads it at flush time */
 static int aeApiAddEvent(aeEventLoop* eventLoop, int fd, int mask, aeFileEvent* fe) {
     aeApiState* state = (aeApiState*)eventLoop->apidata;
-    struct epoll_event ee = { 0 };
-    /* If the fd was already monitored for some event, we need a MOD
-     * operation. Otherwise we need an ADD operation. */
-    int op = fe->mask == AE_NONE ?
-        EPOLL_CTL_ADD : EPOLL_CTL_MOD;
-
-    ee.events = 0;
-    mask |= fe->mask; /* Merge old events */
-    if (mask & AE_READABLE) ee.events |= EPOLLIN;
-    if (mask & AE_WRITABLE) ee.events |= EPOLLOUT;
-    ee.data.ptr = fe;
-    if (epoll_ctl(state->epfd, op, fd, &ee) == -1) return -1;
+    (void)mask;
+    if (fe->change < 0) aeApiJournal(state, fd, fe);
     return 0;
 }
 
-static void aeApiDelEvent(aeEventLoop* eventLoop, int fd, int delmask) {
+/* called after fe->mask is updated */
+static void aeApiDelEvent(aeEventLoop* eventLoop, int fd, int delmask, aeFileEvent* fe) {
     aeApiState* state = (aeApiState*)eventLoop->apidata;
-    struct epoll_event ee;
-    int mask = eventLoop->events[fd].mask & (~delmask);
+    (void)delmask;
 
-    ee.events = 0;
-    if (mask & AE_READABLE) ee.events |= EPOLLIN;
-    if (mask & AE_WRITABLE) ee.events |= EPOLLOUT;
-    ee.data.u64 = 0; /* avoid valgrind warning */
-    ee.data.fd = fd;
-    if (mask != AE_NONE) {
-        epoll_ctl(state->epfd, EPOLL_CTL_MOD, fd, &ee);
+    if (fe->mask != AE_NONE) {
+        if (fe->change < 0) aeApiJournal(state, fd, fe);
+        return;
     }
-    else {
-        /* Note, Kernel < 2.6.9 requires a non null event pointer even for
-         * EPOLL_CTL_DEL. */
-        epoll_ctl(state->epfd, EPOLL_CTL_DEL, fd, &ee);
+    /* the slot is about to be reused, keep only the fd: a new event on the
+     * same fd number is journaled later, so its ADD follows this DEL */
+    if (fe->change >= 0) {
+        aeChange* c = &state->changes[fe->change];
+        c->fe = NULL;
+        c->fd = fe->kmask != AE_NONE ? fd : -1;     // never reached the kernel
+    } else if (fe->kmask != AE_NONE) {
+        aeApiJournal(state, fd, NULL);
+    }
+    fe->change = -1;
+    fe->kmask = AE_NONE;
+}
+
+static void aeApiFlush(aeEventLoop* eventLoop) {
+    aeApiState* state = (aeApiState*)eventLoop->apidata;
+    int j;
+
+    for (j = 0; j < state->nchanges; j++) {
+        aeChange* c = &state->changes[j];
+        aeFileEvent* fe = c->fe;
+        struct epoll_event ee = { 0 };
+
+        if (!fe) {
+            /* Note, Kernel < 2.6.9 requires a non null event pointer even for
+             * EPOLL_CTL_DEL. ENOENT/EBADF: fd already closed */
+            if (c->fd != -1) epoll_ctl(state->epfd, EPOLL_CTL_DEL, c->fd, &ee);
+            continue;
+        }
+        fe->change = -1;
+        if (fe->mask == fe->kmask) continue;
+
+        if (fe->mask & AE_READABLE) ee.events |= EPOLLIN;
+        if (fe->mask & AE_WRITABLE) ee.events |= EPOLLOUT;
+        if (fe->flags & AE_EDGE) ee.events |= EPOLLET;
+        ee.data.ptr = fe;
+        if (epoll_ctl(state->epfd, fe->kmask == AE_NONE ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, c->fd, &ee) == -1) {
+            /* too late to fail aeCreateFileEvent, hand the error to the
+             * callbacks like EPOLLERR: their next read/write fails */
+            aeMarkPending(eventLoop, c->fd, fe, fe->mask);
+            continue;
+        }
+        fe->kmask = fe->mask;
     }
+    state->nchanges = 0;
+}
+
+/* epoll_wait only takes ms: whole ms go there directly, a sub-ms remainder
+ * needs epoll_pwait2 (5.11+) or else a timerfd armed for the timeout */
+static int aeApiWait(aeApiState* state, int maxevents, struct timeval* tvp) {
+    struct itimerspec its;
+    struct epoll_event ev;
+
+    if (!tvp) return epoll_wait(state->epfd, state->events, maxevents, -1);
+    if (tvp->tv_usec % 1000 == 0)
+        return epoll_wait(state->epfd, state->events, maxevents,
+            (int)(tvp->tv_sec * 1000 + tvp->tv_usec / 1000));
+#ifdef AE_HAVE_PWAIT2
+    if (state->pwait2) {
+        struct timespec ts;
+        int retval;
+        ts.tv_sec = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec * 1000;
+        retval = epoll_pwait2(state->epfd, state->events, maxevents, &ts, NULL);
+        if (retval != -1 || errno != ENOSYS) return retval;
+        state->pwait2 = 0;
+    }
+#endif
+    if (state->tfd == -1) {
+        state->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (state->tfd != -1 && epoll_ctl(state->epfd, EPOLL_CTL_ADD, state->tfd, &ev) == -1) {
+            close(state->tfd);
+            state->tfd = -1;
+        }
+        if (state->tfd == -1)   /* round up, late rather than spinning */
+            return epoll_wait(state->epfd, state->events, maxevents,
+                (int)(tvp->tv_sec * 1000 + (tvp->tv_usec + 999) / 1000));
+    }
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = tvp->tv_sec;
+    its.it_value.tv_nsec = tvp->tv_usec * 1000;
+    timerfd_settime(state->tfd, 0, &its, NULL);
+    return epoll_wait(state->epfd, state->events, maxevents, -1);
 }
 
 static int aeApiPoll(aeEventLoop* eventLoop, struct timeval* tvp) {
     aeApiState* state = (aeApiState*)eventLoop->apidata;
     int retval, numevents = 0;
 
-    retval = epoll_wait(state->epfd, state->events, eventLoop->setsize,
-        tvp ? (tvp->tv_sec * 1000 + tvp->tv_usec / 1000) : -1);
+    aeApiFlush(eventLoop);
+    retval = aeApiWait(state, eventLoop->nfired, tvp);
     if (retval > 0) {
         int j;
 
-        numevents = retval;
-        for (j = 0; j < numevents; j++) {
+        for (j = 0; j < retval; j++) {
             int mask = 0;
             struct epoll_event* e = state->events + j;
 
+            if (e->data.ptr == NULL) {  /* the sub-ms timerfd */
+                uint64_t expirations;
+                if (read(state->tfd, &expirations, sizeof(expirations)) < 0) {}
+                continue;
+            }
+
             if (e->events & EPOLLIN) mask |= AE_READABLE;
             if (e->events & EPOLLOUT) mask |= AE_WRITABLE;
-            eventLoop->fired[j].fd = e->data.fd;
-            eventLoop->fired[j].mask = mask;
-            eventLoop->fired[j].fe = (aeFileEvent*)e->data.ptr;
+            /* errors must reach the callbacks, with EPOLLET they won't repeat */
+            if (e->events & (EPOLLERR | EPOLLHUP)) mask |= AE_READABLE | AE_WRITABLE;
+            eventLoop->fired[numevents].fe = (aeFileEvent*)e->data.ptr;
+            eventLoop->fired[numevents].fd = eventLoop->fired[numevents].fe->fd;
+            eventLoop->fired[numevents].mask = mask;
+            numevents++;
         }
     }
     else if (retval == -1 && errno != EINTR) {
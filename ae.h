@@ -39,7 +39,14 @@ extern "C" {
 
 #include "fmacros.h"
 
-#define AE_SETSIZE (1024*10)    /* Max number of fd supported */
+/* Max number of file events per loop. Memory follows live events: slots are
+ * allocated AE_EVENT_CHUNK at a time and never move, about 52 bytes per
+ * registered fd in user space (48 aeFileEvent + 4 fd index) plus the
+ * kernel's epitem (~160 bytes with epoll). An idle connection costs that
+ * plus its xchannel buffers. */
+#define AE_SETSIZE (1024*1024)
+#define AE_EVENT_CHUNK 1024
+#define AE_FIRED_MAX 1024       /* events handled per poll, the rest wait for the next */
 
 #define AE_OK 0
 #define AE_ERR -1
@@ -48,6 +55,12 @@ extern "C" {
 #define AE_READABLE 1
 #define AE_WRITABLE 2
 #define AE_PIPE     4
+#define AE_EDGE     8       /* edge-triggered, drain until EAGAIN in callbacks */
+#define AE_PENDING  16      /* fe->flags: queued by aeMarkPending */
+#define AE_IOCOMP   32      /* io_uring: completion based, see aeUringRecv */
+#define AE_HOLD     64      /* fe->flags: kept when the mask drops to AE_NONE, see aeHoldFileEvent */
+
+#define AE_IO_BUDGET (64*1024)  /* default bytes per edge-triggered wakeup */
 
 #define AE_FILE_EVENTS 1
 #define AE_TIME_EVENTS 2
@@ -67,8 +80,13 @@ typedef void    aeBeforeSleepProc(struct aeEventLoop *eventLoop);
 
 /* File event structure */
 typedef struct aeFileEvent {
-    short int       slot;       /* for free list */
+    int             id;         /* index in the loop, stable while the loop lives */
+    int             next;       /* free list */
     short int       mask;       /* one of AE_(READABLE|WRITABLE) */
+    short int       flags;      /* AE_EDGE|AE_PENDING|AE_IOCOMP */
+    short int       kmask;      /* epoll: interest registered in the kernel */
+    int             change;     /* epoll: journal index; kqueue: scratch while merging a poll; -1 none */
+    xSocket         fd;
     aeFileProc      *rfileProc; /* for recv packet */
     aeFileProc      *wfileProc; /* for send packet */
     void            *clientData;
@@ -80,26 +98,82 @@ typedef struct aeFiredEvent {
     int     mask;
     int     trans;
     aeFileEvent* fe;
+#ifdef HAVE_IOURING
+    char*   data;                       /* provided buffer of a recv completion */
+#endif
 } aeFiredEvent;
 
+#ifndef HAVE_IOCP
+/* cross-thread wakeup: eventfd on linux, nonblocking pipe elsewhere.
+ * state lets aeWakerSignal skip the write unless the owner is blocked */
+typedef struct aeWaker {
+    int fd[2];                          /* [0] read, [1] write, same fd for eventfd */
+    int state;                          /* AE_WAKER_SLEEPING|AE_WAKER_SIGNALED, atomic */
+} aeWaker;
+#endif
+
+/* loop instrumentation, off unless aeEnableStats. HDR-style log-linear
+ * histogram: 4 buckets per power of two (<25% error), values in us */
+#define AE_HIST_BUCKETS 128
+typedef struct aeHist {
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long max;
+    unsigned long long buckets[AE_HIST_BUCKETS];
+} aeHist;
+
+typedef struct aeStats {
+    aeHist  poll;                       /* time blocked in aeApiPoll */
+    aeHist  callback;                   /* time per fired file event */
+    aeHist  timer;                      /* timer lateness past its deadline */
+    aeHist  events;                     /* fired file events per iteration (count, not us) */
+    unsigned long long iterations;
+    unsigned long long spins;           /* busy-poll: zero-timeout polls */
+    unsigned long long spinhits;        /* ... that returned events */
+    unsigned long long sleeps;          /* polls allowed to block */
+    struct {
+        unsigned long long us;
+        aeFileProc *proc;               /* resolve with addr2line / dladdr */
+        xSocket fd;
+        int mask;
+    } slowest;                          /* slowest single callback since reset */
+} aeStats;
+
 /* State of an event based program */
 typedef struct aeEventLoop {
     xSocket     maxfd;                  /* highest file descriptor currently registered */
-    int         setsize;                /* max number of file descriptors tracked */
-    int         nevents;                /* Size of Registered events */
-    aeFileEvent* events;                /* Registered events */
+    int         setsize;                /* max number of file events */
+    int         nevents;                /* slots allocated, a multiple of AE_EVENT_CHUNK */
+    int         count;                  /* live file events */
+    aeFileEvent** events;               /* chunks of AE_EVENT_CHUNK slots, see aeGetEvent */
+    int         nfired;                 /* size of fired, bounded by AE_FIRED_MAX */
     aeFiredEvent* fired;                /* Fired events */
+    int*        fdmap;                  /* fd -> event id, -1 none; not used with iocp */
+    int         fdmapsize;
 
     int         efhead;                 /* freehead */
 
+    int         flags;                  /* AE_EDGE: default for new file events */
+    int         budget;                 /* bytes per edge-triggered wakeup */
+    int         spinus;                 /* busy-poll window after activity, 0 off */
+    unsigned long long lastactive;      /* monotonic us of the last iteration with events */
+    aeFiredEvent* pending;              /* events re-fired next iteration */
+    int         npending;
+    int         pendingsize;
+
     int stop;
     void *apidata;                      /* This is used for polling API specific data */
     aeBeforeSleepProc *beforesleep;
+    aeBeforeSleepProc *flushproc;       /* every aeProcessEvents before polling, coalesced writes */
+    aeStats *stats;                     /* NULL: instrumentation off */
 
 #ifndef HAVE_IOCP
-    xSocket signal_fd[2];               /* signal pair fd对[0]:read, [1] : write */
+    aeWaker waker;                      /* cross-thread wakeup, see aeCreateSignalFile */
 #endif
     int fdWaitSlot;                     /* signal fileEvent index */ 
+#ifdef HAVE_IOURING
+    char* rdata;                        /* data of the recv being fired */
+#endif
 } aeEventLoop;
 
 /* Prototypes */
@@ -110,15 +184,66 @@ void aeStop(aeEventLoop *eventLoop);
 int aeCreateFileEvent(aeEventLoop *eventLoop, xSocket fd, int mask,
         aeFileProc *proc, void *clientData, aeFileEvent** ev);
 void aeDeleteFileEvent(aeEventLoop *eventLoop, xSocket fd, aeFileEvent* fe, int mask);
+aeFileEvent *aeGetFileEvent(aeEventLoop *eventLoop, xSocket fd);    /* last event created on fd, NULL with iocp */
+int aeEnableFileEvent(aeEventLoop *eventLoop, xSocket fd, aeFileEvent* fe, int mask);   /* re-add mask deleted before, callbacks kept */
+void aeHoldFileEvent(aeEventLoop *eventLoop, xSocket fd, aeFileEvent* fe, int hold);    /* readiness backends: pause all interest without losing fe */
 int aeProcessEvents(aeEventLoop *eventLoop, int flags);
 int aeWait(xSocket fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
 char *aeGetApiName(void);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
+void aeSetFlushProc(aeEventLoop *eventLoop, aeBeforeSleepProc *flushproc);
+
+/* edge-triggered mode: callbacks must read/write until EAGAIN, or stop at
+ * the budget and call aeMarkPending() so the event fires again next loop.
+ * aeMarkPending() also serves work left in user buffers (e.g. packets past
+ * a per-wakeup budget) in either mode: the loop doesn't sleep while it's set */
+void aeSetEdgeTriggered(aeEventLoop *eventLoop, int enable);
+void aeSetIoBudget(aeEventLoop *eventLoop, int budget);
+int  aeGetIoBudget(aeEventLoop *eventLoop);
+void aeMarkPending(aeEventLoop *eventLoop, xSocket fd, aeFileEvent *fe, int mask);
+
+/* busy-poll: for us microseconds after an iteration that handled events,
+ * poll with a zero timeout instead of sleeping, then block as usual.
+ * trades a core for wakeup latency; 0 turns it off (default) */
+void aeSetBusyPoll(aeEventLoop *eventLoop, int us);
+int  aeGetBusyPoll(aeEventLoop *eventLoop);
+#define aeIsEdgeTriggered(fe) ((fe) && ((fe)->flags & AE_EDGE))
+#define aeGetEvent(el, id) (&(el)->events[(id) / AE_EVENT_CHUNK][(id) % AE_EVENT_CHUNK])
+
+#ifdef HAVE_IOURING
+/* completion mode for events created with AE_IOCOMP, results come back
+ * through the callback's trans like iocp: accepted fd / bytes, 0 on EOF
+ * or error. recv data is at aeUringRecvData() during the callback only. */
+int  aeUringAccept(aeEventLoop *eventLoop, xSocket fd, aeFileEvent *fe);
+int  aeUringRecv(aeEventLoop *eventLoop, xSocket fd, aeFileEvent *fe);
+int  aeUringSend(aeEventLoop *eventLoop, xSocket fd, aeFileEvent *fe, const char *buf, int len);
+char *aeUringRecvData(aeEventLoop *eventLoop);
+#endif
+
+/* instrumentation: two clock reads per fired event, cheap enough for production */
+int  aeEnableStats(aeEventLoop *eventLoop, int enable);
+const aeStats *aeGetStats(aeEventLoop *eventLoop);
+void aeResetStats(aeEventLoop *eventLoop);
+unsigned long long aeHistPercentile(const aeHist *hist, double percentile);    /* 0-100, bucket upper bound */
+void aeShowStats(aeEventLoop *eventLoop);
 
 void aeCreateSignalFile(aeEventLoop* eventLoop);
 void aeDeleteSignalFile(aeEventLoop *eventLoop);
 void aeGetSignalFile(aeEventLoop *eventLoop, xSocket* fdSignal);
+void *aeGetWakeHandle(aeEventLoop *eventLoop);     /* for xthread_set_notify: iocp handle or aeWaker* */
+
+#ifndef HAVE_IOCP
+/* signal from any thread; the owner calls aeWakerSleep before blocking
+ * (non-zero: already signaled, don't block) and aeWakerAwake after it, then
+ * checks its work queue. aeWakerDrain when fd[0] becomes readable. */
+int  aeWakerInit(aeWaker *w);
+void aeWakerFree(aeWaker *w);
+int  aeWakerSignal(aeWaker *w);
+int  aeWakerSleep(aeWaker *w);
+int  aeWakerAwake(aeWaker *w);
+void aeWakerDrain(aeWaker *w);
+#endif
 
 #ifdef __cplusplus
 }
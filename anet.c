@@ -44,10 +44,12 @@
     #include <fcntl.h>
     #include <netdb.h>
     #include <errno.h>
+    #include <sys/uio.h>
 #endif
 
 #include <string.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 
 #include "anet.h"
@@ -207,6 +209,60 @@ int anetResolve(char *err, char *host, char *ipbuf)
     return ANET_OK;
 }
 
+/* 解析host的全部TCP地址(IPv4/IPv6), 数字串写入ips, 返回个数.
+ * 数字地址不查询DNS; 域名会阻塞, 事件循环里请放到其他线程调用.
+ * flags带ANET_IP_ONLY时只接受数字地址 */
+int anetResolveAll(char *err, char *host, char ips[][ANET_IP_LEN], int max, int flags)
+{
+    struct addrinfo hints, *res, *p;
+    int rv, n = 0;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (flags & ANET_IP_ONLY) hints.ai_flags = AI_NUMERICHOST;
+    if ((rv = getaddrinfo(host, NULL, &hints, &res)) != 0) {
+        anetSetError(err, "can't resolve %s: %s", host, gai_strerror(rv));
+        return ANET_ERR;
+    }
+    for (p = res; p != NULL && n < max; p = p->ai_next) {
+        const void *a;
+        int i, dup = 0;
+        if (p->ai_family == AF_INET)
+            a = &((struct sockaddr_in*)p->ai_addr)->sin_addr;
+        else if (p->ai_family == AF_INET6)
+            a = &((struct sockaddr_in6*)p->ai_addr)->sin6_addr;
+        else
+            continue;
+        if (inet_ntop(p->ai_family, a, ips[n], ANET_IP_LEN) == NULL)
+            continue;
+        for (i = 0; i < n && !dup; i++)
+            dup = (strcmp(ips[i], ips[n]) == 0);
+        if (!dup) n++;
+    }
+    freeaddrinfo(res);
+    if (n == 0) {
+        anetSetError(err, "can't resolve: %s", host);
+        return ANET_ERR;
+    }
+    return n;
+}
+
+/* 取非阻塞connect的结果(SO_ERROR), 0为成功 */
+int anetSockError(xSocket fd)
+{
+    int serr = 0;
+    socklen_t len = sizeof(serr);
+#ifdef _WIN32
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (char*)&serr, &len) == SOCKET_ERROR)
+        return WSAGetLastError();
+#else
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &serr, &len) == -1)
+        return errno;
+#endif
+    return serr;
+}
+
 static xSocket anetCreateSocket(char *err, int domain) {
     static int wsa_inited = 0;
     if (!wsa_inited) {
@@ -257,29 +313,43 @@ static xSocket anetTcpGenericConnect(char *err, char *addr, int port, int flags)
 {
     xSocket s;
     struct sockaddr_in sa;
+    struct sockaddr_in6 sa6;
+    struct sockaddr *psa = (struct sockaddr*)&sa;
+    int salen = sizeof(sa);
+
+    /* IPv6字面地址(含':')直接走AF_INET6, 不做解析 */
+    memset(&sa6, 0, sizeof(sa6));
+    if (strchr(addr, ':') && inet_pton(AF_INET6, addr, &sa6.sin6_addr) == 1) {
+        if ((s = anetCreateSocket(err, AF_INET6)) == ANET_ERR)
+            return ANET_ERR;
+        sa6.sin6_family = AF_INET6;
+        sa6.sin6_port = htons(port);
+        psa = (struct sockaddr*)&sa6;
+        salen = sizeof(sa6);
+    } else {
+        if ((s = anetCreateSocket(err, AF_INET)) == ANET_ERR)
+            return ANET_ERR;
 
-    if ((s = anetCreateSocket(err, AF_INET)) == ANET_ERR)
-        return ANET_ERR;
-
-    sa.sin_family = AF_INET;
-    sa.sin_port = htons(port);
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
 #ifdef _WIN32
-    if (inet_pton(AF_INET, addr, &sa.sin_addr) != 1) {
+        if (inet_pton(AF_INET, addr, &sa.sin_addr) != 1) {
 #else
-    if (inet_aton(addr, &sa.sin_addr) == 0) {
+        if (inet_aton(addr, &sa.sin_addr) == 0) {
 #endif
-        struct hostent *he;
-        he = gethostbyname(addr);
-        if (he == NULL) {
-            anetSetError(err, "can't resolve: %s", addr);
+            struct hostent *he;
+            he = gethostbyname(addr);
+            if (he == NULL) {
+                anetSetError(err, "can't resolve: %s", addr);
 #ifdef _WIN32
-            closesocket(s);
+                closesocket(s);
 #else
-            close(s);
+                close(s);
 #endif
-            return ANET_ERR;
+                return ANET_ERR;
+            }
+            memcpy(&sa.sin_addr, he->h_addr, sizeof(struct in_addr));
         }
-        memcpy(&sa.sin_addr, he->h_addr, sizeof(struct in_addr));
     }
 
     if (flags & ANET_CONNECT_NONBLOCK) {
@@ -294,7 +364,7 @@ static xSocket anetTcpGenericConnect(char *err, char *addr, int port, int flags)
     }
 
 #ifdef _WIN32
-    int ret = connect(s, (struct sockaddr*)&sa, sizeof(sa));
+    int ret = connect(s, psa, salen);
     if (ret == SOCKET_ERROR) {
         int err_code = WSAGetLastError();
         if (err_code == WSAEINPROGRESS && (flags & ANET_CONNECT_NONBLOCK)) {
@@ -306,7 +376,7 @@ static xSocket anetTcpGenericConnect(char *err, char *addr, int port, int flags)
         return ANET_ERR;
     }
 #else
-    if (connect(s, (struct sockaddr*)&sa, sizeof(sa)) == -1) {
+    if (connect(s, psa, salen) == -1) {
         if (errno == EINPROGRESS && (flags & ANET_CONNECT_NONBLOCK))
             return s;
         anetSetError(err, "connect: %s", strerror(errno));
@@ -327,22 +397,51 @@ xSocket anetTcpNonBlockConnect(char *err, char *addr, int port)
     return anetTcpGenericConnect(err,addr,port,ANET_CONNECT_NONBLOCK);
 }
 
+#ifndef _WIN32
+/* path starting with '@' is a linux abstract socket: no file, gone with the last fd */
+static int anetUnixAddr(char *err, char *path, struct sockaddr_un *sa, socklen_t *len)
+{
+    size_t n = strlen(path);
+    memset(sa,0,sizeof(*sa));
+    sa->sun_family = AF_LOCAL;
+    if (n == 0 || n >= sizeof(sa->sun_path)) {
+        anetSetError(err, "invalid unix socket path: %s", path);
+        return ANET_ERR;
+    }
+    memcpy(sa->sun_path,path,n);
+    *len = (socklen_t)(offsetof(struct sockaddr_un,sun_path) + n + 1);
+    if (path[0] == '@') {
+#if defined(__linux__)
+        sa->sun_path[0] = '\0';
+        *len = (socklen_t)(offsetof(struct sockaddr_un,sun_path) + n);
+#else
+        anetSetError(err, "abstract unix socket not supported: %s", path);
+        return ANET_ERR;
+#endif
+    }
+    return ANET_OK;
+}
+#endif
+
 xSocket anetUnixGenericConnect(char *err, char *path, int flags)
 {
 #ifndef _WIN32
     int s;
     struct sockaddr_un sa;
+    socklen_t salen;
 
+    if (anetUnixAddr(err,path,&sa,&salen) == ANET_ERR)
+        return ANET_ERR;
     if ((s = anetCreateSocket(err,AF_LOCAL)) == ANET_ERR)
         return ANET_ERR;
 
-    sa.sun_family = AF_LOCAL;
-    strncpy(sa.sun_path,path,sizeof(sa.sun_path)-1);
     if (flags & ANET_CONNECT_NONBLOCK) {
-        if (anetNonBlock(err,s) != ANET_OK)
+        if (anetNonBlock(err,s) != ANET_OK) {
+            close(s);
             return ANET_ERR;
+        }
     }
-    if (connect(s,(struct sockaddr*)&sa,sizeof(sa)) == -1) {
+    if (connect(s,(struct sockaddr*)&sa,salen) == -1) {
         if (errno == EINPROGRESS &&
             flags & ANET_CONNECT_NONBLOCK)
             return s;
@@ -512,6 +611,85 @@ int anetWrite(xSocket fd, char *buf, int count) {
     return totlen;
 }
 
+/* single recv(2), for edge-triggered drain loops:
+ * >0 bytes read, 0 peer closed/reset, ANET_EAGAIN nothing left, ANET_ERR */
+int anetRecv(xSocket fd, char *buf, int count)
+{
+    int nread;
+    for (;;) {
+#ifdef _WIN32
+        nread = recv(fd, buf, count, 0);
+        if (nread >= 0) return nread;
+        int err_code = WSAGetLastError();
+        if (err_code == WSAEINTR) continue;
+        if (err_code == WSAEWOULDBLOCK) return ANET_EAGAIN;
+        if (err_code == WSAECONNRESET || err_code == WSAENETRESET) return 0;
+#else
+        nread = read(fd, buf, count);
+        if (nread >= 0) return nread;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return ANET_EAGAIN;
+        if (errno == ECONNRESET || errno == ENETRESET) return 0;
+#endif
+        return ANET_ERR;
+    }
+}
+
+/* single send(2): >0 bytes written, ANET_EAGAIN socket buffer full, ANET_ERR */
+int anetSend(xSocket fd, char *buf, int count)
+{
+    int nwritten;
+    for (;;) {
+#ifdef _WIN32
+        nwritten = send(fd, buf, count, 0);
+        if (nwritten >= 0) return nwritten;
+        int err_code = WSAGetLastError();
+        if (err_code == WSAEINTR) continue;
+        if (err_code == WSAEWOULDBLOCK) return ANET_EAGAIN;
+#else
+        nwritten = write(fd, buf, count);
+        if (nwritten >= 0) return nwritten;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return ANET_EAGAIN;
+#endif
+        return ANET_ERR;
+    }
+}
+
+/* gathered send of count buffers (at most ANET_IOV_MAX), same returns as anetSend */
+int anetSendv(xSocket fd, char **bufs, int *lens, int count)
+{
+    if (count > ANET_IOV_MAX) count = ANET_IOV_MAX;
+#ifdef _WIN32
+    WSABUF iov[ANET_IOV_MAX];
+    DWORD nwritten = 0;
+    for (int i = 0; i < count; i++) {
+        iov[i].buf = bufs[i];
+        iov[i].len = (ULONG)lens[i];
+    }
+    for (;;) {
+        if (WSASend(fd, iov, (DWORD)count, &nwritten, 0, NULL, NULL) == 0) return (int)nwritten;
+        int err_code = WSAGetLastError();
+        if (err_code == WSAEINTR) continue;
+        if (err_code == WSAEWOULDBLOCK) return ANET_EAGAIN;
+        return ANET_ERR;
+    }
+#else
+    struct iovec iov[ANET_IOV_MAX];
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = (size_t)lens[i];
+    }
+    for (;;) {
+        ssize_t nwritten = writev(fd, iov, count);
+        if (nwritten >= 0) return (int)nwritten;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return ANET_EAGAIN;
+        return ANET_ERR;
+    }
+#endif
+}
+
 static int anetListen(char *err, xSocket s, struct sockaddr *sa, socklen_t len)
 {
 #ifdef _WIN32
@@ -542,13 +720,34 @@ static int anetListen(char *err, xSocket s, struct sockaddr *sa, socklen_t len)
     return ANET_OK;
 }
 
-xSocket anetTcpServer(char *err, int port, char *bindaddr) {
+#define ANET_SERVER_NONE 0
+#define ANET_SERVER_REUSEPORT 1
+static xSocket anetTcpGenericServer(char *err, int port, char *bindaddr, int flags) {
     xSocket s;
     struct sockaddr_in sa;
 
     if ((s = anetCreateSocket(err, AF_INET)) == ANET_ERR)
         return ANET_ERR;
 
+    if (flags & ANET_SERVER_REUSEPORT) {
+#ifdef SO_REUSEPORT
+        int on = 1;
+        if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+            anetSetError(err, "setsockopt SO_REUSEPORT: %s", strerror(errno));
+            close(s);
+            return ANET_ERR;
+        }
+#else
+        anetSetError(err, "SO_REUSEPORT not supported");
+#ifdef _WIN32
+        closesocket(s);
+#else
+        close(s);
+#endif
+        return ANET_ERR;
+#endif
+    }
+
     memset(&sa, 0, sizeof(sa));
     sa.sin_family = AF_INET;
     sa.sin_port = htons(port);
@@ -581,24 +780,102 @@ xSocket anetTcpServer(char *err, int port, char *bindaddr) {
     return s;
 }
 
-/*
-int anetUnixServer(char *err, char *path, mode_t perm)
+xSocket anetTcpServer(char *err, int port, char *bindaddr) {
+    return anetTcpGenericServer(err, port, bindaddr, ANET_SERVER_NONE);
+}
+
+/* one of several listeners on the same port, the kernel spreads connections */
+xSocket anetTcpReusePortServer(char *err, int port, char *bindaddr) {
+    return anetTcpGenericServer(err, port, bindaddr, ANET_SERVER_REUSEPORT);
+}
+
+/* a socket file left by a dead server is removed; one still accepting is an error */
+xSocket anetUnixServer(char *err, char *path, int perm)
 {
+#ifndef _WIN32
     int s;
     struct sockaddr_un sa;
+    socklen_t salen;
 
+    if (anetUnixAddr(err,path,&sa,&salen) == ANET_ERR)
+        return ANET_ERR;
+    if (path[0] != '@') {
+        struct stat st;
+        if (stat(path,&st) == 0 && S_ISSOCK(st.st_mode)) {
+            int c = anetUnixConnect(NULL,path);
+            if (c != ANET_ERR) {
+                close(c);
+                anetSetError(err, "unix socket in use: %s", path);
+                return ANET_ERR;
+            }
+            unlink(path);
+        }
+    }
     if ((s = anetCreateSocket(err,AF_LOCAL)) == ANET_ERR)
         return ANET_ERR;
+    if (anetListen(err,s,(struct sockaddr*)&sa,salen) == ANET_ERR)
+        return ANET_ERR;
+    if (perm && path[0] != '@')
+        chmod(sa.sun_path, (mode_t)perm);
+    return s;
+#else
+    anetSetError(err, "unix socket not supported");
+    return ANET_ERR;
+#endif
+}
+
+/* non-blocking UDP socket. with ANET_UDP_CONNECT it is connected to addr:port
+ * and only talks to that peer, otherwise it is bound to addr:port (NULL addr
+ * binds the IPv4 wildcard, port 0 lets the system pick one).
+ * addr may be a host name or an IPv4/IPv6 literal, names resolve blocking */
+#define ANET_UDP_BIND 0
+#define ANET_UDP_CONNECT 1
+static xSocket anetUdpGenericSocket(char *err, char *addr, int port, int flags)
+{
+    struct addrinfo hints, *res, *p;
+    char portstr[8];
+    xSocket s = ANET_ERR;
+    int rv;
 
-    memset(&sa,0,sizeof(sa));
-    sa.sun_family = AF_LOCAL;
-    strncpy(sa.sun_path,path,sizeof(sa.sun_path)-1);
-    if (anetListen(err,s,(struct sockaddr*)&sa,sizeof(sa)) == ANET_ERR)
+    if (anetWSAInit(err) != ANET_OK)
         return ANET_ERR;
-    if (perm)
-        chmod(sa.sun_path, perm);
+    snprintf(portstr, sizeof(portstr), "%d", port);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = addr ? AF_UNSPEC : AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (!(flags & ANET_UDP_CONNECT)) hints.ai_flags = AI_PASSIVE;
+    if ((rv = getaddrinfo(addr, portstr, &hints, &res)) != 0) {
+        anetSetError(err, "can't resolve %s: %s", addr ? addr : "*", gai_strerror(rv));
+        return ANET_ERR;
+    }
+    for (p = res; p != NULL; p = p->ai_next) {
+        if ((s = socket(p->ai_family, SOCK_DGRAM, 0)) == (xSocket)-1) {
+            s = ANET_ERR;
+            continue;
+        }
+        if (flags & ANET_UDP_CONNECT) rv = connect(s, p->ai_addr, (socklen_t)p->ai_addrlen);
+        else rv = bind(s, p->ai_addr, (socklen_t)p->ai_addrlen);
+        if (rv == 0 && anetNonBlock(err, s) == ANET_OK)
+            break;
+        anetCloseSocket(s);
+        s = ANET_ERR;
+    }
+    if (s == (xSocket)ANET_ERR)
+        anetSetError(err, "%s %s:%d: %s", (flags & ANET_UDP_CONNECT) ? "connect" : "bind",
+            addr ? addr : "*", port, strerror(errno));
+    freeaddrinfo(res);
     return s;
-}*/
+}
+
+xSocket anetUdpServer(char *err, int port, char *bindaddr)
+{
+    return anetUdpGenericSocket(err, bindaddr, port, ANET_UDP_BIND);
+}
+
+xSocket anetUdpConnect(char *err, char *addr, int port)
+{
+    return anetUdpGenericSocket(err, addr, port, ANET_UDP_CONNECT);
+}
 
 static int anetGenericAccept(char *err, xSocket s, struct sockaddr *sa, socklen_t *len)
 {
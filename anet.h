@@ -38,7 +38,12 @@ extern "C" {
 
 #define ANET_OK 0
 #define ANET_ERR -1
+#define ANET_EAGAIN -2
 #define ANET_ERR_LEN 256
+#define ANET_IOV_MAX 64     /* buffers per anetSendv */
+#define ANET_IP_LEN 46      /* INET6_ADDRSTRLEN */
+#define ANET_NONE 0
+#define ANET_IP_ONLY (1<<0)
 
 #if defined(__sun)
 #define AF_LOCAL AF_UNIX
@@ -51,11 +56,19 @@ xSocket anetUnixNonBlockConnect(char *err, char *path);
 int		anetRead(xSocket fd, char *buf, int count);
 int		anetReadWithTimeout(xSocket fd, char* buf, int count, long long timeout_ms);
 int		anetResolve(char *err, char *host, char *ipbuf);
+int		anetResolveAll(char *err, char *host, char ips[][ANET_IP_LEN], int max, int flags);
+int		anetSockError(xSocket fd);
 xSocket	anetTcpServer(char *err, int port, char *bindaddr);
-//int	anetUnixServer(char *err, char *path, mode_t perm);
+xSocket	anetTcpReusePortServer(char *err, int port, char *bindaddr);
+xSocket	anetUnixServer(char *err, char *path, int perm);
+xSocket	anetUdpServer(char *err, int port, char *bindaddr);
+xSocket	anetUdpConnect(char *err, char *addr, int port);
 xSocket anetTcpAccept(char *err, xSocket serversock, char *ip, int *port);
 xSocket anetUnixAccept(char *err, xSocket serversock);
 int		anetWrite(xSocket fd, char *buf, int count);
+int		anetRecv(xSocket fd, char *buf, int count);
+int		anetSend(xSocket fd, char *buf, int count);
+int		anetSendv(xSocket fd, char **bufs, int *lens, int count);
 int		anetNonBlock(char *err, xSocket fd);
 int		anetTcpNoDelay(char *err, xSocket fd);
 int		anetTcpKeepAlive(char *err, xSocket fd);
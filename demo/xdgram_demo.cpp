@@ -0,0 +1,130 @@
+// xdgram_demo.cpp - UDP datagram channel demo: echo round trip, oversize datagrams and an unreachable peer
+//
+// 服务端xdgram_bind在系统分配的端口上原样回显, 客户端xdgram_connect过去发一批数据报等回显.
+// 超过接收上限(xdgram_set_rsize)的数据报整个丢弃并计入rtrunc; 发给没人监听的端口时ICMP错误被忽略, channel照常可用.
+// 运行: ../bin/xdgram_demo
+
+#include "ae.h"
+#include "xchannel_dgram.h"
+#include "xtimer.h"
+#include "xlog.h"
+#include <string.h>
+#include <thread>
+#include <chrono>
+
+#define DEMO_COUNT      100         // 回显的数据报数
+#define DEMO_RSIZE      512         // 服务端接收上限
+#define DEMO_BIG        1200        // 超过上限的数据报
+
+static int _echoed = 0;             // 服务端收到的
+static int _got = 0;                // 客户端收到的回显
+static int _bad = 0;
+
+//=============================================================================
+// 服务端: 原样发回来源地址
+//=============================================================================
+int on_server(xDgramChannel* d, char* buf, int len, const struct sockaddr* from, int fromlen) {
+    _echoed++;
+    xdgram_sendto(d, buf, len, from, fromlen);
+    return 0;
+}
+
+//=============================================================================
+// 客户端: 回显里带着序号, 检查长度和内容
+//=============================================================================
+int on_client(xDgramChannel* d, char* buf, int len, const struct sockaddr* from, int fromlen) {
+    (void)d; (void)from; (void)fromlen;
+    int seq = -1;
+    if (len >= (int)sizeof(seq)) memcpy(&seq, buf, sizeof(seq));
+    if (len != 16 + seq % 200 || (unsigned char)buf[len - 1] != (unsigned char)seq) _bad++;
+    _got++;
+    return 0;
+}
+
+// 跑loop直到done()为真, 超时返回false
+static bool run_until(aeEventLoop* el, int ms, bool (*done)()) {
+    long long t0 = time_get_ms();
+    while (!done()) {
+        if (time_get_ms() - t0 > ms) return false;
+        aeProcessEvents(el, AE_ALL_EVENTS | AE_DONT_WAIT);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+//=============================================================================
+// 主函数
+//=============================================================================
+int main() {
+    xlog_init(XLOG_INFO, true, true, nullptr);
+    aeEventLoop* el = aeCreateEventLoop(100);
+    xtimer_init(100);
+    if (!el) {
+        xlog_err("init failed");
+        return 1;
+    }
+
+    xDgramChannel* server = xdgram_bind("127.0.0.1", 0, on_server, nullptr);
+    if (!server) {
+        xlog_err("bind failed");
+        return 1;
+    }
+    int port = xdgram_port(server);
+    xdgram_set_rsize(server, DEMO_RSIZE);
+    xDgramChannel* client = xdgram_connect("127.0.0.1", port, on_client, nullptr);
+    if (!client) {
+        xlog_err("connect to %d failed", port);
+        return 1;
+    }
+    xlog_info("server on 127.0.0.1:%d, rsize %d", port, DEMO_RSIZE);
+    bool ok = true;
+
+    // 1. 一批长短不一的数据报, 下一次poll时用sendmmsg一起写出
+    xlog_info("=== Test 1: echo %d datagrams ===", DEMO_COUNT);
+    char buf[DEMO_BIG];
+    for (int i = 0; i < DEMO_COUNT; i++) {
+        int len = 16 + i % 200;
+        memset(buf, i, len);
+        memcpy(buf, &i, sizeof(i));
+        xdgram_send(client, buf, len);
+    }
+    run_until(el, 3000, [] { return _got >= DEMO_COUNT; });
+    xlog_info("[Client] %d/%d echoed, %d bad", _got, DEMO_COUNT, _bad);
+    ok = _got == DEMO_COUNT && !_bad;
+
+    // 2. 超过服务端接收上限: 不回调, 计数加一, 之后的照常收
+    xlog_info("=== Test 2: datagram over the receive limit ===");
+    int echoed = _echoed;
+    memset(buf, 0, sizeof(buf));
+    xdgram_send(client, buf, DEMO_BIG);
+    int last = DEMO_COUNT;
+    memset(buf, last, 16 + last % 200);
+    memcpy(buf, &last, sizeof(last));
+    xdgram_send(client, buf, 16 + last % 200);
+    run_until(el, 3000, [] { return _got > DEMO_COUNT; });
+    xlog_info("[Server] rtrunc %u, delivered %d", server->rtrunc, _echoed - echoed);
+    ok = ok && server->rtrunc == 1 && _echoed - echoed == 1 && _got == DEMO_COUNT + 1;
+
+    // 3. 对端不在: ICMP端口不可达被忽略, channel不关闭, 队列正常清空
+    xlog_info("=== Test 3: peer not listening ===");
+    xDgramChannel* probe = xdgram_bind("127.0.0.1", 0, on_server, nullptr);
+    int dead_port = probe ? xdgram_port(probe) : 0;
+    if (probe) xdgram_close(probe);
+    xDgramChannel* lost = dead_port ? xdgram_connect("127.0.0.1", dead_port, on_client, nullptr) : NULL;
+    if (!lost) {
+        xlog_err("connect to %d failed", dead_port);
+        ok = false;
+    } else {
+        for (int i = 0; i < 10; i++) xdgram_send(lost, buf, 32);
+        run_until(el, 200, [] { return false; });
+        xlog_info("[Client] %d left in queue, %u dropped", xdgram_wpending(lost), lost->wdrop);
+        ok = ok && xdgram_wpending(lost) == 0;
+        xdgram_close(lost);
+    }
+
+    xdgram_close(client);
+    xdgram_close(server);
+    xlog_info("datagram demo %s", ok ? "passed" : "FAILED");
+    xlog_uninit();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+// xkcp_demo.cpp - KCP channel demo: RPC over a lossy link, and data still in flight when the sender closes
+//
+// 客户端经一个丢包的UDP代理线程连服务端, 丢掉的段靠重传补上, 上层看到的还是完整有序的字节流.
+// 第二段: 服务端连发一批包后马上xchannel_close, 没确认的数据在XKCP_LINGER_MS内继续重传, 客户端全部收到后才关闭.
+// 运行: ../bin/xkcp_demo
+
+#include "ae.h"
+#include "xchannel.h"
+#include "xchannel_kcp.h"
+#include "xpack.h"
+#include "xcoroutine.h"
+#include "xhandle.h"
+#include "xrpc.h"
+#include "xtimer.h"
+#include "xlog.h"
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdlib.h>
+#ifdef XCHANNEL_KCP
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#define RPC_PORT        8893
+#define RPC_PROXY       8894
+#define LINGER_PORT     8895
+#define LINGER_PROXY    8896
+#define LOSS_PERCENT    10
+#define LINGER_PACKS    50
+#define LINGER_SIZE     10000
+
+static int _calls_ok = 0;
+static int _done = 0;
+static int _got = 0;
+static int _bad = 0;
+static int _closed = 0;
+
+#ifdef XCHANNEL_KCP
+//=============================================================================
+// 丢包代理: 127.0.0.1:pport <-> 127.0.0.1:sport, 每个方向按LOSS_PERCENT丢
+//=============================================================================
+static std::atomic<int> _stop{ 0 };
+static std::atomic<long> _dropped{ 0 };
+
+static void lossy_proxy(int pport, int sport) {
+    int p = socket(AF_INET, SOCK_DGRAM, 0);
+    int u = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(pport);
+    sockaddr_in srv = addr;
+    srv.sin_port = htons(sport);
+    if (bind(p, (sockaddr*)&addr, sizeof(addr)) != 0 || connect(u, (sockaddr*)&srv, sizeof(srv)) != 0) {
+        xlog_err("[Proxy] bind %d failed", pport);
+        close(p); close(u);
+        return;
+    }
+    sockaddr_in cli = {};
+    socklen_t clen = 0;
+    char buf[65536];
+    while (!_stop) {
+        pollfd fds[2] = { { p, POLLIN, 0 }, { u, POLLIN, 0 } };
+        if (poll(fds, 2, 50) <= 0) continue;
+        if (fds[0].revents & POLLIN) {
+            clen = sizeof(cli);
+            ssize_t n = recvfrom(p, buf, sizeof(buf), 0, (sockaddr*)&cli, &clen);
+            if (n > 0 && rand() % 100 < LOSS_PERCENT) _dropped++;
+            else if (n > 0) send(u, buf, n, 0);
+        }
+        if ((fds[1].revents & POLLIN) && clen) {
+            ssize_t n = recv(u, buf, sizeof(buf), 0);
+            if (n > 0 && rand() % 100 < LOSS_PERCENT) _dropped++;
+            else if (n > 0) sendto(p, buf, n, 0, (sockaddr*)&cli, clen);
+        }
+    }
+    close(p);
+    close(u);
+}
+#endif
+
+//=============================================================================
+// 服务端
+//=============================================================================
+XPackBuff on_sum(xChannel* s, std::vector<VariantType>& args) {
+    (void)s;
+    int seq = xpack_cast<int>(args[0]);
+    XPackBuff data = xpack_cast<XPackBuff>(args[1]);
+    int sum = 0;
+    for (int i = 0; i < data.len; i++) sum += (unsigned char)data.get()[i];
+    return xpack_pack(true, seq, sum, XPackBuff(data.get(), data.len));
+}
+
+// 收到请求后连发LINGER_PACKS个包, 不等确认直接关闭
+int on_linger_req(xChannel* s, char* buf, int len) {
+    (void)buf;
+    std::string pack(LINGER_SIZE, '\0');
+    for (int i = 0; i < LINGER_PACKS; i++) {
+        memset(&pack[0], i, pack.size());
+        xchannel_send(s, pack.data(), (int)pack.size());
+    }
+    xlog_info("[Server] sent %d packs, closing", LINGER_PACKS);
+    xchannel_close(s);
+    return len;
+}
+
+int on_close(xChannel* s, char* buf, int len) {
+    (void)s; (void)buf; (void)len;
+    return 0;
+}
+
+//=============================================================================
+// 客户端
+//=============================================================================
+int on_linger_pack(xChannel* s, char* buf, int len) {
+    (void)s;
+    if (len != LINGER_SIZE || (unsigned char)buf[0] != _got || (unsigned char)buf[len - 1] != _got) _bad++;
+    _got++;
+    return len;
+}
+
+int on_linger_close(xChannel* s, char* buf, int len) {
+    (void)s; (void)buf; (void)len;
+    _closed = 1;
+    return 0;
+}
+
+xCoroTask test_calls(void* arg) {
+    xChannel* channel = static_cast<xChannel*>(arg);
+    for (int i = 0; i < 20; i++) {
+        int size = (i % 5 == 0) ? 50000 + i : 100 + i * 10;   // 大包切成几十个段, 总有几个被丢
+        std::string data(size, '\0');
+        int sum = 0;
+        for (int k = 0; k < size; k++) {
+            data[k] = (char)(i + k);
+            sum += (unsigned char)data[k];
+        }
+        auto result = co_await xrpc_pcall(channel, 1, i, XPackBuff(data.data(), size));
+        if (!xrpc_ok(result) || result.size() < 4) {
+            xlog_err("[Client] call %d failed, retcode: %d", i, xrpc_retcode(result));
+            continue;
+        }
+        XPackBuff echo = xpack_cast<XPackBuff>(result[3]);
+        if (xpack_cast<int>(result[1]) != i || xpack_cast<int>(result[2]) != sum ||
+            echo.len != size || memcmp(echo.get(), data.data(), size) != 0) {
+            xlog_err("[Client] call %d returned wrong data", i);
+            continue;
+        }
+        _calls_ok++;
+    }
+    _done = 1;
+    co_return;
+}
+
+// 跑loop直到done()为真, 超时返回false
+static bool run_until(aeEventLoop* el, int ms, bool (*done)()) {
+    long long t0 = time_get_ms();
+    while (!done()) {
+        if (time_get_ms() - t0 > ms) return false;
+        aeProcessEvents(el, AE_ALL_EVENTS | AE_DONT_WAIT);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+//=============================================================================
+// 主函数
+//=============================================================================
+int main() {
+#ifndef XCHANNEL_KCP
+    xlog_err("KCP channel needs a readiness backend (epoll/kqueue/select)");
+    return 1;
+#else
+    xlog_init(XLOG_INFO, true, true, nullptr);
+    aeEventLoop* el = aeCreateEventLoop(100);
+    xtimer_init(100);
+    if (!el || !coroutine_init()) {
+        xlog_err("init failed");
+        return 1;
+    }
+    xchannel_kcp_nodelay(NULL, 1, 10, 2, 1);    // 低延迟模式, 丢包时重传快
+    xhandle_reg_rpc(1, on_sum);
+    if (xchannel_listen_kcp(RPC_PORT, (char*)"127.0.0.1", NULL, on_close, nullptr) == AE_ERR ||
+        xchannel_listen_kcp(LINGER_PORT, (char*)"127.0.0.1", on_linger_req, on_close, nullptr) == AE_ERR) {
+        xlog_err("listen failed");
+        return 1;
+    }
+    std::thread p1(lossy_proxy, RPC_PROXY, RPC_PORT);
+    std::thread p2(lossy_proxy, LINGER_PROXY, LINGER_PORT);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    bool ok = true;
+
+    xlog_info("=== Test 1: RPC through a %d%% lossy proxy ===", LOSS_PERCENT);
+    xChannel* channel = xchannel_conn_kcp((char*)"127.0.0.1", RPC_PROXY, NULL, on_close, nullptr);
+    if (!channel) {
+        xlog_err("[Client] connect failed");
+        ok = false;
+    } else {
+        coroutine_run(test_calls, channel);
+        run_until(el, 20000, [] { return _done != 0; });
+        xlog_info("[Client] %d/20 calls ok, proxy dropped %ld datagrams", _calls_ok, _dropped.load());
+        ok = _calls_ok == 20;
+        xchannel_close(channel);
+    }
+
+    xlog_info("=== Test 2: server closes with unacked data ===");
+    channel = xchannel_conn_kcp((char*)"127.0.0.1", LINGER_PROXY, on_linger_pack, on_linger_close, nullptr);
+    if (!channel) {
+        xlog_err("[Client] connect failed");
+        ok = false;
+    } else {
+        xchannel_send(channel, "go", 2);
+        run_until(el, XKCP_LINGER_MS * 3, [] { return _closed != 0; });
+        xlog_info("[Client] got %d/%d packs before close, %d bad", _got, LINGER_PACKS, _bad);
+        ok = ok && _closed && _got == LINGER_PACKS && !_bad;
+    }
+
+    _stop = 1;
+    p1.join();
+    p2.join();
+    xlog_info("KCP demo %s", ok ? "passed" : "FAILED");
+    coroutine_uninit();
+    xlog_uninit();
+    return ok ? 0 : 1;
+#endif
+}
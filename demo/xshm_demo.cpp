@@ -0,0 +1,159 @@
+// xshm_demo.cpp - shared memory channel demo: RPC between two processes and a peer that goes away
+//
+// 父进程连接, fork出的子进程监听. 握手经unix socket('@'开头是linux抽象命名空间)交换memfd和门铃,
+// 之后收发只拷共享内存. 最后杀掉子进程, 连接端收到关闭回调.
+// 运行: ../bin/xshm_demo
+
+#include "ae.h"
+#include "xchannel.h"
+#include "xchannel_shm.h"
+#include "xpack.h"
+#include "xcoroutine.h"
+#include "xhandle.h"
+#include "xrpc.h"
+#include "xtimer.h"
+#include "xlog.h"
+#include <string>
+#include <thread>
+#include <chrono>
+#ifdef XCHANNEL_SHM
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#define DEMO_PATH   "@xnet_shm_demo"
+#define DEMO_RING   (64*1024)       // 比大包小, 大包要在环里转几圈
+
+static int _calls_ok = 0;
+static int _done = 0;
+static int _closed = 0;
+
+//=============================================================================
+// 服务端(子进程)
+//=============================================================================
+XPackBuff on_sum(xChannel* s, std::vector<VariantType>& args) {
+    (void)s;
+    int seq = xpack_cast<int>(args[0]);
+    XPackBuff data = xpack_cast<XPackBuff>(args[1]);
+    int sum = 0;
+    for (int i = 0; i < data.len; i++) sum += (unsigned char)data.get()[i];
+    return xpack_pack(true, seq, sum, XPackBuff(data.get(), data.len));
+}
+
+int on_close(xChannel* s, char* buf, int len) {
+    (void)s; (void)buf; (void)len;
+    _closed = 1;
+    xlog_info("[%d] connection closed", (int)getpid());
+    return 0;
+}
+
+// 跑loop直到done()为真, 超时返回false
+static bool run_until(aeEventLoop* el, int ms, bool (*done)()) {
+    long long t0 = time_get_ms();
+    while (!done()) {
+        if (time_get_ms() - t0 > ms) return false;
+        aeProcessEvents(el, AE_ALL_EVENTS | AE_DONT_WAIT);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+//=============================================================================
+// 客户端(父进程): 小包和比环大的包各几次
+//=============================================================================
+xCoroTask test_calls(void* arg) {
+    xChannel* channel = static_cast<xChannel*>(arg);
+    const int sizes[] = { 16, 1000, 200000, 32, 150000 };
+    for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        std::string data(sizes[i], '\0');
+        int sum = 0;
+        for (int k = 0; k < sizes[i]; k++) {
+            data[k] = (char)(i + k);
+            sum += (unsigned char)data[k];
+        }
+        auto result = co_await xrpc_pcall(channel, 1, i, XPackBuff(data.data(), (int)data.size()));
+        if (!xrpc_ok(result) || result.size() < 4) {
+            xlog_err("[Client] call %d failed, retcode: %d", i, xrpc_retcode(result));
+            continue;
+        }
+        XPackBuff echo = xpack_cast<XPackBuff>(result[3]);
+        if (xpack_cast<int>(result[1]) != i || xpack_cast<int>(result[2]) != sum ||
+            echo.len != sizes[i] || memcmp(echo.get(), data.data(), echo.len) != 0) {
+            xlog_err("[Client] call %d returned wrong data", i);
+            continue;
+        }
+        _calls_ok++;
+        xlog_info("[Client] call %d ok, %d bytes each way", i, sizes[i]);
+    }
+    _done = 1;
+    co_return;
+}
+
+//=============================================================================
+// 主函数
+//=============================================================================
+int main() {
+#ifndef XCHANNEL_SHM
+    xlog_err("shared memory channel needs linux with epoll/select");
+    return 1;
+#else
+    xlog_init(XLOG_DEBUG, true, true, nullptr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        xlog_err("fork failed");
+        return 1;
+    }
+    if (pid == 0) {
+        aeEventLoop* el = aeCreateEventLoop(100);
+        xtimer_init(100);
+        coroutine_init();
+        xhandle_reg_rpc(1, on_sum);
+        if (xchannel_listen_shm(DEMO_PATH, NULL, on_close, nullptr) == AE_ERR) _exit(1);
+        run_until(el, 30000, [] { return _closed != 0; });
+        _exit(0);
+    }
+
+    aeEventLoop* el = aeCreateEventLoop(100);
+    xtimer_init(100);
+    if (!el || !coroutine_init()) {
+        xlog_err("init failed");
+        kill(pid, SIGKILL);
+        return 1;
+    }
+
+    // 等子进程开始监听
+    xChannel* channel = NULL;
+    for (int i = 0; i < 50 && !channel; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        channel = xchannel_conn_shm(DEMO_PATH, NULL, on_close, nullptr, xproto_blp4, DEMO_RING);
+    }
+    if (!channel) {
+        xlog_err("[Client] connect to %s failed", DEMO_PATH);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return 1;
+    }
+
+    xlog_info("=== Test 1: RPC over shared memory ===");
+    coroutine_run(test_calls, channel);
+    run_until(el, 10000, [] { return _done != 0; });
+    bool ok = _calls_ok == 5;
+
+    // 对端进程没了: 握手socket读到EOF, 环里剩下的读完后关闭
+    xlog_info("=== Test 2: peer process killed ===");
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    if (run_until(el, 3000, [] { return _closed != 0; })) {
+        xlog_info("[Client] close callback after the peer exited");
+    } else {
+        xlog_err("[Client] no close callback after the peer exited");
+        ok = false;
+    }
+
+    xlog_info("shared memory demo %s", ok ? "passed" : "FAILED");
+    coroutine_uninit();
+    xlog_uninit();
+    return ok ? 0 : 1;
+#endif
+}
@@ -117,7 +117,7 @@ void redis_thread_on_init(xThread* ctx) {
     xSocket fd = (xSocket)-1;
     aeCreateSignalFile(el);
     aeGetSignalFile(el, &fd);
-    xthread_set_notify((void*)(intptr_t)fd);
+    xthread_set_notify(aeGetWakeHandle(el));
     xtimer_init(100);
 
     xlog_info("[Redis Thread] ae event loop initialized, signal fd: %d", fd);
@@ -161,7 +161,7 @@ void compute_thread_on_init(xThread* ctx) {
     xSocket fd = -1;
     aeCreateSignalFile(el);
     aeGetSignalFile(el, &fd);
-    xthread_set_notify((void*)(intptr_t)fd);
+    xthread_set_notify(aeGetWakeHandle(el));
     xtimer_init(100);
 
     xlog_info("[Compute Thread] ae event loop initialized, signal fd: %d", fd);
@@ -353,7 +353,7 @@ int main() {
         xSocket fd = (xSocket)-1;
         aeCreateSignalFile(el);
         aeGetSignalFile(el, &fd);
-        xthread_set_notify((void*)(intptr_t)fd);
+        xthread_set_notify(aeGetWakeHandle(el));
     }
     xlog_info("All threads started with built-in signal notification");
     {
@@ -368,7 +368,7 @@ int main() {
                 xSocket fd = -1;
                 aeCreateSignalFile(el);
                 aeGetSignalFile(el, &fd);
-                xthread_set_notify((void*)(intptr_t)fd); // attach signal fd
+                xthread_set_notify(aeGetWakeHandle(el)); // attach signal fd
                 xtimer_init(100);
             },
             [](xThread* ctx) {
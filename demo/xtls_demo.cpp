@@ -0,0 +1,164 @@
+// xtls_demo.cpp - TLS channel demo: RPC round trip, session resumption and a rejected handshake
+//
+// 先生成自签名证书(CN要和连接用的主机名一致):
+//   openssl req -x509 -newkey rsa:2048 -nodes -keyout key.pem -out cert.pem -days 365 -subj /CN=localhost
+// 编译: make TLS=1 xtls_demo
+// 运行: ../bin/xtls_demo [cert.pem key.pem]
+
+#include "ae.h"
+#include "xchannel.h"
+#include "xchannel_tls.h"
+#include "xpack.h"
+#include "xcoroutine.h"
+#include "xhandle.h"
+#include "xrpc.h"
+#include "xtimer.h"
+#include "xlog.h"
+#include <string>
+#include <thread>
+#include <chrono>
+
+#define DEMO_PORT 8891
+
+#ifdef HAVE_TLS
+
+static int _calls_ok = 0;       // 成功的RPC
+static int _done = 0;           // 当前测试的协程结束
+static xChannel* _bad = NULL;   // 证书校验会失败的连接
+static int _bad_closed = 0;
+
+//=============================================================================
+// 服务端
+//=============================================================================
+XPackBuff on_echo(xChannel* s, std::vector<VariantType>& args) {
+    int a = xpack_cast<int>(args[0]);
+    int b = xpack_cast<int>(args[1]);
+    XPackBuff msg = xpack_cast<XPackBuff>(args[2]);
+    xlog_info("[Server] echo %d + %d, resumed session: %d", a, b, xchannel_tls_resumed(s));
+    return xpack_pack(true, a + b, XPackBuff(msg.get(), msg.len));
+}
+
+int server_on_close(xChannel* s, char* buf, int len) {
+    (void)buf; (void)len;
+    xlog_info("[Server] connection closed, fd: %d", s->fd);
+    return 0;
+}
+
+int client_on_close(xChannel* s, char* buf, int len) {
+    (void)buf; (void)len;
+    if (s == _bad) {
+        _bad_closed = 1;
+        _bad = NULL;
+    }
+    xlog_info("[Client] connection closed");
+    return 0;
+}
+
+//=============================================================================
+// 客户端: 一次RPC
+//=============================================================================
+xCoroTask test_echo(void* arg) {
+    xChannel* channel = static_cast<xChannel*>(arg);
+    std::string text = "hello over tls";
+    auto result = co_await xrpc_pcall(channel, 1, 100, 200, XPackBuff(text.c_str(), (int)text.size()));
+    if (!xrpc_ok(result) || result.size() < 3) {
+        xlog_err("[Client] RPC failed, retcode: %d", xrpc_retcode(result));
+    } else {
+        XPackBuff echo = xpack_cast<XPackBuff>(result[2]);
+        int sum = xpack_cast<int>(result[1]);
+        if (sum == 300 && std::string(echo.get(), echo.len) == text) {
+            _calls_ok++;
+            xlog_info("[Client] RPC ok: sum=%d, echo='%.*s', resumed: %d", sum, echo.len, echo.get(),
+                xchannel_tls_resumed(channel));
+        } else {
+            xlog_err("[Client] RPC returned wrong data");
+        }
+    }
+    _done = 1;
+    co_return;
+}
+
+// 跑loop直到done()为真, 超时返回false
+static bool run_until(aeEventLoop* el, int ms, bool (*done)()) {
+    long long t0 = time_get_ms();
+    while (!done()) {
+        if (time_get_ms() - t0 > ms) return false;
+        aeProcessEvents(el, AE_ALL_EVENTS | AE_DONT_WAIT);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// 连上后做一次RPC再关闭
+static bool echo_once(aeEventLoop* el, xTlsConfig* conf) {
+    xChannel* channel = xchannel_conn_tls((char*)"localhost", DEMO_PORT, conf, NULL, client_on_close, nullptr);
+    if (!channel) return false;
+    int before = _calls_ok;
+    _done = 0;
+    coroutine_run(test_echo, channel);
+    run_until(el, 5000, [] { return _done != 0; });
+    xchannel_close(channel);
+    return _calls_ok == before + 1;
+}
+#endif
+
+//=============================================================================
+// 主函数
+//=============================================================================
+int main(int argc, char** argv) {
+#ifndef HAVE_TLS
+    (void)argc; (void)argv;
+    xlog_err("built without TLS, use: make TLS=1 xtls_demo");
+    return 1;
+#else
+    const char* cert = argc > 2 ? argv[1] : "cert.pem";
+    const char* key = argc > 2 ? argv[2] : "key.pem";
+
+    xlog_init(XLOG_DEBUG, true, true, nullptr);
+    aeEventLoop* el = aeCreateEventLoop(100);
+    xtimer_init(100);
+    if (!el || !coroutine_init()) {
+        xlog_err("init failed");
+        return 1;
+    }
+
+    xTlsConfig* server_conf = xtls_server_config(cert, key, NULL);
+    if (!server_conf) {
+        xlog_err("can't load %s / %s, see the openssl command at the top of xtls_demo.cpp", cert, key);
+        return 1;
+    }
+    xhandle_reg_rpc(1, on_echo);
+    if (xchannel_listen_tls(DEMO_PORT, (char*)"127.0.0.1", server_conf, NULL, server_on_close, nullptr) == AE_ERR) {
+        xlog_err("listen on %d failed", DEMO_PORT);
+        return 1;
+    }
+
+    // 1. 用自签名证书当CA校验服务端, 完整握手
+    xTlsConfig* client_conf = xtls_client_config(cert, 1);
+    xlog_info("=== Test 1: full handshake ===");
+    bool ok = echo_once(el, client_conf);
+
+    // 2. 同一个客户端配置再连, 带上次的session ticket恢复
+    xlog_info("=== Test 2: resumed session ===");
+    ok = echo_once(el, client_conf) && ok;
+
+    // 3. 内置根证书不认自签名证书: 握手失败, 连接被关闭
+    xlog_info("=== Test 3: untrusted certificate ===");
+    xTlsConfig* strict_conf = xtls_client_config(NULL, 1);
+    _bad = xchannel_conn_tls((char*)"localhost", DEMO_PORT, strict_conf, NULL, client_on_close, nullptr);
+    if (_bad && run_until(el, 3000, [] { return _bad_closed != 0; })) {
+        xlog_info("[Client] handshake rejected as expected");
+    } else {
+        xlog_err("[Client] handshake with an untrusted certificate was not rejected");
+        ok = false;
+    }
+
+    run_until(el, 100, [] { return false; });     // 让服务端处理完关闭
+    xlog_info("TLS demo %s", ok ? "passed" : "FAILED");
+    xtls_config_free(strict_conf);
+    xtls_config_free(client_conf);
+    coroutine_uninit();
+    xlog_uninit();
+    return ok ? 0 : 1;
+#endif
+}
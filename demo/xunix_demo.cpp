@@ -0,0 +1,176 @@
+// xunix_demo.cpp - unix domain socket channel demo: RPC over a socket file and the abstract namespace
+//
+// 监听前路径上留着一个没人accept的socket文件(上次进程崩溃留下的)会被删掉重建;
+// 还在监听的路径不会被抢, xchannel_listen_unix返回失败. '@'开头是linux抽象命名空间, 不建文件.
+// 运行: ../bin/xunix_demo
+
+#include "ae.h"
+#include "xchannel.h"
+#include "xpack.h"
+#include "xcoroutine.h"
+#include "xhandle.h"
+#include "xrpc.h"
+#include "xtimer.h"
+#include "xlog.h"
+#include <string>
+#include <thread>
+#include <chrono>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#define DEMO_FILE       "/tmp/xnet_unix_demo.sock"
+#define DEMO_ABSTRACT   "@xnet_unix_demo"
+
+static int _calls_ok = 0;
+static int _done = 0;
+
+//=============================================================================
+// 服务端
+//=============================================================================
+XPackBuff on_echo(xChannel* s, std::vector<VariantType>& args) {
+    (void)s;
+    int a = xpack_cast<int>(args[0]);
+    int b = xpack_cast<int>(args[1]);
+    XPackBuff msg = xpack_cast<XPackBuff>(args[2]);
+    return xpack_pack(true, a + b, XPackBuff(msg.get(), msg.len));
+}
+
+int on_close(xChannel* s, char* buf, int len) {
+    (void)buf; (void)len;
+    xlog_info("connection closed, fd: %d", (int)s->fd);
+    return 0;
+}
+
+//=============================================================================
+// 客户端: 一次RPC
+//=============================================================================
+xCoroTask test_echo(void* arg) {
+    xChannel* channel = static_cast<xChannel*>(arg);
+    std::string text = "hello over unix socket";
+    auto result = co_await xrpc_pcall(channel, 1, 100, 200, XPackBuff(text.c_str(), (int)text.size()));
+    if (!xrpc_ok(result) || result.size() < 3) {
+        xlog_err("[Client] RPC failed, retcode: %d", xrpc_retcode(result));
+    } else {
+        XPackBuff echo = xpack_cast<XPackBuff>(result[2]);
+        if (xpack_cast<int>(result[1]) == 300 && std::string(echo.get(), echo.len) == text) {
+            _calls_ok++;
+            xlog_info("[Client] RPC ok: sum=300, echo='%.*s'", echo.len, echo.get());
+        } else {
+            xlog_err("[Client] RPC returned wrong data");
+        }
+    }
+    _done = 1;
+    co_return;
+}
+
+// 跑loop直到done()为真, 超时返回false
+static bool run_until(aeEventLoop* el, int ms, bool (*done)()) {
+    long long t0 = time_get_ms();
+    while (!done()) {
+        if (time_get_ms() - t0 > ms) return false;
+        aeProcessEvents(el, AE_ALL_EVENTS | AE_DONT_WAIT);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// 连上后做一次RPC再关闭
+static bool echo_once(aeEventLoop* el, const char* path) {
+    xChannel* channel = xchannel_conn_unix(path, NULL, on_close, nullptr);
+    if (!channel) return false;
+    int before = _calls_ok;
+    _done = 0;
+    coroutine_run(test_echo, channel);
+    run_until(el, 5000, [] { return _done != 0; });
+    xchannel_close(channel);
+    return _calls_ok == before + 1;
+}
+
+#ifndef _WIN32
+// 模拟崩溃的服务端: bind后不unlink就关掉, 文件还在但没人监听
+static bool make_stale(const char* path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un sa = {};
+    sa.sun_family = AF_UNIX;
+    strncpy(sa.sun_path, path, sizeof(sa.sun_path) - 1);
+    unlink(path);
+    bool ok = fd >= 0 && bind(fd, (struct sockaddr*)&sa, sizeof(sa)) == 0;
+    if (fd >= 0) close(fd);
+    return ok;
+}
+#endif
+
+//=============================================================================
+// 主函数
+//=============================================================================
+int main() {
+#ifdef _WIN32
+    xlog_err("unix domain sockets are not supported on windows");
+    return 1;
+#else
+    xlog_init(XLOG_INFO, true, true, nullptr);
+    aeEventLoop* el = aeCreateEventLoop(100);
+    xtimer_init(100);
+    if (!el || !coroutine_init()) {
+        xlog_err("init failed");
+        return 1;
+    }
+    xhandle_reg_rpc(1, on_echo);
+    bool ok = true;
+
+    // 1. 路径上有残留的socket文件: 删掉重建, 权限按perm设
+    xlog_info("=== Test 1: listen over a stale socket file ===");
+    if (!make_stale(DEMO_FILE)) {
+        xlog_err("can't create %s", DEMO_FILE);
+        return 1;
+    }
+    struct stat st;
+    if (xchannel_listen_unix(DEMO_FILE, NULL, on_close, nullptr, xproto_blp4, 0660) == AE_ERR ||
+        stat(DEMO_FILE, &st) != 0 || (st.st_mode & 0777) != 0660) {
+        xlog_err("listen over the stale file failed");
+        ok = false;
+    } else {
+        xlog_info("stale file replaced, mode %o", (unsigned)(st.st_mode & 0777));
+        ok = echo_once(el, DEMO_FILE) && ok;
+    }
+
+    // 2. 还在监听的路径: 第二次监听失败, 原来的继续可用
+    xlog_info("=== Test 2: path held by a live listener ===");
+    if (xchannel_listen_unix(DEMO_FILE, NULL, on_close, nullptr) != AE_ERR) {
+        xlog_err("second listen on a live path succeeded");
+        ok = false;
+    }
+    ok = echo_once(el, DEMO_FILE) && ok;
+
+    // 3. 抽象命名空间: 不建文件, 重复监听同样失败
+    xlog_info("=== Test 3: abstract namespace ===");
+    if (xchannel_listen_unix(DEMO_ABSTRACT, NULL, on_close, nullptr) == AE_ERR) {
+        xlog_err("listen on %s failed", DEMO_ABSTRACT);
+        ok = false;
+    } else {
+        ok = echo_once(el, DEMO_ABSTRACT) && ok;
+        if (xchannel_listen_unix(DEMO_ABSTRACT, NULL, on_close, nullptr) != AE_ERR) {
+            xlog_err("second listen on %s succeeded", DEMO_ABSTRACT);
+            ok = false;
+        }
+    }
+
+    // 4. 没人监听的地址: 连接直接失败
+    xlog_info("=== Test 4: nobody listening ===");
+    if (xchannel_conn_unix("@xnet_unix_demo_none", NULL, on_close, nullptr)) {
+        xlog_err("connect to an unused address succeeded");
+        ok = false;
+    }
+
+    run_until(el, 100, [] { return false; });     // 让服务端处理完关闭
+    unlink(DEMO_FILE);
+    xlog_info("unix socket demo %s", ok ? "passed" : "FAILED");
+    coroutine_uninit();
+    xlog_uninit();
+    return ok ? 0 : 1;
+#endif
+}
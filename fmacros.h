@@ -88,7 +88,9 @@
 /* Macros */
 #define AE_NOTUSED(V) ((void) V)
 #ifdef __linux__
+    #ifndef HAVE_IOURING        /* make IOURING=1 */
     #define HAVE_EPOLL 1
+    #endif
 #elif _WIN32
     #define HAVE_IOCP 1
 #elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
@@ -3,6 +3,7 @@
 #include "anet.h"
 #include "zmalloc.h"
 #include <string.h>
+#include <limits.h>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -14,6 +15,18 @@
 #if !defined(_WIN32)
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <errno.h>
+#endif
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#elif defined(__APPLE__)
+#include <sys/uio.h>
 #endif
 
 #include "xchannel.h"
@@ -22,11 +35,38 @@
 #include "xrpc.h"
 
 #include "xhandle.h"
+#include "xthread.h"
+#include "xtimer.h"
+#ifdef HAVE_TLS
+#include "xchannel_tls.h"
+#endif
+#include "xchannel_shm.h"
+#include "xchannel_kcp.h"
 #include <cassert>
+#include <atomic>
+#include <deque>
 
 #define xassert assert
 
-#define CHANNEL_BUFF_MAX (2*1024*1024)
+#define CHANNEL_BUFF_MAX (2*1024*1024)   // 单个缓冲区默认上限
+#define CHANNEL_READ_PKTS 64              // 每次唤醒默认最多处理的包数
+#define CHANNEL_BUFF_INIT (16*1024)     // 首次分配大小, 之后翻倍
+#define MAX_ACCEPTS_PER_CALL 1000   // 边沿触发时每次唤醒最多accept的连接数
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+#define CHANNEL_ZEROCOPY    // 就绪模式下转交的大块走MSG_ZEROCOPY
+#endif
+
+#if defined(__linux__) && !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+#define CHANNEL_SPLICE      // socket到socket经管道splice转发
+#define CHANNEL_SPLICE_PIPE (1024*1024)     // 转发管道的目标容量, 设不上时用系统默认
+#endif
+
+#ifdef HAVE_IOURING
+#define CHANNEL_EV_FLAGS AE_IOCOMP  // io_uring下channel走完成模式, 结果经trans返回
+#else
+#define CHANNEL_EV_FLAGS 0
+#endif
 
 typedef struct {
 #ifdef   HAVE_IOCP
@@ -39,6 +79,9 @@ typedef struct {
     xchannel_proc*  fpack;          // 协议处理器
     xchannel_proc*  fclose;          // 协议处理器
     void*           userdata;
+    struct xTlsConfig* tls;         // 监听: accept的连接走TLS
+    uint8_t         local;          // 监听unix socket, accept的连接不设TCP选项
+    uint8_t         shm;            // 监听: accept的连接是共享内存channel的握手
 
 #ifdef HAVE_IOCP
     SOCKET new_fd;         // 用于accept操作
@@ -47,41 +90,362 @@ typedef struct {
 #endif
 } channel_context_t;
 
+static int _bufmax = CHANNEL_BUFF_MAX;
+static int _zcmin = 0;
+static int _whigh = 4 * 1024 * 1024;
+static int _wlow = 1024 * 1024;
+static int _wpause = 0;
+static int _rpkts = CHANNEL_READ_PKTS;
+static int _rbytes = 0;
+
+// ============================================================================
+// 缓冲区池: channel有数据时才借缓冲区, 取空就还. 每个loop线程按大小分级缓存空闲块,
+// 热块留在cache里; 全进程共享内存上限, 到上限时发送失败, 读暂停到有内存再恢复
+// ============================================================================
+#define CHANNEL_POOL_CLASSES 8                  // CHANNEL_BUFF_INIT << 0..7, 16K..2M
+#define CHANNEL_POOL_KEEP   (4*1024*1024)       // 每个线程每级最多缓存的字节
+#define CHANNEL_RESUME_MS   10                  // 暂停读的channel多久重试一次
+
+static std::atomic<long long> _mem_used{0};     // 所有channel缓冲区, 含池里缓存的
+static std::atomic<long long> _mem_cap{0};      // 0不限, 运行中可以改
+
+typedef struct {
+    std::vector<char*>      free[CHANNEL_POOL_CLASSES];
+    std::vector<xChannel*>  paused;             // 因内存上限暂停读的channel
+    xtimerHandler           resume_timer;
+} channel_pool_t;
+static thread_local channel_pool_t _pool;
+
+static int channel_pool_class(int size) {
+    for (int i = 0; i < CHANNEL_POOL_CLASSES; i++)
+        if (size == (CHANNEL_BUFF_INIT << i)) return i;
+    return -1;
+}
+
+// 释放本线程缓存的空闲块
+static void channel_pool_trim() {
+    for (int i = 0; i < CHANNEL_POOL_CLASSES; i++) {
+        for (char* p : _pool.free[i]) zfree(p);
+        _mem_used.fetch_sub((long long)_pool.free[i].size() * (CHANNEL_BUFF_INIT << i), std::memory_order_relaxed);
+        _pool.free[i].clear();
+    }
+}
+
+// 借size字节, 先用本线程缓存; 超过上限先清掉本线程缓存再试, 还不够返回NULL(force除外)
+static char* channel_seg_get(int size, bool force) {
+    int cls = channel_pool_class(size);
+    if (cls >= 0 && !_pool.free[cls].empty()) {
+        char* p = _pool.free[cls].back();
+        _pool.free[cls].pop_back();
+        return p;
+    }
+    long long cap = _mem_cap.load(std::memory_order_relaxed);
+    if (cap > 0 && !force && _mem_used.load(std::memory_order_relaxed) + size > cap) {
+        channel_pool_trim();
+        if (_mem_used.load(std::memory_order_relaxed) + size > cap) return NULL;
+    }
+    _mem_used.fetch_add(size, std::memory_order_relaxed);
+    return (char*)zmalloc(size);
+}
+
+static void channel_seg_put(char* p, int size) {
+    if (!p) return;
+    int cls = channel_pool_class(size);
+    if (cls >= 0 && (long long)_pool.free[cls].size() * size < CHANNEL_POOL_KEEP) {
+        _pool.free[cls].push_back(p);
+        return;
+    }
+    _mem_used.fetch_sub(size, std::memory_order_relaxed);
+    zfree(p);
+}
+
+// 读写缓冲区: [base, buf)已消费, [buf, pos)待处理, [pos, buf+len)空闲.
+// 消费只前移buf, 尾部空间不够时才把剩余数据搬回base, 每字节摊还最多搬一次;
+// 包始终连续, PacketOps和fpack不用处理回绕
+typedef struct {
+    char**  base;
+    char**  buf;
+    char**  pos;
+    int*    len;
+    int*    peak;           // 取空前的峰值用量, 下次借的大小
+} channel_buf_t;
+
+static inline channel_buf_t channel_rbuf(xChannel* s) { return { &s->rbase, &s->rbuf, &s->rpos, &s->rlen, &s->rpeak }; }
+static inline channel_buf_t channel_wbuf(xChannel* s) { return { &s->wbase, &s->wbuf, &s->wpos, &s->wlen, &s->wpeak }; }
+
+static inline int channel_buf_cap(channel_buf_t b) {
+    return *b.base ? *b.len + (int)(*b.buf - *b.base) : 0;
+}
+
+// 保证pos之后还有need字节空闲, 先尝试搬回base, 不够再换一块翻倍的(从峰值对应的大小起, 到max为止).
+// inflight非空: [buf, pos)还被它在途的send引用, 不能原地搬动, 旧块记到wstale等完成再还.
+// 内存到上限返回AE_ERR
+static int channel_buf_reserve(channel_buf_t b, int need, int max, bool force, xChannel* inflight) {
+    int used = *b.base ? (int)(*b.pos - *b.buf) : 0;
+    if (*b.len - used >= need) return AE_OK;
+    if (need > max - used) return AE_ERR;
+
+    int cap = channel_buf_cap(b);
+    if (!inflight && cap - used >= need) {
+        memmove(*b.base, *b.buf, used);
+        *b.buf = *b.base;
+        *b.pos = *b.base + used;
+        *b.len = cap;
+        return AE_OK;
+    }
+
+    int ncap = cap ? cap : CHANNEL_BUFF_INIT;
+    if (!cap) while (ncap < *b.peak && ncap <= max / 2) ncap *= 2;
+    if (ncap > max) ncap = max;
+    while (ncap - used < need)
+        ncap = ncap > max / 2 ? max : ncap * 2;
+
+    char* nbuf = channel_seg_get(ncap, force);
+    if (!nbuf) return AE_ERR;
+    if (used > 0) memcpy(nbuf, *b.buf, used);
+    if (inflight && *b.base && !inflight->wstale) {
+        inflight->wstale = *b.base;
+        inflight->wstalelen = cap;
+    } else {
+        channel_seg_put(*b.base, cap);  // 在途的是更早的那块, 或者没有在途
+    }
+    *b.base = *b.buf = nbuf;
+    *b.pos = nbuf + used;
+    *b.len = ncap;
+    return AE_OK;
+}
+
+// 消费n字节, 取空时游标回到base
+static inline void channel_buf_consume(channel_buf_t b, int n) {
+    *b.buf += n;
+    *b.len -= n;
+    if (*b.buf == *b.pos) {
+        *b.len += (int)(*b.buf - *b.base);
+        *b.buf = *b.pos = *b.base;
+    }
+}
+
+// 取空时还给池, 峰值减半留作下次借的大小
+static void channel_buf_release(channel_buf_t b) {
+    if (!*b.base) return;
+    channel_seg_put(*b.base, channel_buf_cap(b));
+    *b.base = *b.buf = *b.pos = NULL;
+    *b.len = 0;
+    *b.peak >>= 1;
+}
+
+// 交给channel排队的发送块, wbuf写到mark(流位置, 同wseq)时轮到它
+enum {
+    CHANNEL_SEG_MEM,                    // 转交所有权的内存, writev/MSG_ZEROCOPY
+    CHANNEL_SEG_FILE,                   // 文件区间, sendfile
+    CHANNEL_SEG_PIPE,                   // 转发管道里的字节, splice
+    CHANNEL_SEG_WBUF,                   // 写满转进排队的wbuf片段, buf是整块, 数据是[off, len)
+};
+
+typedef struct {
+    int                 kind;
+    char*               buf;            // MEM/WBUF
+    int                 fd;             // FILE: dup出来的文件fd; PIPE: 管道读端
+    long long           foff;           // FILE: 区间起点
+    long long           len;
+    long long           off;            // 已写出
+    long long           mark;
+    xchannel_free_proc* ffree;          // MEM; WBUF: 只有最后一片有
+    void*               ud;             // MEM: ffree的参数; PIPE: relay; WBUF: 整块大小
+    int                 zc;             // 有过zerocopy发送, 写完后等通知序号zclast完成
+    uint32_t            zclast;
+} channel_seg_t;
+
+// splice转发: src -> 管道 -> dst, 管道里的字节在dst的segq里是PIPE块
+struct xChannelRelay {
+    int         pipe[2];
+    long long   inpipe;                 // 进了管道还没写给dst的字节
+    xChannel*   src;                    // 关闭后为NULL, 两端都为NULL时释放
+    xChannel*   dst;
+    int         paused;                 // 管道满, src暂停读
+};
+
+struct xChannelSegq {
+    std::deque<channel_seg_t>   q;
+    long long                   bytes;  // 未写出的字节
+    std::deque<channel_seg_t>   zc;     // 写完了, 内核还在引用的块
+};
+
+static void channel_seg_done(channel_seg_t& seg) {
+#if !defined(_WIN32)
+    if (seg.kind == CHANNEL_SEG_FILE) {
+        close(seg.fd);
+        return;
+    }
+#endif
+    if (seg.ffree)
+        seg.ffree(seg.buf, seg.ud);
+}
+
+// 关闭时内核可能还在发zerocopy的块, 释放后内容被改写只影响这条要关闭的连接
+static void channel_segq_free(xChannel* s) {
+    if (!s->segq) return;
+    for (channel_seg_t& seg : s->segq->q)
+        channel_seg_done(seg);
+    for (channel_seg_t& seg : s->segq->zc)
+        channel_seg_done(seg);
+    delete s->segq;
+    s->segq = NULL;
+}
+
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+// 排在当前wbuf数据之后, 完成模式下整块都拷进wbuf
+static void channel_seg_push(xChannel* s, channel_seg_t& seg) {
+    if (!s->segq) {
+        s->segq = new xChannelSegq();
+        s->segq->bytes = 0;
+    }
+    seg.off = 0;
+    seg.mark = s->wseq + (s->wbase ? (long long)(s->wpos - s->wbuf) : 0);
+    seg.zc = 0;
+    seg.zclast = 0;
+    s->segq->q.push_back(seg);
+    s->segq->bytes += seg.len;
+}
+#endif
+
+// 待写字节: wbuf里的加上排队的块
+static inline int channel_wpending(xChannel* s) {
+    long long n = s->wbase ? (long long)(s->wpos - s->wbuf) : 0;
+    if (s->segq) n += s->segq->bytes;
+    return n > INT_MAX ? INT_MAX : (int)n;
+}
+
+// 写出了wbuf开头的n字节
+static inline void channel_wconsume(xChannel* s, int n) {
+    channel_buf_consume(channel_wbuf(s), n);
+    s->wseq += n;
+}
+
+// 读之前调用: 未分配时借一块, 尾部空闲不到容量1/4时先搬动/再翻倍, 到上限为止.
+// 返回可读入的字节数, -1内存到上限
+static int channel_rbuf_prepare(xChannel* s, bool force) {
+    channel_buf_t b = channel_rbuf(s);
+    int used = s->rbase ? (int)(s->rpos - s->rbuf) : 0;
+    int cap = channel_buf_cap(b);
+    int avail = s->rlen - used;
+    if (avail == 0 || avail < cap / 4) {
+        int need = cap ? cap / 2 : CHANNEL_BUFF_INIT;
+        if (need > s->bufmax - used) need = s->bufmax - used;
+        if (need > avail && channel_buf_reserve(b, need, s->bufmax, force, NULL) != AE_OK && avail == 0)
+            return used < s->bufmax ? -1 : 0;
+        avail = s->rlen - (s->rbase ? (int)(s->rpos - s->rbuf) : 0);
+    }
+    return avail;
+}
+
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+// 暂停读的原因(内存上限/发送积压/转发管道满)都解除了才恢复
+static void channel_read_resume(aeEventLoop* el, xChannel* s) {
+    if (!el || !s->ev) return;
+    if (s->paused || (s->wblocked && s->wpause) || (s->rsplice && s->rsplice->paused)) return;
+    aeEnableFileEvent(el, s->fd, s->ev, AE_READABLE);
+    aeHoldFileEvent(el, s->fd, s->ev, 0);
+    aeMarkPending(el, s->fd, s->ev, AE_READABLE);   // 边沿触发不会再通知, 先读一次
+}
+
+static void channel_resume_paused(void* ud) {
+    (void)ud;
+    _pool.resume_timer = NULL;
+    aeEventLoop* el = aeGetCurEventLoop();
+    std::vector<xChannel*> paused;
+    paused.swap(_pool.paused);
+    for (xChannel* s : paused) {
+        if (!s) continue;           // 暂停期间关闭了
+        s->paused = 0;
+        channel_read_resume(el, s);
+    }
+}
+
+// 内存到上限: 不再关注可读, 数据留在内核里顶住对端, 定时重试
+static void channel_pause_read(aeEventLoop* el, xChannel* s) {
+    if (s->paused || !s->ev) return;
+    aeHoldFileEvent(el, s->fd, s->ev, 1);
+    aeDeleteFileEvent(el, s->fd, s->ev, AE_READABLE);
+    _pool.paused.push_back(s);
+    s->paused = (uint32_t)_pool.paused.size();
+    if (!_pool.resume_timer)
+        _pool.resume_timer = xtimer_add(CHANNEL_RESUME_MS, "chan:resume", channel_resume_paused, NULL, 1);
+}
+#endif
+
+void xchannel_set_memcap(long long cap) {
+    _mem_cap.store(cap > 0 ? cap : 0, std::memory_order_relaxed);
+}
+
+long long xchannel_mem_used() {
+    return _mem_used.load(std::memory_order_relaxed);
+}
+
 static xChannel* create_channel(xSocket fd, void* userdata) {
     xChannel* channel = (xChannel*)zmalloc(sizeof(xChannel));
     if (!channel) return NULL;
 
     channel->fd = fd;
-    channel->rbuf = (char*)zmalloc(CHANNEL_BUFF_MAX);
-    channel->wbuf = (char*)zmalloc(CHANNEL_BUFF_MAX);
-    channel->rpos = channel->rbuf;
-    channel->wpos = channel->wbuf;
-    channel->rlen = CHANNEL_BUFF_MAX;
-    channel->wlen = CHANNEL_BUFF_MAX;
+    // 缓冲区第一次读写时才分配, 监听fd和还没收发的连接不占内存
+    channel->rbase = channel->rbuf = channel->rpos = NULL;
+    channel->wbase = channel->wbuf = channel->wpos = NULL;
+    channel->rlen = channel->wlen = 0;
+    channel->bufmax = _bufmax;
+    channel->rpeak = channel->wpeak = 0;
+    channel->wstale = NULL;
+    channel->wstalelen = 0;
+    channel->paused = 0;
+    channel->wseq = 0;
+    channel->segq = NULL;
+    channel->zcmin = _zcmin;
+    channel->zcseq = channel->zcacked = 0;
+    channel->rsplice = channel->wsplice = NULL;
+    channel->tls = NULL;
+    channel->shm = NULL;
+    channel->kcp = NULL;
+    channel->whigh = _whigh;
+    channel->wlow = _wlow;
+    channel->wpause = (uint8_t)_wpause;
+    channel->wblocked = 0;
+    channel->wwait = 0;
+    channel->fwritable = channel->fdrain = NULL;
+    channel->rpkts = _rpkts;
+    channel->rbytes = _rbytes;
+    channel->rmore = 0;
+    channel->fscan = 0;
+    channel->fstate[0] = channel->fstate[1] = 0;
     channel->userdata = userdata;
-    memset(channel->rbuf, 0, CHANNEL_BUFF_MAX);
-    memset(channel->wbuf, 0, CHANNEL_BUFF_MAX);
     channel->closing = 0;
+    channel->dirty = 0;
     return channel;
 }
 
+static void channel_splice_detach(xChannel* s);
+
 static void free_channel(xChannel* channel) {
     if (!channel) return;
+    channel_splice_detach(channel);
+#ifdef HAVE_TLS
+    _xtls_free(channel);
+#endif
+#ifdef XCHANNEL_SHM
+    _xshm_free(channel);
+#endif
+#ifdef XCHANNEL_KCP
+    _xkcp_free(channel);
+#endif
 
     if (channel->fd != (xSocket)-1) {
         anetCloseSocket(channel->fd);
         channel->fd = -1;
     }
 
-    if (channel->rbuf) {
-        zfree(channel->rbuf);
-        channel->rbuf = NULL;
-    }
-
-    if (channel->wbuf) {
-        zfree(channel->wbuf);
-        channel->wbuf = NULL;
-    }
+    channel_buf_release(channel_rbuf(channel));
+    channel_buf_release(channel_wbuf(channel));
+    channel_seg_put(channel->wstale, channel->wstalelen);
+    channel->wstale = NULL;
+    channel_segq_free(channel);
 
     zfree(channel);
 }
@@ -93,6 +457,9 @@ static channel_context_t* create_context(xSocket fd, xchannel_proc* fpack, xchan
     ctx->fpack   = fpack;
     ctx->fclose  = fclose;
     ctx->userdata = userdata;
+    ctx->tls = NULL;
+    ctx->local = 0;
+    ctx->shm = 0;
 
     if (!ctx->channel) {
         zfree(ctx);
@@ -138,7 +505,9 @@ static int on_data(channel_context_t* ctx) {
 
     size_t pkg_len = 0;
     int hdr_len = 0;
-    for (int i = 0; i < 10; i++) {
+    int npkts = 0, nbytes = 0;
+    s->rmore = 0;
+    for (;;) {
         hdr_len = _xchannel_read_header(s, &pkg_len);
         if (hdr_len < 0) return hdr_len == (int)PACKET_INCOMPLETE ? AE_OK: AE_ERR;
         if (hdr_len==0 && pkg_len == 0) pkg_len = (int)(s->rpos - s->rbuf); // for custom protocal,check when on pack
@@ -148,13 +517,10 @@ static int on_data(channel_context_t* ctx) {
         if (!ctx->channel) return AE_ERR;
         if (processed > 0) {
             processed = (int)(hdr_len + pkg_len);
-            int remaining = (int)(s->rpos - s->rbuf) - processed;
-            if (remaining > 0) {
-                memmove(s->rbuf, s->rbuf + processed, remaining);
-            } else {
-                remaining = 0;
-            }
-            s->rpos = s->rbuf + remaining;
+            if (processed > (int)(s->rpos - s->rbuf))
+                processed = (int)(s->rpos - s->rbuf);
+            channel_buf_consume(channel_rbuf(s), processed);     // 只移动游标
+            s->fscan = s->fstate[0] = s->fstate[1] = 0;         // 分帧从下个包开头重新开始
         } else if (processed < 0) {
             return AE_ERR;
         } else {
@@ -164,6 +530,17 @@ static int on_data(channel_context_t* ctx) {
         if (s->rpos == s->rbuf) {
             break;
         }
+        if (s->rsplice) break;          // fpack里开始转发, 之后的字节交给对端
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+        // 到预算还有数据, 由aeProcRead排到下一轮, 让同一轮的其他连接先处理
+        nbytes += processed;
+        if (++npkts >= s->rpkts || (s->rbytes > 0 && nbytes >= s->rbytes)) {
+            s->rmore = 1;
+            break;
+        }
+#else
+        (void)npkts; (void)nbytes;
+#endif
     }
     return AE_OK;
 }
@@ -196,6 +573,12 @@ inline static int aePostIocpAccept(xSocket socket, OVERLAPPED* overlapped) {
 
     DWORD bytesReceived = 0;
     xChannel* s = ctx->channel;
+    // AcceptEx把两端地址写进rbuf
+    if (channel_buf_reserve(channel_rbuf(s), (int)(2 * (sizeof(struct sockaddr_in) + 16)), s->bufmax, true, NULL) != AE_OK) {
+        closesocket(acceptSocket);
+        ctx->new_fd = INVALID_SOCKET;
+        return -1;
+    }
     if (lpAcceptEx(socket, acceptSocket, s->rbuf, 0,
         sizeof(struct sockaddr_in) + 16,
         sizeof(struct sockaddr_in) + 16,
@@ -217,8 +600,10 @@ inline static int aePostIocpRead(xSocket socket, OVERLAPPED* overlapped) {
 
     DWORD bytesReceived = 0;
     DWORD flags = 0;
+    int available = channel_rbuf_prepare(s, true);     // 完成模式没法暂停读, 超上限也分配
+    if (available <= 0) return -1;
     ctx->wsrbuf.buf = s->rpos;
-    ctx->wsrbuf.len = (ULONG)(s->rlen - (s->rpos - s->rbuf));
+    ctx->wsrbuf.len = (ULONG)available;
 
     if (WSARecv(socket, &ctx->wsrbuf, 1, &bytesReceived, &flags, overlapped, NULL) == SOCKET_ERROR) {
         int error = WSAGetLastError();
@@ -254,6 +639,457 @@ inline static int aePostIocpWrite(xSocket socket, OVERLAPPED* overlapped) {
 }
 #endif
 
+#ifdef CHANNEL_ZEROCOPY
+static inline bool channel_seg_zc(xChannel* s, const channel_seg_t& seg) {
+    return seg.kind == CHANNEL_SEG_MEM && s->zcmin > 0 && seg.len >= s->zcmin;
+}
+
+// 单独发一个块, 不和wbuf混在一起: wbuf会被改写, 不能让内核引用. 返回值同anetSend
+static int channel_zc_send(xChannel* s, channel_seg_t& seg, int budget) {
+    struct iovec iov;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = seg.buf + seg.off;
+    iov.iov_len = (size_t)(seg.len - seg.off < budget ? seg.len - seg.off : budget);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    for (;;) {
+        ssize_t n = sendmsg(s->fd, &msg, MSG_ZEROCOPY);
+        if (n > 0) {
+            seg.zc = 1;
+            seg.zclast = s->zcseq++;
+            return (int)n;
+        }
+        if (n == 0) return 0;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return ANET_EAGAIN;
+        if (errno == ENOBUFS) return anetSend(s->fd, (char*)iov.iov_base, (int)iov.iov_len);   // optmem不够, 这次拷贝
+        return ANET_ERR;
+    }
+}
+
+// 读错误队列里的完成通知, 释放内核不再引用的块
+static void channel_zc_reap(xChannel* s) {
+    char control[128];
+    for (;;) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(s->fd, &msg, MSG_ERRQUEUE) == -1) {
+            if (errno == EINTR) continue;
+            break;                  // EAGAIN: 读空了
+        }
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            if ((int32_t)(serr->ee_data + 1 - s->zcacked) > 0)
+                s->zcacked = serr->ee_data + 1;     // [ee_info, ee_data]完成, 通知按序到达
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                s->zcmin = 0;       // 内核还是拷贝了, 之后不再用
+        }
+    }
+    std::deque<channel_seg_t>& zc = s->segq->zc;
+    while (!zc.empty() && (int32_t)(zc.front().zclast - s->zcacked) < 0) {
+        channel_seg_done(zc.front());
+        zc.pop_front();
+    }
+}
+#endif
+
+int xchannel_set_zerocopy(xChannel* s, int min) {
+    if (min < 0) min = 0;
+#ifdef CHANNEL_ZEROCOPY
+    if (!s) {
+        _zcmin = min;
+        return AE_OK;
+    }
+    int on = 1;
+    if (min > 0 && (s->shm || s->kcp || setsockopt(s->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == -1))
+        return AE_ERR;
+    s->zcmin = min;
+    return AE_OK;
+#else
+    (void)s;
+    return min > 0 ? AE_ERR : AE_OK;
+#endif
+}
+
+// ============================================================================
+// 发送积压: 超过高水位阻塞(可选暂停读), loop写出后降到低水位再通知
+// ============================================================================
+static thread_local std::vector<std::pair<xChannel*, uint32_t>> _drain_waits;
+
+static void channel_wblock(xChannel* s) {
+    if (s->wblocked || channel_wpending(s) <= s->whigh) return;
+    s->wblocked = 1;
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (s->wpause && el && s->ev && (s->ev->mask & AE_READABLE)) {
+        aeHoldFileEvent(el, s->fd, s->ev, 1);
+        aeDeleteFileEvent(el, s->fd, s->ev, AE_READABLE);
+    }
+#endif
+}
+
+// 唤醒s上等xchannel_drain的协程
+static void channel_drain_resume(xChannel* s, int code) {
+    std::vector<uint32_t> waits;
+    for (size_t i = 0; i < _drain_waits.size();) {
+        if (_drain_waits[i].first == s) {
+            waits.push_back(_drain_waits[i].second);
+            _drain_waits[i] = _drain_waits.back();
+            _drain_waits.pop_back();
+        } else {
+            i++;
+        }
+    }
+    s->wwait = 0;
+    for (uint32_t id : waits) {
+        std::vector<VariantType> res;
+        res.emplace_back(code);
+        coroutine_resume(id, std::move(res));   // 超时已返回的找不到, 忽略
+    }
+}
+
+// loop里写出之后调用. 回调和协程里可能关闭s, 关闭时会清掉ev->clientData, 之后不能再访问s
+static void channel_wnotify(aeEventLoop* el, xChannel* s) {
+    (void)el;
+    aeFileEvent* ev = s->ev;
+    int pending = channel_wpending(s);
+    if (!ev || pending > s->wlow) return;
+    void* ctx = ev->clientData;
+    if (s->wblocked) {
+        s->wblocked = 0;
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+        if (s->wpause) channel_read_resume(el, s);
+#endif
+        if (s->fwritable) {
+            s->fwritable(s, NULL, 0);
+            if (ev->clientData != ctx) return;
+        }
+    }
+    if (s->wwait) {
+        channel_drain_resume(s, XNET_SUCCESS);
+        if (ev->clientData != ctx) return;
+    }
+    if (pending == 0 && s->fdrain && channel_wpending(s) == 0)
+        s->fdrain(s, NULL, 0);
+}
+
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+// 明文直接读写socket, TLS channel经mbedtls加解密, 共享内存channel拷进/出环, KCP channel经ARQ分段重传. 返回值同anetRecv/anetSend
+static inline int channel_recv(xChannel* s, char* buf, int len) {
+#ifdef HAVE_TLS
+    if (s->tls) return _xtls_recv(s, buf, len);
+#endif
+#ifdef XCHANNEL_SHM
+    if (s->shm) return _xshm_recv(s, buf, len);
+#endif
+#ifdef XCHANNEL_KCP
+    if (s->kcp) return _xkcp_recv(s, buf, len);
+#endif
+    return anetRecv(s->fd, buf, len);
+}
+
+static inline int channel_send(xChannel* s, char* buf, int len) {
+#ifdef HAVE_TLS
+    if (s->tls) return _xtls_send(s, buf, len);
+#endif
+#ifdef XCHANNEL_SHM
+    if (s->shm) return _xshm_sendv(s, &buf, &len, 1);
+#endif
+#ifdef XCHANNEL_KCP
+    if (s->kcp) return _xkcp_sendv(s, &buf, &len, 1);
+#endif
+    return anetSend(s->fd, buf, len);
+}
+
+static inline int channel_sendv(xChannel* s, char** bufs, int* lens, int count) {
+#ifdef HAVE_TLS
+    if (s->tls) return _xtls_send(s, bufs[0], lens[0]);    // 一次加密一段, 写出的按顺序消费
+#endif
+#ifdef XCHANNEL_SHM
+    if (s->shm) return _xshm_sendv(s, bufs, lens, count);
+#endif
+#ifdef XCHANNEL_KCP
+    if (s->kcp) return _xkcp_sendv(s, bufs, lens, count);
+#endif
+    return anetSendv(s->fd, bufs, lens, count);
+}
+
+// 文件块: 从foff+off起最多budget字节. 返回值同anetSend, 文件比登记的短算出错
+static int channel_file_send(xChannel* s, channel_seg_t& seg, int budget) {
+    long long left = seg.len - seg.off;
+    size_t count = (size_t)(left < budget ? left : budget);
+#if defined(HAVE_TLS) || defined(XCHANNEL_SHM) || defined(XCHANNEL_KCP)
+    if (s->tls || s->shm || s->kcp) {
+        // 要加密/拷进环/分段, 读出来一段一段地发; 没写出的下次重读, 内容不变
+        char tmp[16 * 1024];
+        if (count > sizeof(tmp)) count = sizeof(tmp);
+        ssize_t n = pread(seg.fd, tmp, count, (off_t)(seg.foff + seg.off));
+        if (n > 0) return channel_send(s, tmp, (int)n);
+        printf("Sendfile error on fd: %d\n", s->fd);
+        return ANET_ERR;
+    }
+#endif
+#if defined(__linux__)
+    off_t off = (off_t)(seg.foff + seg.off);
+    for (;;) {
+        ssize_t n = sendfile(s->fd, seg.fd, &off, count);
+        if (n > 0) return (int)n;
+        if (n == 0) break;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return ANET_EAGAIN;
+        break;
+    }
+#elif defined(__APPLE__)
+    for (;;) {
+        off_t n = (off_t)count;
+        int ret = sendfile(seg.fd, s->fd, (off_t)(seg.foff + seg.off), &n, NULL, 0);
+        if (n > 0) return (int)n;           // EAGAIN/EINTR时也可能写了一部分
+        if (ret == 0) break;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN) return ANET_EAGAIN;
+        break;
+    }
+#elif !defined(_WIN32)
+    char tmp[16 * 1024];
+    if (count > sizeof(tmp)) count = sizeof(tmp);
+    ssize_t n = pread(seg.fd, tmp, count, (off_t)(seg.foff + seg.off));
+    if (n > 0) return anetSend(s->fd, tmp, (int)n);    // 没写出的下次重读
+#endif
+    printf("Sendfile error on fd: %d\n", s->fd);
+    return ANET_ERR;
+}
+
+#ifdef CHANNEL_SPLICE
+// 管道块: 管道里已经有这些字节, 写不动只会是dst的socket满
+static int channel_pipe_send(xChannel* s, channel_seg_t& seg, int budget) {
+    long long left = seg.len - seg.off;
+    size_t count = (size_t)(left < budget ? left : budget);
+    for (;;) {
+        ssize_t n = splice(seg.fd, NULL, s->fd, NULL, count, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+        if (n > 0) return (int)n;
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return ANET_EAGAIN;
+        return ANET_ERR;
+    }
+}
+
+static void channel_splice_drained(xChannelRelay* r, int n);
+#endif
+
+// 不能和wbuf片段拼进一次writev的块
+static inline bool channel_seg_solo(xChannel* s, const channel_seg_t& seg) {
+    if (seg.kind == CHANNEL_SEG_FILE || seg.kind == CHANNEL_SEG_PIPE) return true;
+#ifdef CHANNEL_ZEROCOPY
+    if (channel_seg_zc(s, seg)) return true;
+#else
+    (void)s;
+#endif
+    return false;
+}
+
+static int channel_seg_send(xChannel* s, channel_seg_t& seg, int budget) {
+    if (seg.kind == CHANNEL_SEG_FILE) return channel_file_send(s, seg, budget);
+#ifdef CHANNEL_SPLICE
+    if (seg.kind == CHANNEL_SEG_PIPE) return channel_pipe_send(s, seg, budget);
+#endif
+#ifdef CHANNEL_ZEROCOPY
+    return channel_zc_send(s, seg, budget);
+#else
+    return ANET_ERR;
+#endif
+}
+
+// 有排队的块时: wbuf片段和块按顺序拼成iovec一次writev, 写出的字节再按同样顺序消费
+static int channel_writev_out(xChannel* s, int budget, int* again) {
+    xChannelSegq* sq = s->segq;
+    int sent = 0;
+    *again = 0;
+    while (sent < budget && channel_wpending(s) > 0) {
+        char* bufs[ANET_IOV_MAX];
+        int lens[ANET_IOV_MAX];
+        int n = 0, total = 0;
+        char* w = s->wbuf;
+        long long wat = s->wseq;
+        bool all = true;
+        channel_seg_t* solo = NULL;
+        for (channel_seg_t& seg : sq->q) {
+            if (n >= ANET_IOV_MAX - 1 || total >= budget - sent) {
+                all = false;
+                break;
+            }
+            int before = (int)(seg.mark - wat);
+            if (before > 0) {
+                bufs[n] = w;
+                lens[n++] = before;
+                w += before;
+                wat += before;
+                total += before;
+            }
+            if (channel_seg_solo(s, seg)) {
+                // 文件/管道/zerocopy的块单独发, 先把它前面的写完
+                all = false;
+                if (n == 0) solo = &seg;
+                break;
+            }
+            bufs[n] = seg.buf + seg.off;
+            lens[n++] = (int)(seg.len - seg.off);
+            total += (int)(seg.len - seg.off);
+        }
+        if (all && s->wbase && w < s->wpos && n < ANET_IOV_MAX) {
+            bufs[n] = w;
+            lens[n++] = (int)(s->wpos - w);
+        }
+
+        int nwritten = solo ? channel_seg_send(s, *solo, budget - sent) : channel_sendv(s, bufs, lens, n);
+        if (nwritten == ANET_EAGAIN) {
+            *again = 1;
+            break;
+        }
+        if (nwritten <= 0) {
+            printf("Write error on fd: %d\n", s->fd);
+            return -1;
+        }
+        sent += nwritten;
+
+        for (int left = nwritten; left > 0;) {
+            int before = sq->q.empty() ? (int)(s->wpos - s->wbuf) : (int)(sq->q.front().mark - s->wseq);
+            if (before > 0) {
+                int k = before < left ? before : left;
+                channel_wconsume(s, k);
+                left -= k;
+                continue;
+            }
+            channel_seg_t& seg = sq->q.front();
+            int k = (int)(seg.len - seg.off < left ? seg.len - seg.off : left);
+            seg.off += k;
+            sq->bytes -= k;
+            left -= k;
+#ifdef CHANNEL_SPLICE
+            if (seg.kind == CHANNEL_SEG_PIPE)
+                channel_splice_drained((xChannelRelay*)seg.ud, k);
+#endif
+            if (seg.off == seg.len) {
+                if (seg.zc)
+                    sq->zc.push_back(seg);      // 等完成通知再释放
+                else
+                    channel_seg_done(seg);
+                sq->q.pop_front();
+            }
+        }
+    }
+    if (s->wbase && s->wpos == s->wbuf) channel_buf_release(channel_wbuf(s));
+    return sent;
+}
+
+// 非阻塞写出wbuf, 直到写完/EAGAIN/超出budget; 返回写出字节数, 出错返回-1
+static int channel_write_out(xChannel* s, int budget, int* again) {
+    if (s->segq && !s->segq->q.empty()) return channel_writev_out(s, budget, again);
+    int slen = (int)(s->wpos - s->wbuf);
+    int sent = 0;
+    *again = 0;
+    while (sent < slen && sent < budget) {
+        int len = slen - sent;
+        if (len > budget - sent) len = budget - sent;
+        int nwritten = channel_send(s, s->wbuf + sent, len);
+        if (nwritten == ANET_EAGAIN) {
+            *again = 1;
+            break;
+        }
+        if (nwritten <= 0) {
+            if (nwritten == 0) {
+                printf("Connection closed during write, fd: %d\n", s->fd);
+            } else {
+                printf("Write error on fd: %d\n", s->fd);
+            }
+            return -1;
+        }
+        sent += nwritten;
+    }
+
+    if (sent > 0) {
+        channel_wconsume(s, sent);
+        if (sent == slen) channel_buf_release(channel_wbuf(s));
+    }
+    return sent;
+}
+
+// 发送合并: 每个线程一个loop, dirty列表跟着线程走
+static thread_local std::vector<xChannel*> _dirty;
+static thread_local bool _coalesce = false;
+
+static void channel_mark_dirty(xChannel* s) {
+    if (s->dirty) return;
+    _dirty.push_back(s);
+    s->dirty = (uint32_t)_dirty.size();
+}
+
+// poll前调用, 每个dirty channel只写一次
+static void channel_flush_dirty(aeEventLoop* el) {
+    // 关闭回调里可能再发送, 按下标遍历, 新加的本轮一起写
+    for (size_t i = 0; i < _dirty.size(); i++) {
+        xChannel* s = _dirty[i];
+        if (!s) continue;       // 已关闭
+        _dirty[i] = NULL;
+        s->dirty = 0;
+        if (s->ev && (s->ev->mask & AE_WRITABLE)) continue;     // 已在等可写
+        int again = 0;
+        if (channel_write_out(s, channel_wpending(s), &again) < 0) {
+            xchannel_close(s);
+            continue;
+        }
+        if (channel_wpending(s) > 0 && s->ev)
+            aeEnableFileEvent(el, s->fd, s->ev, AE_WRITABLE);
+        channel_wnotify(el, s);
+    }
+    _dirty.clear();
+}
+#endif
+
+void xchannel_coalesce(bool enable) {
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (!el) return;
+    if (!enable) channel_flush_dirty(el);
+    _coalesce = enable;
+    aeSetFlushProc(el, enable ? channel_flush_dirty : NULL);
+#else
+    (void)enable;   // 完成模式每个channel只有一个在途写, 其间的发送已经合并
+#endif
+}
+
+#ifdef CHANNEL_SPLICE
+static int channel_splice_read(aeEventLoop* el, xChannel* s);
+#endif
+
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+// 读出来但不会再有可读通知的字节: TLS已解密留在mbedtls里的, 共享内存环里还没读的(门铃已经读空), KCP已按序收到的
+static inline bool channel_rx_pending(xChannel* s) {
+#ifdef HAVE_TLS
+    if (s->tls && _xtls_pending(s) > 0) return true;
+#endif
+#ifdef XCHANNEL_SHM
+    if (s->shm && _xshm_pending(s) > 0) return true;
+#endif
+#ifdef XCHANNEL_KCP
+    if (s->kcp && _xkcp_pending(s) > 0) return true;
+#endif
+    (void)s;
+    return false;
+}
+
+#ifdef HAVE_TLS
+// 握手在等可写时关注可写; 握手完成后写出握手期间排队的数据
+static void channel_tls_rearm(aeEventLoop* el, xChannel* s) {
+    if (s->ev && (_xtls_want_write(s) || (xchannel_tls_ready(s) && channel_wpending(s) > 0)))
+        aeEnableFileEvent(el, s->fd, s->ev, AE_WRITABLE);
+}
+#endif
+#endif
+
 int aeProcRead(struct aeEventLoop* eventLoop, void* client_data, int mask, int trans) {
     (void)eventLoop; (void)mask;
     channel_context_t* ctx = (channel_context_t*)client_data;
@@ -262,17 +1098,71 @@ int aeProcRead(struct aeEventLoop* eventLoop, void* client_data, int mask, int t
     xChannel* s = ctx->channel;
     aeFileEvent* ev = s->ev;
     xSocket fd = s->fd;
-#ifndef HAVE_IOCP
-    int available = s->rlen - (s->rpos - s->rbuf);
-    if (available < 0) {
-        xchannel_close(s);
-        return AE_ERR;
-    } else if (available == 0) {
-        trans = 0;
-    } else {
-        trans = anetRead(fd, s->rpos, available);
-        if (trans <= 0) {
-            if (trans == 0) {
+#if defined(HAVE_IOCP)
+    if (trans > 0)
+        s->rpos += trans;
+#elif defined(HAVE_IOURING)
+    // multishot recv的数据在ring提供的缓冲区里, 回调返回后即被回收, 拷入rbuf;
+    // rbuf放不下时先让on_data消费
+    const char* data = aeUringRecvData(eventLoop);
+    (void)ev; (void)fd;
+    if (!data) trans = 0;
+    for (int left = trans; left > 0;) {
+        int available = channel_rbuf_prepare(s, true);
+        int n = left < available ? left : available;
+        if (n <= 0) {
+            xchannel_close(s);
+            return AE_ERR;
+        }
+        memcpy(s->rpos, data, n);
+        s->rpos += n;
+        data += n;
+        left -= n;
+        if (left > 0 && on_data(ctx) == AE_ERR) {
+            xchannel_close(ctx->channel);
+            return AE_ERR;
+        }
+    }
+#else
+#ifdef CHANNEL_SPLICE
+    if (s->rsplice) return channel_splice_read(eventLoop, s);
+#endif
+    // 上一轮到预算留下的包先处理; 还没处理完就不读新的, 继续排到下一轮.
+    // 已排队时这次是内核的通知, 交给排队的那次, 一轮只处理一份预算
+    if (s->rmore) {
+        if (ev->flags & AE_PENDING) return AE_OK;
+        if (on_data(ctx) == AE_ERR) {
+            xchannel_close(ctx->channel);
+            return AE_ERR;
+        }
+        if (s->rmore) {
+            aeMarkPending(eventLoop, fd, ev, AE_READABLE);
+            return AE_OK;
+        }
+#ifdef CHANNEL_SPLICE
+        if (s->rsplice) return channel_splice_read(eventLoop, s);
+#endif
+    }
+    // 边沿触发: 读到EAGAIN为止, 但单次唤醒不超过budget, 避免热连接饿死其他连接
+    int edge = aeIsEdgeTriggered(ev);
+    int budget = aeGetIoBudget(eventLoop);
+    int nread = 0;
+    trans = 0;
+    for (;;) {
+        int available = channel_rbuf_prepare(s, false);
+        if (available < 0 && trans == 0) {
+            channel_pause_read(eventLoop, s);   // 内存到上限, 等有内存再读
+            return AE_OK;
+        }
+        if (available <= 0) {
+            break;                          // 缓冲区到上限, 先交给on_data消费
+        }
+        if (edge && available > budget - trans)
+            available = budget - trans;
+        nread = channel_recv(s, s->rpos, available);
+        if (nread == ANET_EAGAIN) break;
+        if (nread <= 0) {
+            if (nread == 0) {
                 printf("Connection closed by peer, fd: %d\n", fd);
             } else {
                 printf("Read error on fd: %d\n", fd);
@@ -280,19 +1170,33 @@ int aeProcRead(struct aeEventLoop* eventLoop, void* client_data, int mask, int t
             xchannel_close(s);
             return AE_ERR;
         }
-        s->rpos += trans;
+        s->rpos += nread;
+        trans += nread;
+        if (!edge || trans >= budget) break;
     }
+#ifdef HAVE_TLS
+    if (s->tls) channel_tls_rearm(eventLoop, s);
 #endif
-    if (trans > 0)
-        s->rpos += trans;
+    if (trans == 0 && nread == ANET_EAGAIN)
+        return AE_OK;                       // 被其他线程/事件抢先读空
+#endif
+    if (s->rbuf && (int)(s->rpos - s->rbuf) > s->rpeak)
+        s->rpeak = (int)(s->rpos - s->rbuf);
     if (on_data(ctx) == AE_ERR || trans==0) {
         xchannel_close(ctx->channel);
         return AE_ERR;
     }
-#ifdef HAVE_IOCP
+    if (s->rbuf && s->rpos == s->rbuf)
+        channel_buf_release(channel_rbuf(s));
+#if defined(HAVE_IOCP)
     if (ev && ev->clientData == ctx) {
         aePostIocpRead(fd, &ctx->rop);
     }
+#elif !defined(HAVE_IOURING)
+    // 没读到EAGAIN, 内核不会再通知, 下一轮继续读; 到读预算的也下一轮接着处理.
+    // TLS已解密的字节留在mbedtls里, 环里的数据门铃只敲一次, 都不会再通知
+    if ((edge && nread != ANET_EAGAIN) || s->rmore || channel_rx_pending(s))
+        aeMarkPending(eventLoop, fd, ev, AE_READABLE);
 #endif
     return AE_OK;
 }
@@ -304,36 +1208,68 @@ int aeProcWrite(struct aeEventLoop* eventLoop, xSocket fd, void* client_data, in
 
     xChannel* s = ctx->channel;
     fd = s->fd;
-    int slen = (int)(s->wpos - s->wbuf);
+#if defined(HAVE_IOCP) || defined(HAVE_IOURING)
+    if (s->wstale) {
+        // 刚完成的send用的是扩容前的wbuf
+        channel_seg_put(s->wstale, s->wstalelen);
+        s->wstale = NULL;
+    }
+#endif
+#ifdef HAVE_TLS
+    if (s->tls && !xchannel_tls_ready(s)) {
+        // 握手中可写只用来推进握手, 转为等对端时不再关注
+        int hs = _xtls_handshake(s);
+        if (hs < 0) {
+            xchannel_close(s);
+            return AE_ERR;
+        }
+        if (hs == 0) {
+            if (!_xtls_want_write(s))
+                aeDeleteFileEvent(eventLoop, fd, s->ev, AE_WRITABLE);
+            return AE_OK;
+        }
+    }
+#endif
+    int slen = channel_wpending(s);
     if (slen <= 0) {
         s->wpos = s->wbuf;
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+        aeDeleteFileEvent(eventLoop, fd, s->ev, AE_WRITABLE);   // 注册时带上的或send里已写完
+#endif
+        channel_wnotify(eventLoop, s);
         return AE_OK;
     }
-#ifndef HAVE_IOCP
-    trans = anetWrite(fd, s->wbuf, slen);
+#if defined(HAVE_IOURING)
     if (trans <= 0) {
-        if (trans == 0) {
-            printf("Connection closed during write, fd: %d\n", fd);
-        } else {
-            printf("Write error on fd: %d\n", fd);
-        }
+        printf("Write error on fd: %d\n", fd);
         xchannel_close(s);
         return AE_ERR;
     }
-
-    if (slen == trans) {
-        s->wpos = s->wbuf;
+    channel_wconsume(s, trans < slen ? trans : slen);
+    if (s->wpos != s->wbuf) {
+        if (aeUringSend(eventLoop, fd, s->ev, s->wbuf, (int)(s->wpos - s->wbuf)) == AE_ERR) {
+            xchannel_close(s);
+            return AE_ERR;
+        }
     } else {
-        memmove(s->wbuf, s->wbuf + trans, slen - trans);
-        s->wpos = s->wbuf + slen - trans;
+        aeDeleteFileEvent(eventLoop, fd, s->ev, AE_WRITABLE);
+        channel_buf_release(channel_wbuf(s));
     }
-#else
-    if (slen == trans) {
-        s->wpos = s->wbuf;
-    } else {
-        memmove(s->wbuf, s->wbuf + trans, slen - trans);
-        s->wpos = s->wbuf + slen - trans;
+#elif !defined(HAVE_IOCP)
+    int again = 0;
+    int edge = aeIsEdgeTriggered(s->ev);
+    if (channel_write_out(s, edge ? aeGetIoBudget(eventLoop) : slen, &again) < 0) {
+        xchannel_close(s);
+        return AE_ERR;
     }
+    if (channel_wpending(s) == 0) {
+        aeDeleteFileEvent(eventLoop, fd, s->ev, AE_WRITABLE);   // 写完不再关注可写
+    } else if (edge && !again) {
+        // budget用完仍可写, 边沿不会再来
+        aeMarkPending(eventLoop, fd, s->ev, AE_WRITABLE);
+    }
+#else
+    channel_wconsume(s, trans < slen ? trans : slen);
     if (s->wpos != s->wbuf) {
         if (aePostIocpWrite(fd, &ctx->wop) == AE_ERR) {
             xchannel_close(s);
@@ -341,15 +1277,32 @@ int aeProcWrite(struct aeEventLoop* eventLoop, xSocket fd, void* client_data, in
         }
     } else {
         aeDeleteFileEvent(eventLoop, fd, s->ev, AE_WRITABLE);
+        channel_buf_release(channel_wbuf(s));
     }
 #endif
-
+    channel_wnotify(eventLoop, s);
     return AE_OK;
 }
 
 int aeProcEvent(struct aeEventLoop* eventLoop, xSocket fd, void* client_data, int mask, int trans) {
+    channel_context_t* ctx = (channel_context_t*)client_data;
+#ifdef CHANNEL_ZEROCOPY
+    // 完成通知以EPOLLERR送达, 在读写回调里都会收到
+    if (ctx && ctx->channel && ctx->channel->segq && !ctx->channel->segq->zc.empty())
+        channel_zc_reap(ctx->channel);
+#endif
     if (mask & AE_READABLE) {
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+        // 同时可写的也在这次写, 一直有数据可读的连接积压才写得出去; 读里关闭了会清掉clientData
+        aeFileEvent* ev = ctx && ctx->channel ? ctx->channel->ev : NULL;
+        int ret = aeProcRead(eventLoop, client_data, mask, trans);
+        if ((mask & AE_WRITABLE) && ev && ev->clientData == client_data && (ev->mask & AE_WRITABLE))
+            ret = aeProcWrite(eventLoop, fd, client_data, mask, trans);
+        return ret;
+#else
+        (void)ctx;
         return aeProcRead(eventLoop, client_data, mask, trans);
+#endif
     } else if (mask & AE_WRITABLE) {
         return aeProcWrite(eventLoop, fd, client_data, mask, trans);
     } else {
@@ -357,6 +1310,163 @@ int aeProcEvent(struct aeEventLoop* eventLoop, xSocket fd, void* client_data, in
     }
 }
 
+#ifdef XCHANNEL_SHM
+// 共享内存channel的fd是自己的门铃eventfd: 对端写入了数据或腾出了空间都会敲它, 一直可写.
+// 可写只用来把send推迟到这一轮写, 环满时去掉, 等对端消费后敲门铃再写
+static int aeProcShm(struct aeEventLoop* eventLoop, xSocket fd, void* client_data, int mask, int trans) {
+    channel_context_t* ctx = (channel_context_t*)client_data;
+    if (!ctx || !ctx->channel) return AE_ERR;
+    xChannel* s = ctx->channel;
+    aeFileEvent* ev = s->ev;
+    int ret = AE_OK;
+    if (mask & AE_READABLE) {
+        _xshm_ack(s);
+        ret = aeProcRead(eventLoop, client_data, mask, trans);
+        if (ev->clientData != client_data) return ret;     // 读里关闭了
+    }
+    if (channel_wpending(s) > 0 || (ev->mask & AE_WRITABLE)) {
+        ret = aeProcWrite(eventLoop, fd, client_data, mask, trans);
+        if (ev->clientData != client_data) return ret;
+    }
+    if ((ev->mask & AE_WRITABLE) && _xshm_wblocked(s))
+        aeDeleteFileEvent(eventLoop, fd, ev, AE_WRITABLE);
+    // 对端已退出: 一直读到环空, 读到0时关闭
+    if (_xshm_gone(s))
+        aeMarkPending(eventLoop, fd, ev, AE_READABLE);
+    return ret;
+}
+
+static xChannel* channel_shm_attach(aeEventLoop* el, struct xChannelShm* sh, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto) {
+    xSocket efd = _xshm_fd(sh);
+    channel_context_t* ctx = create_context(efd, fpack, fclose, userdata);
+    if (!ctx) {
+        _xshm_destroy(sh);
+        return NULL;
+    }
+    xChannel* s = ctx->channel;
+    s->pproto = proto;
+    aeFileEvent* fe = NULL;
+    if (_xshm_attach(el, s, sh) != AE_OK ||
+        aeCreateFileEvent(el, efd, AE_READABLE | AE_WRITABLE, aeProcShm, ctx, &fe) == AE_ERR) {
+        printf("Failed to create shm channel events, fd: %d\n", (int)efd);
+        free_channel_context(ctx);
+        return NULL;
+    }
+    s->ev = fe;
+    aeDeleteFileEvent(el, efd, fe, AE_WRITABLE);    // register & not start
+    return s;
+}
+
+// 监听端: accept的unix socket上等连接端发来memfd和门铃
+typedef struct {
+    xSocket         fd;
+    aeFileEvent*    ev;
+    xchannel_proc*  fpack;
+    xchannel_proc*  fclose;
+    void*           userdata;
+    xProto          proto;
+} channel_shm_hello_t;
+
+static int aeProcShmHello(struct aeEventLoop* eventLoop, xSocket fd, void* client_data, int mask, int trans) {
+    (void)mask; (void)trans;
+    channel_shm_hello_t* h = (channel_shm_hello_t*)client_data;
+    struct xChannelShm* sh = NULL;
+    int r = _xshm_accept(fd, &sh);
+    if (r == ANET_EAGAIN) return AE_OK;
+    aeDeleteFileEvent(eventLoop, fd, h->ev, AE_READABLE);
+    if (r != ANET_OK) {
+        anetCloseSocket(fd);
+        delete h;
+        return AE_ERR;
+    }
+    xChannel* s = channel_shm_attach(eventLoop, sh, h->fpack, h->fclose, h->userdata, h->proto);
+    if (s) printf("New shm channel accepted, fd: %d\n", (int)s->fd);
+    delete h;
+    return s ? AE_OK : AE_ERR;
+}
+
+static void channel_shm_hello(aeEventLoop* el, xSocket cfd, channel_context_t* cur) {
+    channel_shm_hello_t* h = new channel_shm_hello_t();
+    h->fd = cfd;
+    h->fpack = cur->fpack;
+    h->fclose = cur->fclose;
+    h->userdata = cur->userdata;
+    h->proto = cur->channel->pproto;
+    if (aeCreateFileEvent(el, cfd, AE_READABLE, aeProcShmHello, h, &h->ev) == AE_ERR) {
+        anetCloseSocket(cfd);
+        delete h;
+    }
+}
+#endif
+
+#ifdef XCHANNEL_KCP
+// KCP channel: 客户端fd是UDP socket, 可读时先把数据报交给ARQ; 服务端会话的fd是占位的, 由监听socket分发后aeMarkPending.
+// UDP一直可写, 可写只用来把send推迟到这一轮写, 发送队列满时去掉, 收到ack腾出空间后再打开
+static int aeProcKcp(struct aeEventLoop* eventLoop, xSocket fd, void* client_data, int mask, int trans) {
+    channel_context_t* ctx = (channel_context_t*)client_data;
+    if (!ctx || !ctx->channel) return AE_ERR;
+    xChannel* s = ctx->channel;
+    aeFileEvent* ev = s->ev;
+    int ret = AE_OK;
+    if (mask & AE_READABLE) {
+        int more = _xkcp_input(s);
+        ret = aeProcRead(eventLoop, client_data, mask, trans);
+        if (ev->clientData != client_data) return ret;     // 读里关闭了
+        if (more) aeMarkPending(eventLoop, fd, ev, AE_READABLE);
+    }
+    if (channel_wpending(s) > 0 || (ev->mask & AE_WRITABLE)) {
+        ret = aeProcWrite(eventLoop, fd, client_data, mask, trans);
+        if (ev->clientData != client_data) return ret;
+    }
+    if ((ev->mask & AE_WRITABLE) && _xkcp_wblocked(s))
+        aeDeleteFileEvent(eventLoop, fd, ev, AE_WRITABLE);
+    // 对端关闭/超时: 读完已收到的, 读到0时关闭
+    if (_xkcp_gone(s))
+        aeMarkPending(eventLoop, fd, ev, AE_READABLE);
+    return ret;
+}
+
+static xChannel* channel_kcp_attach(aeEventLoop* el, struct xChannelKcp* k, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto) {
+    xSocket fd = _xkcp_fd(k);
+    channel_context_t* ctx = create_context(fd, fpack, fclose, userdata);
+    if (!ctx) {
+        _xkcp_destroy(k);
+        return NULL;
+    }
+    xChannel* s = ctx->channel;
+    s->pproto = proto;
+    aeFileEvent* fe = NULL;
+    if (_xkcp_attach(el, s, k) != AE_OK ||
+        aeCreateFileEvent(el, fd, AE_READABLE | AE_WRITABLE, aeProcKcp, ctx, &fe) == AE_ERR) {
+        printf("Failed to create kcp channel events, fd: %d\n", (int)fd);
+        free_channel_context(ctx);
+        return NULL;
+    }
+    s->ev = fe;
+    aeDeleteFileEvent(el, fd, fe, AE_WRITABLE);     // register & not start
+    return s;
+}
+
+// 监听端: 收到新的(对端地址, conv)时建channel
+typedef struct {
+    xchannel_proc*  fpack;
+    xchannel_proc*  fclose;
+    void*           userdata;
+    xProto          proto;
+} channel_kcp_listen_t;
+
+static xChannel* channel_kcp_accept(aeEventLoop* el, struct xChannelKcp* k, void* ud) {
+    channel_kcp_listen_t* l = (channel_kcp_listen_t*)ud;
+    xChannel* s = channel_kcp_attach(el, k, l->fpack, l->fclose, l->userdata, l->proto);
+    if (s) printf("New kcp channel accepted, fd: %d\n", (int)s->fd);
+    return s;
+}
+#endif
+
+#if defined(HAVE_TLS) && !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+static int channel_tls_start(aeEventLoop* el, xChannel* s, struct xTlsConfig* conf, const char* servername);
+#endif
+
 int aeProcAccept(struct aeEventLoop* eventLoop, xSocket fd, void* client_data, int mask, int trans) {
     (void)mask; (void)trans;
     channel_context_t* cur = (channel_context_t*)client_data;
@@ -378,6 +1488,7 @@ int aeProcAccept(struct aeEventLoop* eventLoop, xSocket fd, void* client_data, i
 		aeFileEvent* fe = NULL;
         if (aeCreateFileEvent(eventLoop, new_fd, AE_READABLE|AE_WRITABLE, aeProcEvent, client_ctx, &fe) == AE_ERR) {
             printf("Failed to create read event for new connection\n");
+            client_ctx->channel->fd = -1;  // closed below
             free_channel_context(client_ctx);
             anetCloseSocket(new_fd);
             return AE_ERR;
@@ -393,45 +1504,133 @@ int aeProcAccept(struct aeEventLoop* eventLoop, xSocket fd, void* client_data, i
         printf("New connection accepted, fd: %d\n", (int)new_fd);
         return AE_OK;
     }
-#else
-    /*
-    struct sockaddr_in sa;
-    socklen_t salen = sizeof(sa);
-    xSocket cfd = anetTcpAccept(NULL, fd, (struct sockaddr*)&sa, &salen);
-    */
-    int cport;
-    char cip[128];
-    xSocket cfd = anetTcpAccept(NULL, fd, cip, &cport);
-    if (cfd == ANET_ERR) {
-        printf("Accept error on fd: %d\n", fd);
-        return AE_ERR;
-    }
+#elif defined(HAVE_IOURING)
+    // multishot accept, trans为新连接fd
+    xSocket cfd = (xSocket)trans;
+    if (cfd < 0) return AE_ERR;
     printf("New connection accepted, fd: %d\n", cfd);
 
     anetNonBlock(NULL, cfd);
-    anetTcpNoDelay(NULL, cfd);
+    if (!cur->local) anetTcpNoDelay(NULL, cfd);
 
     channel_context_t* client_ctx = create_context(cfd, cur->fpack, cur->fclose, cur->userdata);
     if (!client_ctx) {
         anetCloseSocket(cfd);
         return AE_ERR;
     }
+    client_ctx->channel->pproto = cur->channel->pproto;
 
     aeFileEvent* client_fe = NULL;
-    if (aeCreateFileEvent(eventLoop, cfd, AE_READABLE | AE_WRITABLE, aeProcEvent, client_ctx, &client_fe) == AE_ERR) {
+    if (aeCreateFileEvent(eventLoop, cfd, AE_READABLE | AE_WRITABLE | CHANNEL_EV_FLAGS, aeProcEvent, client_ctx, &client_fe) == AE_ERR) {
         printf("Failed to create read event for new connection, fd: %d\n", cfd);
+        client_ctx->channel->fd = -1;  // closed below
         free_channel_context(client_ctx);
         anetCloseSocket(cfd);
         return AE_ERR;
     }
 
     client_ctx->channel->ev = client_fe;
+    aeDeleteFileEvent(eventLoop, cfd, client_fe, AE_WRITABLE); // register & not start
+    aeUringRecv(eventLoop, cfd, client_fe);
+#else
+    /*
+    struct sockaddr_in sa;
+    socklen_t salen = sizeof(sa);
+    xSocket cfd = anetTcpAccept(NULL, fd, (struct sockaddr*)&sa, &salen);
+    */
+    // 边沿触发时accept到EAGAIN, 超过上限留到下一轮
+    aeFileEvent* listen_fe = cur->channel->ev;
+    int edge = aeIsEdgeTriggered(listen_fe);
+    for (int i = edge ? MAX_ACCEPTS_PER_CALL : 1; i > 0; i--) {
+        int cport;
+        char cip[128];
+        xSocket cfd = cur->local ? anetUnixAccept(NULL, fd) : anetTcpAccept(NULL, fd, cip, &cport);
+        if (cfd == ANET_ERR) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return AE_OK;
+            printf("Accept error on fd: %d\n", fd);
+            return AE_ERR;
+        }
+        printf("New connection accepted, fd: %d\n", cfd);
+
+        anetNonBlock(NULL, cfd);
+        if (!cur->local) anetTcpNoDelay(NULL, cfd);
+#ifdef XCHANNEL_SHM
+        if (cur->shm) {
+            channel_shm_hello(eventLoop, cfd, cur);
+            continue;
+        }
+#endif
+
+        channel_context_t* client_ctx = create_context(cfd, cur->fpack, cur->fclose, cur->userdata);
+        if (!client_ctx) {
+            anetCloseSocket(cfd);
+            continue;
+        }
+        client_ctx->channel->pproto = cur->channel->pproto;
+
+        aeFileEvent* client_fe = NULL;
+        if (aeCreateFileEvent(eventLoop, cfd, AE_READABLE | AE_WRITABLE, aeProcEvent, client_ctx, &client_fe) == AE_ERR) {
+            printf("Failed to create read event for new connection, fd: %d\n", cfd);
+            client_ctx->channel->fd = -1;  // closed below
+            free_channel_context(client_ctx);
+            anetCloseSocket(cfd);
+            continue;
+        }
+
+        client_ctx->channel->ev = client_fe;
+        aeDeleteFileEvent(eventLoop, cfd, client_fe, AE_WRITABLE); // register & not start
+#ifdef HAVE_TLS
+        if (cur->tls && channel_tls_start(eventLoop, client_ctx->channel, cur->tls, NULL) != AE_OK)
+            xchannel_close(client_ctx->channel);
+#endif
+    }
+    if (edge)
+        aeMarkPending(eventLoop, fd, listen_fe, AE_READABLE);
 #endif
 
     return AE_OK;
 }
 
-int xchannel_listen(int port, char* bindaddr, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto) {
+// 在el上注册监听fd的accept事件, 失败时关闭fd; tls非NULL时accept的连接走TLS, shm非0时是共享内存的握手
+static int channel_listen_fd(aeEventLoop* el, xSocket fd, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto,
+    struct xTlsConfig* tls = NULL, int shm = 0) {
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+    anetNonBlock(NULL, fd);     // 边沿触发需要accept到EAGAIN
+#endif
+
+    channel_context_t* listen_ctx = create_context(fd, fpack, fclose, userdata);
+    if (!listen_ctx) {
+        anetCloseSocket(fd);
+        return AE_ERR;
+    }
+    listen_ctx->channel->pproto = proto;
+    listen_ctx->tls = tls;
+    listen_ctx->shm = (uint8_t)shm;
+#if !defined(_WIN32)
+    struct sockaddr_storage ss;
+    socklen_t sslen = sizeof(ss);
+    listen_ctx->local = getsockname(fd, (struct sockaddr*)&ss, &sslen) == 0 && ss.ss_family == AF_LOCAL;
+#endif
+
+    aeFileEvent* fe = NULL;
+    if (aeCreateFileEvent(el, fd, AE_READABLE | CHANNEL_EV_FLAGS, aeProcAccept, listen_ctx, &fe) == AE_ERR) {
+        printf("Failed to create accept event, fd: %d\n", (int)fd);
+        free_channel_context(listen_ctx);
+        anetCloseSocket(fd);
+        return AE_ERR;
+    }
+    listen_ctx->channel->ev = fe;
+
+#if defined(HAVE_IOCP)
+    aePostIocpAccept(fd, &listen_ctx->rop);
+#elif defined(HAVE_IOURING)
+    aeUringAccept(el, fd, fe);
+#endif
+    return AE_OK;
+}
+
+static int channel_listen(int port, char* bindaddr, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto,
+    struct xTlsConfig* tls) {
     aeEventLoop* el = aeGetCurEventLoop();
     if (!el) {
         printf("No event loop available\n");
@@ -450,29 +1649,210 @@ int xchannel_listen(int port, char* bindaddr, xchannel_proc* fpack, xchannel_pro
         return AE_ERR;
     }
     printf("Listening on %s:%d, fd: %d\n", bindaddr ? bindaddr : "0.0.0.0", port, (int)fd);
+    return channel_listen_fd(el, fd, fpack, fclose, userdata, proto, tls);
+}
 
-    channel_context_t* listen_ctx = create_context(fd, fpack, fclose, userdata);
-    if (!listen_ctx) {
-        anetCloseSocket(fd);
+int xchannel_listen(int port, char* bindaddr, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto) {
+    return channel_listen(port, bindaddr, fpack, fclose, userdata, proto, NULL);
+}
+
+int xchannel_listen_unix(const char* path, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto, int perm) {
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (!el) {
+        printf("No event loop available\n");
         return AE_ERR;
     }
-    listen_ctx->channel->pproto = proto;
+    if (!fclose || !path) {
+        printf("fclose Invalid callback\n");
+        return AE_ERR;
+    }
+    fpack = fpack ? fpack : xhandle_on_pack;
 
-    aeFileEvent* fe = NULL;
-    if (aeCreateFileEvent(el, fd, AE_READABLE, aeProcAccept, listen_ctx, &fe) == AE_ERR) {
-        printf("Failed to create accept event, fd: %d\n", (int)fd);
-        free_channel_context(listen_ctx);
-        anetCloseSocket(fd);
+    char err[ANET_ERR_LEN];
+    xSocket fd = anetUnixServer(err, (char*)path, perm);
+    if (fd == (xSocket)ANET_ERR) {
+        printf("Create unix server error: %s\n", err);
         return AE_ERR;
     }
-    listen_ctx->channel->ev = fe;
+    printf("Listening on unix:%s, fd: %d\n", path, (int)fd);
+    return channel_listen_fd(el, fd, fpack, fclose, userdata, proto);
+}
 
-#ifdef HAVE_IOCP
-    aePostIocpAccept(fd, &listen_ctx->rop);
+// ============================================================================
+// 多reactor: 每个网络线程一个aeEventLoop + SO_REUSEPORT监听
+// ============================================================================
+typedef struct {
+    int             base_id;
+    int             nloops;
+    xSocket         fds[XTHR_GROUP_MAX];    // 每个loop一个监听fd, 无SO_REUSEPORT时共用一个
+    xchannel_proc*  fpack;
+    xchannel_proc*  fclose;
+    void*           userdata;
+    xProto          proto;
+} listen_mt_t;
+
+#define LISTEN_MT_MAX 8
+static listen_mt_t  _listen_mt[LISTEN_MT_MAX];
+static int          _listen_mt_count = 0;
+
+// 线程启动时group还没挂上, 按线程id找配置
+static listen_mt_t* listen_mt_find(int thread_id, int* index) {
+    for (int i = 0; i < _listen_mt_count; i++) {
+        listen_mt_t* cfg = &_listen_mt[i];
+        if (thread_id >= cfg->base_id && thread_id < cfg->base_id + cfg->nloops) {
+            *index = thread_id - cfg->base_id;
+            return cfg;
+        }
+    }
+    return NULL;
+}
+
+static void reactor_on_init(xThread* ctx) {
+    int index = 0;
+    listen_mt_t* cfg = listen_mt_find(ctx->id, &index);
+    aeEventLoop* el = aeCreateEventLoop(AE_SETSIZE);
+    if (!cfg || !el) {
+        xlog_err("Reactor[%d] init failed", ctx->id);
+        return;
+    }
+    ctx->userdata = el;
+
+    aeCreateSignalFile(el);
+    xtimer_init(100);
+    coroutine_init();
+    xthread_set_notify(aeGetWakeHandle(el));
+
+    if (channel_listen_fd(el, cfg->fds[index], cfg->fpack, cfg->fclose, cfg->userdata, cfg->proto) == AE_ERR)
+        xlog_err("Reactor[%d] listen failed, fd: %d", ctx->id, (int)cfg->fds[index]);
+}
+
+static void reactor_on_update(xThread* ctx) {
+    aeEventLoop* el = (aeEventLoop*)ctx->userdata;
+    if (el) aeProcessEvents(el, AE_ALL_EVENTS);
+}
+
+static void reactor_on_cleanup(xThread* ctx) {
+    aeEventLoop* el = (aeEventLoop*)ctx->userdata;
+    if (el) {
+        aeDeleteEventLoop(el);
+        ctx->userdata = nullptr;
+    }
+    channel_pool_trim();
+    coroutine_uninit();
+    xtimer_uninit();
+}
+
+// 线程组没起全: 没起来的reactor的监听fd关掉, 一个都没起来时配置位也还回去
+static void listen_mt_rollback(listen_mt_t* cfg) {
+    int started = 0;
+    for (int i = 0; i < cfg->nloops; i++) {
+        int index = 0;
+        xThread* t = xthread_get(cfg->base_id + i);
+        if (t && t->on_init == reactor_on_init && listen_mt_find(cfg->base_id + i, &index) == cfg) {
+            started++;
+            continue;
+        }
+#if defined(SO_REUSEPORT)
+        anetCloseSocket(cfg->fds[i]);
+#endif
+    }
+#if !defined(SO_REUSEPORT)
+    if (!started) anetCloseSocket(cfg->fds[0]);     // 共用一个fd
+#endif
+    if (!started) _listen_mt_count--;
+}
+
+static int cpu_count() {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+int xchannel_listen_mt(int port, char* bindaddr, int nloops, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto, int base_id) {
+    if (!fclose) {
+        printf("fclose Invalid callback\n");
+        return AE_ERR;
+    }
+    if (_listen_mt_count >= LISTEN_MT_MAX) {
+        printf("Too many multi-reactor listeners\n");
+        return AE_ERR;
+    }
+    if (nloops <= 0) nloops = cpu_count();
+    if (nloops > XTHR_GROUP_MAX) nloops = XTHR_GROUP_MAX;
+    if (base_id <= 0) base_id = XTHR_NET_GRP;
+
+    listen_mt_t* cfg = &_listen_mt[_listen_mt_count];
+    cfg->base_id = base_id;
+    cfg->nloops = nloops;
+    cfg->fpack = fpack ? fpack : xhandle_on_pack;
+    cfg->fclose = fclose;
+    cfg->userdata = userdata;
+    cfg->proto = proto;
+
+    // 监听fd在这里建好, 端口被占用等错误同步返回
+    char err[ANET_ERR_LEN];
+    for (int i = 0; i < nloops; i++) {
+#if defined(SO_REUSEPORT)
+        xSocket fd = anetTcpReusePortServer(err, port, bindaddr);
+#elif !defined(HAVE_IOCP)
+        // 无SO_REUSEPORT: 所有loop注册同一个非阻塞监听fd, 抢不到的accept返回EAGAIN
+        xSocket fd = i == 0 ? anetTcpServer(err, port, bindaddr) : cfg->fds[0];
+#else
+        xSocket fd = (xSocket)ANET_ERR;
+        snprintf(err, sizeof(err), "multi-reactor listen not supported with iocp");
+#endif
+        if (fd == (xSocket)ANET_ERR) {
+            printf("Create TCP server error: %s\n", err);
+#if defined(SO_REUSEPORT)
+            while (i-- > 0) anetCloseSocket(cfg->fds[i]);
 #endif
+            return AE_ERR;
+        }
+        cfg->fds[i] = fd;
+    }
+    _listen_mt_count++;     // reactor_on_init要按线程id找到配置, 先占位
+    printf("Listening on %s:%d with %d reactors\n", bindaddr ? bindaddr : "0.0.0.0", port, nloops);
+
+    xthread_init();
+    if (!xthread_register_group(base_id, nloops, XTHSTRATEGY_ROUND_ROBIN, true, "reactor",
+            reactor_on_init, reactor_on_update, reactor_on_cleanup)) {
+        printf("Failed to start reactor threads\n");
+        listen_mt_rollback(cfg);
+        return AE_ERR;
+    }
     return AE_OK;
 }
 
+// 已连上的fd建channel并注册事件, 失败时fd由调用方关闭
+static xChannel* channel_attach(aeEventLoop* el, xSocket fd, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto) {
+    channel_context_t* client_ctx = create_context(fd, fpack, fclose, userdata);
+    if (!client_ctx) return NULL;
+    client_ctx->channel->pproto = proto;
+
+    aeFileEvent* client_fe = NULL;
+    if (aeCreateFileEvent(el, fd, AE_READABLE | AE_WRITABLE | CHANNEL_EV_FLAGS, aeProcEvent, client_ctx, &client_fe) == AE_ERR) {
+        printf("Failed to create read event for connection, fd: %d\n", (int)fd);
+        client_ctx->channel->fd = -1;   // the caller still owns fd on failure
+        free_channel_context(client_ctx);
+        return NULL;
+    }
+
+    client_ctx->channel->ev = client_fe;
+    aeDeleteFileEvent(el, fd, client_fe, AE_WRITABLE);  // register & not start
+
+#if defined(HAVE_IOCP)
+    aePostIocpRead(fd, &client_ctx->rop);
+#elif defined(HAVE_IOURING)
+    aeUringRecv(el, fd, client_fe);
+#endif
+    return client_ctx->channel;
+}
+
 xChannel* xchannel_conn(char* addr, int port, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto) {
     aeEventLoop* el = aeGetCurEventLoop();
     if (!el) {
@@ -500,53 +1880,411 @@ xChannel* xchannel_conn(char* addr, int port, xchannel_proc* fpack, xchannel_pro
     anetNonBlock(NULL, fd);
     printf("Connected to %s:%d, fd: %d\n", addr, port, (int)fd);
 
-    channel_context_t* client_ctx = create_context(fd, fpack, fclose, userdata);
-    if (!client_ctx) {
+    xChannel* s = channel_attach(el, fd, fpack, fclose, userdata, proto);
+    if (!s) anetCloseSocket(fd);
+    return s;
+}
+
+xChannel* xchannel_conn_unix(const char* path, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto) {
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (!el) {
+        printf("No event loop available\n");
+        return NULL;
+    }
+    if (!fclose || !path) {
+        printf("fclose Invalid callback\n");
+        return NULL;
+    }
+    fpack = fpack ? fpack : xhandle_on_pack;
+
+    char err[ANET_ERR_LEN];
+    xSocket fd = anetUnixConnect(err, (char*)path);
+    if (fd == (xSocket)ANET_ERR) {
+        printf("Connect to unix:%s error: %s\n", path, err);
+        return NULL;
+    }
+    anetNonBlock(NULL, fd);
+    printf("Connected to unix:%s, fd: %d\n", path, (int)fd);
+
+    xChannel* s = channel_attach(el, fd, fpack, fclose, userdata, proto);
+    if (!s) anetCloseSocket(fd);
+    return s;
+}
+
+int xchannel_listen_shm(const char* path, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto, int perm) {
+#ifdef XCHANNEL_SHM
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (!el) {
+        printf("No event loop available\n");
+        return AE_ERR;
+    }
+    if (!fclose || !path) {
+        printf("fclose Invalid callback\n");
+        return AE_ERR;
+    }
+    fpack = fpack ? fpack : xhandle_on_pack;
+
+    char err[ANET_ERR_LEN];
+    xSocket fd = anetUnixServer(err, (char*)path, perm);
+    if (fd == (xSocket)ANET_ERR) {
+        printf("Create shm server error: %s\n", err);
+        return AE_ERR;
+    }
+    printf("Listening on shm:%s, fd: %d\n", path, (int)fd);
+    return channel_listen_fd(el, fd, fpack, fclose, userdata, proto, NULL, 1);
+#else
+    (void)path; (void)fpack; (void)fclose; (void)userdata; (void)proto; (void)perm;
+    printf("shm channel not supported\n");
+    return AE_ERR;
+#endif
+}
+
+xChannel* xchannel_conn_shm(const char* path, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto, int ring_size) {
+#ifdef XCHANNEL_SHM
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (!el) {
+        printf("No event loop available\n");
+        return NULL;
+    }
+    if (!fclose || !path) {
+        printf("fclose Invalid callback\n");
+        return NULL;
+    }
+    fpack = fpack ? fpack : xhandle_on_pack;
+
+    char err[ANET_ERR_LEN];
+    xSocket fd = anetUnixConnect(err, (char*)path);
+    if (fd == (xSocket)ANET_ERR) {
+        printf("Connect to shm:%s error: %s\n", path, err);
+        return NULL;
+    }
+    struct xChannelShm* sh = _xshm_connect(fd, ring_size);
+    if (!sh) {
         anetCloseSocket(fd);
         return NULL;
     }
-    client_ctx->channel->pproto = proto;
+    anetNonBlock(NULL, fd);
+    xChannel* s = channel_shm_attach(el, sh, fpack, fclose, userdata, proto);
+    if (s) printf("Connected to shm:%s, fd: %d\n", path, (int)s->fd);
+    return s;
+#else
+    (void)path; (void)fpack; (void)fclose; (void)userdata; (void)proto; (void)ring_size;
+    printf("shm channel not supported\n");
+    return NULL;
+#endif
+}
 
-    aeFileEvent* client_fe = NULL;
-    if (aeCreateFileEvent(el, fd, AE_READABLE | AE_WRITABLE, aeProcEvent, client_ctx, &client_fe) == AE_ERR) {
-        printf("Failed to create read event for connection, fd: %d\n", (int)fd);
-        free_channel_context(client_ctx);
+int xchannel_listen_kcp(int port, char* bindaddr, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto) {
+#ifdef XCHANNEL_KCP
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (!el) {
+        printf("No event loop available\n");
+        return AE_ERR;
+    }
+    if (!fclose) {
+        printf("fclose Invalid callback\n");
+        return AE_ERR;
+    }
+    fpack = fpack ? fpack : xhandle_on_pack;
+
+    char err[ANET_ERR_LEN];
+    xSocket fd = anetUdpServer(err, port, bindaddr);
+    if (fd == (xSocket)ANET_ERR) {
+        printf("Create kcp server error: %s\n", err);
+        return AE_ERR;
+    }
+    channel_kcp_listen_t* l = new channel_kcp_listen_t();
+    l->fpack = fpack;
+    l->fclose = fclose;
+    l->userdata = userdata;
+    l->proto = proto;
+    if (_xkcp_listen(el, fd, channel_kcp_accept, l) != AE_OK) {
+        printf("Failed to create kcp listen event, fd: %d\n", (int)fd);
         anetCloseSocket(fd);
+        delete l;
+        return AE_ERR;
+    }
+    printf("Listening on kcp port %d, fd: %d\n", port, (int)fd);
+    return AE_OK;
+#else
+    (void)port; (void)bindaddr; (void)fpack; (void)fclose; (void)userdata; (void)proto;
+    printf("kcp channel not supported\n");
+    return AE_ERR;
+#endif
+}
+
+xChannel* xchannel_conn_kcp(char* addr, int port, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto) {
+#ifdef XCHANNEL_KCP
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (!el) {
+        printf("No event loop available\n");
         return NULL;
     }
+    if (!fclose || !addr) {
+        printf("fclose Invalid callback\n");
+        return NULL;
+    }
+    fpack = fpack ? fpack : xhandle_on_pack;
 
-    client_ctx->channel->ev = client_fe;
-    aeDeleteFileEvent(el, fd, client_fe, AE_WRITABLE);  // register & not start
+    char err[ANET_ERR_LEN];
+    xSocket fd = anetUdpConnect(err, addr, port);
+    if (fd == (xSocket)ANET_ERR) {
+        printf("Connect to kcp %s:%d error: %s\n", addr, port, err);
+        return NULL;
+    }
+    struct xChannelKcp* k = _xkcp_connect(fd);
+    xChannel* s = channel_kcp_attach(el, k, fpack, fclose, userdata, proto);
+    if (s) printf("Connected to kcp %s:%d, fd: %d\n", addr, port, (int)s->fd);
+    return s;
+#else
+    (void)addr; (void)port; (void)fpack; (void)fclose; (void)userdata; (void)proto;
+    printf("kcp channel not supported\n");
+    return NULL;
+#endif
+}
 
-#ifdef HAVE_IOCP
-    aePostIocpRead(fd, &client_ctx->rop);
+#ifdef HAVE_TLS
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+// 挂上TLS会话并推进第一步: 客户端发出ClientHello, 服务端读已经到了的
+static int channel_tls_start(aeEventLoop* el, xChannel* s, struct xTlsConfig* conf, const char* servername) {
+    if (_xtls_attach(s, conf, servername) != AE_OK) return AE_ERR;
+    if (_xtls_handshake(s) < 0) return AE_ERR;
+    channel_tls_rearm(el, s);
+    return AE_OK;
+}
+#endif
+
+int xchannel_listen_tls(int port, char* bindaddr, xTlsConfig* conf, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto) {
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+    if (!conf) return AE_ERR;
+    return channel_listen(port, bindaddr, fpack, fclose, userdata, proto, conf);
+#else
+    (void)port; (void)bindaddr; (void)conf; (void)fpack; (void)fclose; (void)userdata; (void)proto;
+    printf("TLS channel not supported with completion backend\n");
+    return AE_ERR;
 #endif
-    return client_ctx->channel;
 }
 
-static inline int xchannel_post(xChannel* s, int len) {
-#ifndef HAVE_IOCP
-    int slen = s->wpos - s->wbuf;
-    int trans = anetWrite(s->fd, s->wbuf, slen);
-    if (trans <= 0) {
-        if (trans == 0) {
-            printf("Connection closed during write, fd: %d\n", s->fd);
+xChannel* xchannel_conn_tls(char* addr, int port, xTlsConfig* conf, xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto) {
+    if (!conf) return NULL;
+    xChannel* s = xchannel_conn(addr, port, fpack, fclose, userdata, proto);
+    if (s && xchannel_starttls(s, conf, addr) != AE_OK) {
+        xchannel_close(s);
+        return NULL;
+    }
+    return s;
+}
+
+int xchannel_starttls(xChannel* s, xTlsConfig* conf, const char* servername) {
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (!el || !s || !conf || !s->ev || s->tls || s->closing || s->rsplice || s->wsplice) return AE_ERR;
+    if (channel_wpending(s) > 0 || (s->rbase && s->rpos != s->rbuf)) return AE_ERR;   // 还有明文没处理完
+    return channel_tls_start(el, s, conf, servername);
+#else
+    (void)s; (void)conf; (void)servername;
+    printf("TLS channel not supported with completion backend\n");
+    return AE_ERR;
+#endif
+}
+#endif
+
+//*********************************
+// 非阻塞连接: 解析出的地址并行connect, 可写时取SO_ERROR, 先连上的胜出, 其余关掉
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+#define CHANNEL_CONNECT_MAX 4   // 并行尝试的地址数
+
+struct channel_connect_t {
+    uint32_t wait_id;
+    int n;                                  // 在途的connect数
+    xSocket fds[CHANNEL_CONNECT_MAX];
+    aeFileEvent* fes[CHANNEL_CONNECT_MAX];  // NULL: 该地址已结束
+    xtimerHandler timer;
+    xchannel_proc* fpack;
+    xchannel_proc* fclose;
+    void* userdata;
+    xProto proto;
+};
+
+static void channel_connect_drop(aeEventLoop* el, channel_connect_t* st, int i) {
+    aeDeleteFileEvent(el, st->fds[i], st->fes[i], AE_WRITABLE);
+    st->fes[i] = NULL;
+    st->n--;
+}
+
+// 结束本次连接: 关掉其余在途的fd, 再唤醒协程; 协程已不在(被杀)时连上的channel直接关掉
+static void channel_connect_finish(aeEventLoop* el, channel_connect_t* st, xChannel* s, int code) {
+    for (int i = 0; i < CHANNEL_CONNECT_MAX; i++) {
+        if (!st->fes[i]) continue;
+        xSocket fd = st->fds[i];
+        channel_connect_drop(el, st, i);
+        anetCloseSocket(fd);
+    }
+    if (st->timer) xtimer_del(st->timer);
+    uint32_t wait_id = st->wait_id;
+    delete st;
+
+    std::vector<VariantType> res;
+    res.push_back(code);
+    res.push_back((unsigned long long)(uintptr_t)s);
+    if (!coroutine_resume(wait_id, std::move(res)) && s)
+        xchannel_close(s);
+}
+
+static void channel_connect_timeout(void* ud) {
+    channel_connect_t* st = (channel_connect_t*)ud;
+    st->timer = 0;      // 触发中的timer不再删除
+    channel_connect_finish(aeGetCurEventLoop(), st, NULL, XNET_TIMEOUT);
+}
+
+static int aeProcConnect(aeEventLoop* el, xSocket fd, void* client_data, int mask, int trans) {
+    (void)mask; (void)trans;
+    channel_connect_t* st = (channel_connect_t*)client_data;
+    int i = 0;
+    while (i < CHANNEL_CONNECT_MAX && !(st->fes[i] && st->fds[i] == fd)) i++;
+    if (i == CHANNEL_CONNECT_MAX) return AE_OK;
+
+    int serr = anetSockError(fd);
+    channel_connect_drop(el, st, i);
+    char err[ANET_ERR_LEN];
+    if (serr != 0 || anetTcpNoDelay(err, fd) != ANET_OK) {
+        anetCloseSocket(fd);
+        if (st->n == 0) channel_connect_finish(el, st, NULL, XNET_CONNECT_FAILED);
+        return AE_OK;
+    }
+
+    xChannel* s = channel_attach(el, fd, st->fpack, st->fclose, st->userdata, st->proto);
+    if (!s) anetCloseSocket(fd);
+    channel_connect_finish(el, st, s, s ? XNET_SUCCESS : XNET_CONNECT_FAILED);
+    return AE_OK;
+}
+
+// 对ips并行发起connect, 返回等结果的awaiter; 一个都发不出去时直接就绪
+static xAwaiter channel_connect_start(std::vector<std::string>& ips, int port, int timeout_ms,
+    xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto) {
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (!el) return xAwaiter(XNET_CONNECT_FAILED);
+    xAwaiter awaiter;
+    if (awaiter.wait_id() == 0) return xAwaiter(XNET_NOT_IN_COROUTINE);
+
+    channel_connect_t* st = new channel_connect_t();
+    st->wait_id = awaiter.wait_id();
+    st->fpack = fpack;
+    st->fclose = fclose;
+    st->userdata = userdata;
+    st->proto = proto;
+
+    char err[ANET_ERR_LEN];
+    for (size_t k = 0; k < ips.size() && st->n < CHANNEL_CONNECT_MAX; k++) {
+        xSocket fd = anetTcpNonBlockConnect(err, (char*)ips[k].c_str(), port);
+        if (fd == (xSocket)ANET_ERR) {
+            printf("Connect to %s:%d error: %s\n", ips[k].c_str(), port, err);
+            continue;
         }
-        else {
-            printf("Write error on fd: %d\n", s->fd);
+        aeFileEvent* fe = NULL;
+        if (aeCreateFileEvent(el, fd, AE_WRITABLE, aeProcConnect, st, &fe) == AE_ERR) {
+            anetCloseSocket(fd);
+            continue;
         }
-        xchannel_close(s);
-        return AE_ERR;
+        st->fds[st->n] = fd;
+        st->fes[st->n] = fe;
+        st->n++;
+    }
+    if (st->n == 0) {
+        delete st;
+        return xAwaiter(XNET_CONNECT_FAILED);
     }
+    if (timeout_ms > 0)
+        st->timer = xtimer_add(timeout_ms, "chan:connect", channel_connect_timeout, st, 1);
+    return awaiter;
+}
+#endif
 
-    if (slen == trans) {
-        s->wpos = s->wbuf;
+xCoroTaskT<xChannel*> xchannel_connect_async(const char* addr, int port, int timeout_ms,
+    xchannel_proc* fpack, xchannel_proc* fclose, void* userdata, xProto proto) {
+    if (!fclose) {
+        printf("fclose Invalid callback\n");
+        co_return (xChannel*)NULL;
+    }
+    fpack = fpack? fpack : xhandle_on_pack;
+    std::string host(addr ? addr : "");     // 挂起后addr可能已失效
+
+#if defined(HAVE_IOCP) || defined(HAVE_IOURING)
+    // 完成端口类后端暂无异步connect, 退回阻塞连接
+    (void)timeout_ms;
+    co_return xchannel_conn((char*)host.c_str(), port, fpack, fclose, userdata, proto);
+#else
+    char err[ANET_ERR_LEN];
+    char ipbuf[CHANNEL_CONNECT_MAX][ANET_IP_LEN];
+    std::vector<std::string> ips;
+    int n = ANET_ERR;
+
+    // 数字地址不走DNS; 域名有IO线程时放过去解析, 否则在当前线程getaddrinfo
+    xThread* io = xthread_get(XTHR_IO);
+    if ((n = anetResolveAll(err, (char*)host.c_str(), ipbuf, CHANNEL_CONNECT_MAX, ANET_IP_ONLY)) > 0) {
+        ips.push_back(ipbuf[0]);
+    } else if (io && io->running && xthread_current() && xthread_current() != io) {
+        auto res = co_await xthread_pcall(XTHR_IO, [](xThread*, std::vector<VariantType>& args) {
+            char e[ANET_ERR_LEN];
+            char b[CHANNEL_CONNECT_MAX][ANET_IP_LEN];
+            std::vector<std::string> out;
+            int cnt = anetResolveAll(e, (char*)std::get<std::string>(args[0]).c_str(), b, CHANNEL_CONNECT_MAX, ANET_NONE);
+            for (int i = 0; i < cnt; i++) out.push_back(b[i]);
+            std::vector<VariantType> r;
+            r.push_back(std::move(out));
+            return r;
+        }, host);
+        if (xthread_ok(res) && res.size() > 1)
+            ips = std::get<std::vector<std::string>>(res[1]);
+        if (ips.empty()) printf("Connect to %s:%d error: can't resolve\n", host.c_str(), port);
+    } else if ((n = anetResolveAll(err, (char*)host.c_str(), ipbuf, CHANNEL_CONNECT_MAX, ANET_NONE)) > 0) {
+        for (int i = 0; i < n; i++) ips.push_back(ipbuf[i]);
     } else {
-        //memcpy(s->wbuf, buf + trans, slen - trans);
-        memmove(s->wbuf, s->wbuf + trans, slen - trans);
-        s->wpos = s->wbuf+slen-trans;
+        printf("Connect to %s:%d error: %s\n", host.c_str(), port, err);
     }
+    if (ips.empty()) co_return (xChannel*)NULL;
+
+    auto res = co_await channel_connect_start(ips, port, timeout_ms, fpack, fclose, userdata, proto);
+    if (res.size() < 2 || xpack_cast<int>(res[0]) != XNET_SUCCESS) {
+        printf("Connect to %s:%d failed: %d\n", host.c_str(), port, res.empty() ? -1 : xpack_cast<int>(res[0]));
+        co_return (xChannel*)NULL;
+    }
+    xChannel* s = (xChannel*)(uintptr_t)xpack_cast<unsigned long long>(res[1]);
+    printf("Connected to %s:%d, fd: %d\n", host.c_str(), port, (int)s->fd);
+    co_return s;
+#endif
+}
+
+static inline int xchannel_post(xChannel* s, int len, bool now = false) {
+#if defined(HAVE_IOURING)
+    // 同一channel只有一个send在途, 完成后在aeProcWrite里续发; SQE随下一轮poll批量提交
+    (void)now;
+    aeFileEvent* ev = s->ev;
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (el && ev && !(ev->mask & AE_WRITABLE)) {
+        ev->mask |= AE_WRITABLE;
+        if (aeUringSend(el, s->fd, ev, s->wbuf, (int)(s->wpos - s->wbuf)) == AE_ERR) {
+            xchannel_close(s);
+            return AE_ERR;
+        }
+    }
+#elif !defined(HAVE_IOCP)
+    if (_coalesce && !now) {
+        channel_mark_dirty(s);
+        channel_wblock(s);
+        return len;
+    }
+    // EAGAIN时剩余数据留在wbuf, 关注可写事件再发
+    int again = 0;
+    if (channel_write_out(s, channel_wpending(s), &again) < 0) {
+        xchannel_close(s);
+        return AE_ERR;
+    }
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (channel_wpending(s) > 0 && el && s->ev)
+        aeEnableFileEvent(el, s->fd, s->ev, AE_WRITABLE);
 #else
+    (void)now;
     aeFileEvent* ev = s->ev;
     aeEventLoop* el = aeGetCurEventLoop();
     channel_context_t* ctx = (channel_context_t*)ev->clientData;
@@ -558,12 +2296,98 @@ static inline int xchannel_post(xChannel* s, int len) {
         }
     }
 #endif
+    channel_wblock(s);
     return len;
 }
 
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+static void channel_wbuf_free(char* base, void* ud) {
+    channel_seg_put(base, (int)(intptr_t)ud);
+}
+
+// wbuf写到bufmax: 整块连同未写出的数据转进排队, 之后换一块新的接着写.
+// 已排队的块插在wbuf数据中间, 按mark把wbuf切成片和它们交错, 转完所有块的mark都是wseq
+static void channel_wbuf_seal(xChannel* s) {
+    if (!s->segq) {
+        s->segq = new xChannelSegq();
+        s->segq->bytes = 0;
+    }
+    std::deque<channel_seg_t>& q = s->segq->q;
+    std::deque<channel_seg_t> old;
+    old.swap(q);
+
+    channel_seg_t piece;
+    memset(&piece, 0, sizeof(piece));
+    piece.kind = CHANNEL_SEG_WBUF;
+    piece.buf = s->wbase;
+    piece.mark = s->wseq;
+    long long at = s->wbuf - s->wbase;      // 块内偏移
+    long long end = s->wpos - s->wbase;
+    size_t last = 0;
+    for (channel_seg_t& seg : old) {
+        long long m = seg.mark - s->wseq + (s->wbuf - s->wbase);
+        if (m > at) {
+            piece.off = at;
+            piece.len = m;
+            last = q.size();
+            q.push_back(piece);
+            s->segq->bytes += m - at;
+            at = m;
+        }
+        seg.mark = s->wseq;
+        q.push_back(seg);
+    }
+    if (end > at) {
+        piece.off = at;
+        piece.len = end;
+        last = q.size();
+        q.push_back(piece);
+        s->segq->bytes += end - at;
+    }
+    // 整块随最后一片写完归还
+    q[last].ffree = channel_wbuf_free;
+    q[last].ud = (void*)(intptr_t)channel_buf_cap(channel_wbuf(s));
+    s->wbase = s->wbuf = s->wpos = NULL;
+    s->wlen = 0;
+}
+#endif
+
+int xchannel_reserve(xChannel* s, int len) {
+    if (!s || len < 0) return AE_ERR;
+    xChannel* inflight = NULL;
+#if defined(HAVE_IOCP) || defined(HAVE_IOURING)
+    if (s->ev && (s->ev->mask & AE_WRITABLE))
+        inflight = s;               // send在途, 扩容不能马上归还旧wbuf
+#endif
+    int used = s->wbase ? (int)(s->wpos - s->wbuf) : 0;
+    if (used + len > s->wpeak) s->wpeak = used + len;    // 先记峰值, 首次借就按它取大小
+    if (channel_buf_reserve(channel_wbuf(s), len, s->bufmax, false, inflight) == AE_OK)
+        return AE_OK;
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+    // 写满了: 转进排队再借一块, 发送积压交给水位控制
+    if (used > 0 && used + len > s->bufmax && len <= s->bufmax) {
+        channel_wbuf_seal(s);
+        if (channel_buf_reserve(channel_wbuf(s), len, s->bufmax, false, NULL) == AE_OK)
+            return AE_OK;
+    }
+#endif
+    return AE_ERR;                  // 超过bufmax或内存上限
+}
+
+void xchannel_set_bufmax(xChannel* s, int max) {
+    if (max < 1024) max = 1024;
+    if (!s) {
+        _bufmax = max;
+        return;
+    }
+    // 已经分配的不缩, 只限制之后的增长
+    s->bufmax = max;
+}
+
 int xchannel_send(xChannel* s, const char* buf, int len) {
-    if (!s || !s->wbuf || len<=0 ) return 0;
-    if (_xchannel_write_header(s, len) < 0) {
+    if (!s || len<=0 ) return 0;
+    if (xchannel_reserve(s, (int)_xchannel_header_size(s) + len) != AE_OK ||
+        _xchannel_write_header(s, len) < 0) {
         printf("Send buffer full, fd: %d\n", (int)s->fd);
         return 0;
     }
@@ -574,10 +2398,9 @@ int xchannel_send(xChannel* s, const char* buf, int len) {
 }
 
 int xchannel_rawsend(xChannel* s, const char* buf, int len) {
-    if (!s || !s->wbuf) return 0;
+    if (!s || len <= 0) return 0;
 
-    int remain = s->wlen - (int)(s->wpos - s->wbuf);
-    if (remain < len) {
+    if (xchannel_reserve(s, len) != AE_OK) {
         printf("Send buffer full, fd: %d\n", (int)s->fd);
         return 0;
     }
@@ -587,10 +2410,9 @@ int xchannel_rawsend(xChannel* s, const char* buf, int len) {
 }
 
 int xchannel_sbuf(xChannel* s, const char* buf, int len) {
-    if (!s || !s->wbuf) return 0;
+    if (!s || len <= 0) return 0;
 
-    int remain = s->wlen - (int)(s->wpos - s->wbuf);
-    if (remain < len) {
+    if (xchannel_reserve(s, len) != AE_OK) {
         printf("Send buffer full, fd: %d\n", (int)s->fd);
         return 0;
     }
@@ -599,12 +2421,316 @@ int xchannel_sbuf(xChannel* s, const char* buf, int len) {
     return len;
 }
 
+// 转交的数据是否要拷进wbuf: 小包, TLS(逐段加密, 和wbuf一起切记录), 或完成模式(单缓冲区在途send)
+static bool channel_owned_copy(xChannel* s, int len) {
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+    return len < XCHANNEL_OWNED_MIN || s->tls;
+#else
+    (void)s; (void)len;
+    return true;
+#endif
+}
+
+int xchannel_reserve_owned(xChannel* s, int head, int len) {
+    if (!s || head < 0 || len < 0) return AE_ERR;
+    // 要拷贝的连数据一起预留, 写了头之后不会再因为数据放不下失败
+    return xchannel_reserve(s, channel_owned_copy(s, len) ? head + len : head);
+}
+
+int xchannel_rawsend_owned(xChannel* s, char* buf, int len, xchannel_free_proc* ffree, void* ud) {
+    if (!s || len <= 0 || s->closing) {
+        if (ffree) ffree(buf, ud);
+        return 0;
+    }
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+    if (!channel_owned_copy(s, len)) {
+        channel_seg_t seg;
+        memset(&seg, 0, sizeof(seg));
+        seg.kind = CHANNEL_SEG_MEM;
+        seg.buf = buf;
+        seg.len = len;
+        seg.ffree = ffree;
+        seg.ud = ud;
+        channel_seg_push(s, seg);
+        return xchannel_post(s, len);
+    }
+#endif
+    int ret = xchannel_rawsend(s, buf, len);
+    if (ffree) ffree(buf, ud);
+    return ret;
+}
+
+int xchannel_send_owned(xChannel* s, char* buf, int len, xchannel_free_proc* ffree, void* ud) {
+    if (!s || len <= 0) {
+        if (ffree) ffree(buf, ud);
+        return 0;
+    }
+    if (xchannel_reserve_owned(s, (int)_xchannel_header_size(s), len) != AE_OK ||
+        _xchannel_write_header(s, len) < 0) {
+        printf("Send buffer full, fd: %d\n", (int)s->fd);
+        if (ffree) ffree(buf, ud);
+        return 0;
+    }
+    return xchannel_rawsend_owned(s, buf, len, ffree, ud);
+}
+
+int xchannel_sendfile(xChannel* s, int fd, long long off, long long len) {
+    if (!s || fd < 0 || off < 0 || len <= 0 || s->closing) return AE_ERR;
+#if defined(_WIN32)
+    return AE_ERR;
+#elif !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+    int dfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (dfd == -1) return AE_ERR;
+    channel_seg_t seg;
+    memset(&seg, 0, sizeof(seg));
+    seg.kind = CHANNEL_SEG_FILE;
+    seg.fd = dfd;
+    seg.foff = off;
+    seg.len = len;
+    channel_seg_push(s, seg);
+    return xchannel_post(s, 0) == AE_ERR ? AE_ERR : AE_OK;
+#else
+    // 完成模式每个channel只有一个在途send, 读进wbuf
+    if (len > s->bufmax || xchannel_reserve(s, (int)len) != AE_OK) return AE_ERR;
+    for (long long done = 0; done < len;) {
+        ssize_t n = pread(fd, s->wpos + done, (size_t)(len - done), (off_t)(off + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return AE_ERR;
+        done += n;
+    }
+    s->wpos += len;
+    return xchannel_post(s, (int)len) == AE_ERR ? AE_ERR : AE_OK;
+#endif
+}
+
+#ifdef CHANNEL_SPLICE
+// ============================================================================
+// splice转发: src的socket -> 管道 -> dst的socket, 数据不进用户态
+// ============================================================================
+static void channel_relay_free(xChannelRelay* r) {
+    close(r->pipe[0]);
+    close(r->pipe[1]);
+    delete r;
+}
+
+// src读进管道n字节: 接到dst队尾的管道块上, 中间又写过wbuf就另起一块
+static void channel_splice_queue(xChannelRelay* r, int n) {
+    xChannel* dst = r->dst;
+    r->inpipe += n;
+    long long end = dst->wseq + (dst->wbase ? (long long)(dst->wpos - dst->wbuf) : 0);
+    if (dst->segq && !dst->segq->q.empty()) {
+        channel_seg_t& back = dst->segq->q.back();
+        if (back.kind == CHANNEL_SEG_PIPE && back.mark == end) {
+            back.len += n;
+            dst->segq->bytes += n;
+            return;
+        }
+    }
+    channel_seg_t seg;
+    memset(&seg, 0, sizeof(seg));
+    seg.kind = CHANNEL_SEG_PIPE;
+    seg.fd = r->pipe[0];
+    seg.len = n;
+    seg.ud = r;
+    channel_seg_push(dst, seg);
+}
+
+// 管道满: src不再关注可读, 数据留在src的内核缓冲区里顶住对端
+static void channel_splice_pause(aeEventLoop* el, xChannel* s) {
+    if (!s->ev) return;
+    if (!s->rsplice->paused) {
+        aeHoldFileEvent(el, s->fd, s->ev, 1);
+        s->rsplice->paused = 1;
+    }
+    aeDeleteFileEvent(el, s->fd, s->ev, AE_READABLE);
+}
+
+// dst写出了管道里的n字节, 有空间了就恢复src
+static void channel_splice_drained(xChannelRelay* r, int n) {
+    r->inpipe -= n;
+    if (!r->paused || !r->src) return;
+    xChannel* src = r->src;
+    aeEventLoop* el = aeGetCurEventLoop();
+    r->paused = 0;
+    channel_read_resume(el, src);
+}
+
+static int channel_splice_read(aeEventLoop* el, xChannel* s) {
+    xChannelRelay* r = s->rsplice;
+    xChannel* dst = r->dst;
+    if (!dst || dst->closing) {
+        xchannel_close(s);
+        return AE_ERR;
+    }
+    // 开始转发前已经读进rbuf的; 先只进缓冲区, 最后统一post(发送失败会连带关闭s)
+    int used = s->rbase ? (int)(s->rpos - s->rbuf) : 0;
+    if (used > 0) {
+        if (xchannel_sbuf(dst, s->rbuf, used) != used) {
+            xchannel_close(s);
+            return AE_ERR;
+        }
+        channel_buf_consume(channel_rbuf(s), used);
+    }
+    channel_buf_release(channel_rbuf(s));
+
+    int edge = aeIsEdgeTriggered(s->ev);
+    int budget = aeGetIoBudget(el);
+    long long total = 0;
+    int eof = 0;
+    for (;;) {
+        ssize_t n = splice(s->fd, NULL, r->pipe[1], NULL, CHANNEL_SPLICE_PIPE, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+        if (n > 0) {
+            channel_splice_queue(r, (int)n);
+            total += n;
+            if (!edge || total >= budget) break;
+            continue;
+        }
+        if (n == 0) {
+            eof = 1;
+            break;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // socket里还有数据就是管道满了
+            int avail = 0;
+            if (ioctl(s->fd, FIONREAD, &avail) == 0 && avail > 0)
+                channel_splice_pause(el, s);
+            break;
+        }
+        printf("Splice error on fd: %d\n", s->fd);
+        eof = 1;
+        break;
+    }
+
+    if (eof) {
+        printf("Connection closed by peer, fd: %d\n", s->fd);
+        xchannel_close(s);      // 管道里的字节归dst, 照常写完
+    } else if (edge && total >= budget) {
+        aeMarkPending(el, s->fd, s->ev, AE_READABLE);
+    }
+    if (used + total > 0)
+        xchannel_post(dst, (int)(used + total));
+    return eof ? AE_ERR : AE_OK;
+}
+
+static void channel_splice_detach(xChannel* s) {
+    xChannelRelay* r = s->rsplice;
+    if (r) {
+        s->rsplice = NULL;
+        r->src = NULL;
+        if (r->dst && r->inpipe == 0) {
+            r->dst->wsplice = NULL;     // 管道已空, 不用等dst关闭
+            r->dst = NULL;
+        }
+        if (!r->dst) channel_relay_free(r);
+    }
+    r = s->wsplice;
+    if (r) {
+        s->wsplice = NULL;
+        r->dst = NULL;
+        if (r->src)
+            xchannel_close(r->src);     // 没处可转了, 释放随src
+        else
+            channel_relay_free(r);
+    }
+}
+#else
+static void channel_splice_detach(xChannel* s) {
+    (void)s;
+}
+#endif
+
+int xchannel_splice(xChannel* src, xChannel* dst) {
+#ifdef CHANNEL_SPLICE
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (!el || !src || !dst || src == dst || !src->ev || src->closing || dst->closing)
+        return AE_ERR;
+    if (src->rsplice || dst->wsplice) return AE_ERR;   // 每个方向只能有一个
+    if (src->tls || dst->tls) return AE_ERR;            // 密文不能原样转发
+    if (src->shm || dst->shm) return AE_ERR;            // 共享内存不经内核
+    if (src->kcp || dst->kcp) return AE_ERR;            // 要经过ARQ
+    xChannelRelay* r = new xChannelRelay();
+    if (pipe2(r->pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+        delete r;
+        return AE_ERR;
+    }
+    fcntl(r->pipe[1], F_SETPIPE_SZ, CHANNEL_SPLICE_PIPE);
+    r->inpipe = 0;
+    r->paused = 0;
+    r->src = src;
+    r->dst = dst;
+    src->rsplice = r;
+    dst->wsplice = r;
+    // rbuf里可能还有没处理的字节, 下一轮先转过去
+    aeMarkPending(el, src->fd, src->ev, AE_READABLE);
+    return AE_OK;
+#else
+    (void)src; (void)dst;
+    return AE_ERR;
+#endif
+}
+
+void xchannel_set_watermark(xChannel* s, int high, int low, int pause_read) {
+    if (high < 0) high = 0;
+    if (low < 0) low = 0;
+    if (low > high) low = high;
+    if (!s) {
+        _whigh = high;
+        _wlow = low;
+        _wpause = pause_read ? 1 : 0;
+        return;
+    }
+    s->whigh = high;
+    s->wlow = low;
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+    if (s->wblocked && s->wpause && !pause_read) {
+        s->wpause = 0;
+        channel_read_resume(aeGetCurEventLoop(), s);
+    }
+#endif
+    s->wpause = pause_read ? 1 : 0;
+}
+
+void xchannel_set_rbudget(xChannel* s, int pkts, int bytes) {
+    if (pkts <= 0) pkts = CHANNEL_READ_PKTS;
+    if (bytes < 0) bytes = 0;
+    if (!s) {
+        _rpkts = pkts;
+        _rbytes = bytes;
+        return;
+    }
+    s->rpkts = pkts;
+    s->rbytes = bytes;
+}
+
+void xchannel_set_wcallback(xChannel* s, xchannel_proc* on_writable, xchannel_proc* on_drain) {
+    if (!s) return;
+    s->fwritable = on_writable;
+    s->fdrain = on_drain;
+}
+
+int xchannel_wpending(xChannel* s) {
+    return s ? channel_wpending(s) : 0;
+}
+
+xAwaiter xchannel_drain(xChannel* s, int timeout_ms) {
+    if (!s || s->closing) return xAwaiter(XNET_CHANNEL_CLOSED);
+    if (channel_wpending(s) <= s->wlow) return xAwaiter(XNET_SUCCESS);
+    if (coroutine_self_id() == -1) return xAwaiter(XNET_NOT_IN_COROUTINE);
+    xAwaiter awaiter;
+    if (awaiter.wait_id() == 0) return xAwaiter(XNET_NOT_IN_COROUTINE);
+    if (timeout_ms > 0) awaiter.set_timeout(timeout_ms);
+    _drain_waits.emplace_back(s, awaiter.wait_id());
+    s->wwait++;
+    return awaiter;
+}
+
 int xchannel_flush(xChannel* s) {
-    if (!s || !s->wbuf) return 0;
+    if (!s) return 0;
 
-    int len = (int)(s->wpos - s->wbuf);
+    int len = channel_wpending(s);
     if (len <= 0) return 0;
-    return xchannel_post(s, len);
+    return xchannel_post(s, len, true);
 }
 
 int xchannel_close(struct xChannel* s) {
@@ -613,14 +2739,33 @@ int xchannel_close(struct xChannel* s) {
     if (s->closing) return AE_OK;
     s->closing = 1;
     printf("Closing channel, fd: %d\n", (int)s->fd);
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+    if (s->dirty) {
+        // 合并中还没写的数据尽量写出去
+        int again = 0;
+        _dirty[s->dirty - 1] = NULL;
+        s->dirty = 0;
+        channel_write_out(s, channel_wpending(s), &again);
+    }
+#endif
+
+    if (s->wwait)
+        channel_drain_resume(s, XNET_CHANNEL_CLOSED);
 
     aeFileEvent* ev = s->ev;
     aeEventLoop* el = aeGetCurEventLoop();
-    if (el && ev && (AE_READABLE&ev->mask)) {
+    if (el && ev && ((AE_READABLE&ev->mask) || (ev->flags & AE_HOLD))) {
         channel_context_t* ctx = (channel_context_t*)ev->clientData;
         ev->clientData = NULL;
         aeDeleteFileEvent(el, s->fd, ev, AE_READABLE);
         aeDeleteFileEvent(el, s->fd, ev, AE_WRITABLE);
+#if !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+        if (s->paused) {
+            _pool.paused[s->paused - 1] = NULL;
+            s->paused = 0;
+        }
+#endif
+        aeHoldFileEvent(el, s->fd, ev, 0);     // 暂停读(内存上限/转发管道满)时fe靠AE_HOLD留着
         ctx->fclose(s, NULL, 0);
         if (ctx) {
             free_channel_context(ctx);
@@ -12,21 +12,69 @@ typedef enum xProto {
     xproto_crlf_resp2  = 2,  // crlf-redis-resp2协议
     xproto_crlf_resp3  = 3,  // crlf-redis-resp3协议
     xrpoto_crlf_http1  = 4,  // crlf-http-1.1协议
-    xproto_max               // 协议数量
+    xproto_varint      = 5,  // LEB128 varint长度前缀(protobuf分隔格式)
+    xproto_max               // 内置协议数量, 注册的协议号从这里往后排
 } xProto;
 
+// xchannel_proto_fixed的flags
+#define XPROTO_LEN_LE       0x1     // 长度字段小端, 默认大端
+#define XPROTO_LEN_WHOLE    0x2     // 长度字段的值包含包头
+#define XPROTO_KEEP_HDR     0x4     // 包头也交给fpack; 发送时包头由调用方和数据一起写
+
+// 读写缓冲区从线程的缓冲区池借, 不够时翻倍增长到bufmax, 取空就还回池里.
+// rbuf/wbuf是未处理数据的开头, 消费只前移它, len是从它到缓冲区末尾的字节数,
+// 所以len - (pos - buf)就是尾部空闲
+struct xChannel;
+struct xChannelSegq;
+struct xChannelRelay;
+struct xChannelTls;
+struct xChannelShm;
+struct xChannelKcp;
+typedef int xchannel_proc(struct xChannel* s, char* buf, int len);
+
 typedef struct xChannel {
     xSocket fd;
-    int     wlen;
+    int     wlen;           // wbuf到末尾的字节数, 0未分配
     char* wbuf;
     char* wpos;
+    char* wbase;            // 分配的起点
 
     int	    rlen;
     char* rbuf;
     char* rpos;
+    char* rbase;
+
+    int     bufmax;         // 单个缓冲区上限
+    int     rpeak;          // 取空前的峰值用量, 下次借缓冲区的大小
+    int     wpeak;
+    char*   wstale;         // 完成模式: 扩容前在途send引用的旧wbuf, 完成后归还
+    int     wstalelen;
+    uint32_t paused;        // 因内存上限暂停读, 在暂停列表中的位置+1
+    long long wseq;         // wbuf累计写出的字节, 转交的块按它排在wbuf数据之间
+    struct xChannelSegq* segq;  // 转交所有权待写的块, NULL没有
+    int     zcmin;          // 转交的块不小于它时用MSG_ZEROCOPY发送, 0不用
+    uint32_t zcseq;         // 下一次zerocopy发送的通知序号
+    uint32_t zcacked;       // 内核已通知完成的序号+1
+    struct xChannelRelay* rsplice;  // 读到的数据splice给对端, NULL没有
+    struct xChannelRelay* wsplice;  // 对端splice过来的数据在segq里排队
+    struct xChannelTls* tls;        // TLS会话(见xchannel_tls.h), NULL明文
+    struct xChannelShm* shm;        // 共享内存环(见xchannel_shm.h), NULL走socket
+    struct xChannelKcp* kcp;        // UDP上的可靠流(见xchannel_kcp.h), NULL走TCP/unix socket
+    int     whigh;          // 待写超过它时阻塞
+    int     wlow;           // 阻塞后降到它以下恢复
+    uint8_t wblocked;       // 超过高水位还没降到低水位
+    uint8_t wpause;         // 阻塞期间暂停读
+    uint32_t wwait;         // 在等xchannel_drain的协程数
+    xchannel_proc* fwritable;
+    xchannel_proc* fdrain;
+    int     rpkts;          // 每次唤醒最多交给fpack的包数
+    int     rbytes;         // 每次唤醒最多交给fpack的字节, 0不限
+    uint8_t rmore;          // 到预算时rbuf里还有数据, 已排到loop下一轮
 
     aeFileEvent* ev;
     xProto pproto;          // 通道协议类型
+    int     fscan;          // 分帧: 当前包已经扫过的字节, 新数据到了从这里接着扫
+    int     fstate[2];      // 分帧器的续扫状态, 由协议解释; 取走一个包后清零
     void* userdata;         // 用户数据指针
 
     uint8_t  is_rpc;
@@ -34,17 +82,69 @@ typedef struct xChannel {
     uint32_t co_id;
     uint32_t pt;
     uint8_t  closing;       // 关闭中标记，避免重复关闭
+    uint32_t dirty;         // 在loop待写列表中的位置+1, 0不在
 } xChannel;
 
-typedef int xchannel_proc(struct xChannel* s, char* buf, int len);
+typedef void xchannel_free_proc(char* buf, void* ud);
+
+#define XCHANNEL_OWNED_MIN (16*1024)    // 转交所有权的发送小于它时直接拷进wbuf
 
 // 函数声明
+// 注册定长包头协议: 包头hdr_size字节, [len_off, len_off+len_bytes)是长度字段(1~4字节), flags见XPROTO_*.
+// 返回协议号(作为xchannel_conn/listen的proto), 失败-1; name需长期有效. 在启动网络线程前注册
+int         xchannel_proto_fixed(const char* name, int hdr_size, int len_off, int len_bytes, int flags);
 xChannel*   xchannel_conn(char* addr, int port, xchannel_proc* on_pack, xchannel_proc* on_close, void* userdata, xProto proto = xProto::xproto_blp4);
 int         xchannel_listen(int port, char* bindaddr, xchannel_proc* proc, xchannel_proc* on_close, void* userdata, xProto proto = xProto::xproto_blp4);
+// 多reactor监听: 启动nloops个xthread网络线程(id从base_id起, 0为XTHR_NET_GRP, nloops<=0取CPU数),
+// 每个线程一个aeEventLoop和SO_REUSEPORT监听fd, 连接固定在accept它的loop上, 回调都在该线程执行
+int         xchannel_listen_mt(int port, char* bindaddr, int nloops, xchannel_proc* proc, xchannel_proc* on_close, void* userdata, xProto proto = xProto::xproto_blp4, int base_id = 0);
+// unix domain socket, 分帧/RPC和TCP一样. path以'@'开头是linux抽象命名空间(不建文件, 进程退出即消失);
+// 文件路径上残留的死socket会先删掉, 还有进程在监听则失败. perm非0时chmod socket文件. windows不支持
+int         xchannel_listen_unix(const char* path, xchannel_proc* proc, xchannel_proc* on_close, void* userdata, xProto proto = xProto::xproto_blp4, int perm = 0);
+xChannel*   xchannel_conn_unix(const char* path, xchannel_proc* on_pack, xchannel_proc* on_close, void* userdata, xProto proto = xProto::xproto_blp4);
+// wbuf到bufmax时整块转进排队继续写, 不丢数据; 只有单条超过bufmax或到内存上限时失败返回0
 int         xchannel_send(struct xChannel* s, const char* buf, int len);
 int         xchannel_rawsend(struct xChannel* s, const char* buf, int len);
 int         xchannel_sbuf(xChannel* s, const char* buf, int len);
+// 转交所有权的发送: buf不拷贝, 排在已写入wbuf的数据之后用writev写出, 写完(或失败/关闭)时调用ffree(buf, ud).
+// 调用后buf归channel, 返回值同xchannel_send. 完成模式(iocp/io_uring)和小包仍拷进wbuf
+int         xchannel_send_owned(xChannel* s, char* buf, int len, xchannel_free_proc* ffree, void* ud);
+int         xchannel_rawsend_owned(xChannel* s, char* buf, int len, xchannel_free_proc* ffree, void* ud);
+// 先写head字节的头再xchannel_rawsend_owned转交len字节时, 写头前调用: 数据要拷进wbuf时连数据一起预留, 否则只预留头
+int         xchannel_reserve_owned(xChannel* s, int head, int len);
+// 转交的块不小于min字节时用MSG_ZEROCOPY发送, 块等内核从错误队列通知完成才释放; 0关闭.
+// s为NULL时设置之后新建channel的默认值(全进程共用, 在启动网络线程前设置). 只在linux的epoll/select等就绪模式下可用, 不支持返回AE_ERR.
+// 内核回退成拷贝时(如loopback)自动关闭, 那种情况下zerocopy只会更慢
+int         xchannel_set_zerocopy(xChannel* s, int min);
+// 发送文件fd的[off, off+len), 排在已写入的数据之后由loop用sendfile分段写出, 不经过wbuf.
+// fd会被dup, 调用后可以马上关闭. 完成模式(iocp/io_uring)读进wbuf再发, 受bufmax限制. 成功AE_OK
+int         xchannel_sendfile(xChannel* s, int fd, long long off, long long len);
+// 转发: 之后src读到的字节经管道splice到dst, 不再交给src的fpack, 不进用户态. src的rbuf里剩下的先转过去.
+// dst写不动时src停止读, 由TCP流控顶住src的对端. src关闭后已读的数据照常写完; dst关闭时src一起关闭.
+// 双向代理调两次. 只支持linux就绪模式, 否则返回AE_ERR
+int         xchannel_splice(xChannel* src, xChannel* dst);
+// 保证wbuf还能写入len字节(按需扩容), 直接往wpos写数据前调用; 超过上限返回AE_ERR
+int         xchannel_reserve(xChannel* s, int len);
+// 单个缓冲区上限, s为NULL时设置之后新建channel的默认值(默认2MB, 全进程共用, 在启动网络线程前设置)
+void        xchannel_set_bufmax(xChannel* s, int max);
+// 全进程channel缓冲区内存上限(含池里缓存的), 0不限(默认), 任何线程随时可以改. 到上限时send/reserve失败,
+// 读暂停到有内存再恢复, 数据留在内核缓冲区里由TCP流控顶住对端
+void        xchannel_set_memcap(long long cap);
+long long   xchannel_mem_used();
+// 发送积压水位(字节, wbuf加排队的块): 超过high时阻塞, 降到low及以下时回调on_writable, 唤醒xchannel_drain.
+// pause_read非0时阻塞期间不读这个channel, 由TCP流控顶住对端(两端都开启又互相大量发送时会互等).
+// s为NULL时设置之后新建channel的默认值(默认4MB/1MB, 不暂停读; 全进程共用, 在启动网络线程前设置). 完成模式(iocp/io_uring)不暂停读
+void        xchannel_set_watermark(xChannel* s, int high, int low, int pause_read);
+// 写出回调, 在loop里调用, NULL不回调: on_writable阻塞后降到低水位; on_drain等可写的数据全部写给了内核
+void        xchannel_set_wcallback(xChannel* s, xchannel_proc* on_writable, xchannel_proc* on_drain);
+int         xchannel_wpending(xChannel* s);
+// 读预算: 一次唤醒最多处理pkts个包/bytes字节(0不限), 剩下的排到loop下一轮接着处理, 不等新的可读事件.
+// 小了公平, 大了吞吐好. s为NULL时设置之后新建channel的默认值(默认64个包, 字节不限; 全进程共用, 在启动网络线程前设置).
+// 完成模式(iocp/io_uring)没有重新触发, 每次完成都处理到不完整为止
+void        xchannel_set_rbudget(xChannel* s, int pkts, int bytes);
 int         xchannel_flush(xChannel* s);
 int         xchannel_close(struct xChannel* s);
+// 发送合并(当前线程的loop): 开启后send只追加到wbuf, 每轮poll前每个channel写一次; 关闭时立即写出
+void        xchannel_coalesce(bool enable);
 
 #endif
@@ -28,6 +28,13 @@ typedef struct {
 
 const PacketOps* _xchannel_get_ops(xChannel* channel);
 
+#define XCHANNEL_PROTO_MAX 32   // 内置加注册的协议总数上限
+
+// 注册自定义协议, ops按值保存, proto_name需长期有效. read_header返回包头长度并给出数据长度,
+// 不完整返回PACKET_INCOMPLETE; 可以用channel->fscan/fstate保存续扫状态, 取走一个包后自动清零.
+// 返回协议号(作为xchannel_conn/listen的proto), 表满返回-1. 在启动网络线程前注册
+int xchannel_proto_register(const PacketOps* ops);
+
 /**
     * @brief 检查通道接收缓冲区中的数据包是否完整
     * @param channel 通道指针
@@ -0,0 +1,459 @@
+// xchannel_dgram.cpp
+#include "xchannel_dgram.h"
+#include "anet.h"
+#include "zmalloc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#if defined(__linux__)
+#include <netinet/udp.h>
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
+#define DGRAM_GSO_SEGS  64          // 一次GSO发送最多的段数(老内核的UDP_MAX_SEGMENTS)
+#define DGRAM_GSO_MAX   65000       // 一次GSO发送的总字节上限(UDP负载不超过64K)
+#define DGRAM_GRO_SIZE  65536       // 开GRO时的接收上限
+#define DGRAM_LEN_MAX   65507       // 单个数据报的负载上限
+
+#if !defined(_WIN32)
+// 排队的数据报: 负载在wdata[off, off+len), alen为0发给connect的对端
+typedef struct dgram_out_t {
+    int     off;
+    int     len;
+    socklen_t alen;
+    struct sockaddr_storage addr;
+} dgram_out_t;
+
+struct xDgramIo {
+    char*   rbuf;               // XDGRAM_BATCH个rcap大小的接收槽
+    int     rcap;
+    struct sockaddr_storage raddr[XDGRAM_BATCH];
+#if defined(__linux__)
+    struct mmsghdr rmsg[XDGRAM_BATCH];
+    struct iovec riov[XDGRAM_BATCH];
+    char    rctl[XDGRAM_BATCH][CMSG_SPACE(sizeof(int))];
+    struct mmsghdr wmsg[XDGRAM_BATCH];
+    struct iovec wiov[XDGRAM_BATCH * DGRAM_GSO_SEGS];
+    char    wctl[XDGRAM_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+    int     wsegs[XDGRAM_BATCH];    // 每条msg合了几个数据报
+#endif
+    std::vector<char> wdata;
+    std::vector<dgram_out_t> wq;
+    size_t  whead;              // wq里第一个没写出的
+    int     wbytes;             // 没写出的负载字节
+};
+
+static int dgram_write(xDgramChannel* d);
+
+static void dgram_free(xDgramChannel* d) {
+    if (d->io) {
+        if (d->io->rbuf) zfree(d->io->rbuf);
+        delete d->io;
+    }
+    zfree(d);
+}
+
+static int dgram_same_dest(const dgram_out_t* a, const dgram_out_t* b) {
+    return a->alen == b->alen && (a->alen == 0 || memcmp(&a->addr, &b->addr, a->alen) == 0);
+}
+
+// 接收槽的大小跟着rsize/gro变, 只在两次读之间换, 回调里改设置不影响正在交出去的数据
+static int dgram_rcap(xDgramChannel* d) {
+    int cap = d->rsize;
+    if (d->gro && cap < DGRAM_GRO_SIZE) cap = DGRAM_GRO_SIZE;
+    xDgramIo* io = d->io;
+    if (io->rbuf && io->rcap == cap) return cap;
+    if (io->rbuf) zfree(io->rbuf);
+    io->rbuf = (char*)zmalloc((size_t)cap * XDGRAM_BATCH);
+    io->rcap = cap;
+#if defined(__linux__)
+    for (int i = 0; i < XDGRAM_BATCH; i++) {
+        io->riov[i].iov_base = io->rbuf + (size_t)cap * i;
+        io->riov[i].iov_len = cap;
+    }
+#endif
+    return cap;
+}
+
+// 一个收到的数据报(GRO合并的按段拆开)交给fpack, 回调里关闭了返回-1
+static int dgram_deliver(xDgramChannel* d, char* buf, int len, int seg, int i) {
+    const struct sockaddr* from = (const struct sockaddr*)&d->io->raddr[i];
+    int fromlen = d->connected ? 0 : (int)sizeof(struct sockaddr_storage);
+#if defined(__linux__)
+    fromlen = d->connected ? 0 : (int)d->io->rmsg[i].msg_hdr.msg_namelen;
+#endif
+    if (seg <= 0 || seg >= len) seg = len;
+    for (int off = 0; off < len && !d->closing; off += seg) {
+        int n = len - off < seg ? len - off : seg;
+        d->fpack(d, buf + off, n, fromlen ? from : NULL, fromlen);
+    }
+    return d->closing ? -1 : 0;
+}
+
+// 读到EAGAIN或预算用完, 返回-1表示回调里关闭了
+static int dgram_read(aeEventLoop* el, xDgramChannel* d) {
+    xDgramIo* io = d->io;
+    int total = 0;
+    for (;;) {
+        int cap = dgram_rcap(d);
+#if defined(__linux__)
+        for (int i = 0; i < XDGRAM_BATCH; i++) {
+            struct msghdr* h = &io->rmsg[i].msg_hdr;
+            h->msg_name = &io->raddr[i];
+            h->msg_namelen = sizeof(io->raddr[i]);
+            h->msg_iov = &io->riov[i];
+            h->msg_iovlen = 1;
+            h->msg_control = d->gro ? io->rctl[i] : NULL;
+            h->msg_controllen = d->gro ? sizeof(io->rctl[i]) : 0;
+            h->msg_flags = 0;
+        }
+        int n = recvmmsg(d->fd, io->rmsg, XDGRAM_BATCH, 0, NULL);
+#else
+        socklen_t alen = sizeof(io->raddr[0]);
+        int n = (int)recvfrom(d->fd, io->rbuf, cap, 0, (struct sockaddr*)&io->raddr[0], &alen);
+        if (n >= 0) {
+            if (n > cap) n = cap;
+            d->busy = 1;
+            int r = dgram_deliver(d, io->rbuf, n, 0, 0);
+            d->busy = 0;
+            if (r < 0) return -1;
+            n = 1;
+        }
+#endif
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            // connect的对端不可达(ICMP)之类的异步错误, 读一次就清掉了
+            if (errno == ECONNREFUSED || errno == EHOSTUNREACH || errno == ENETUNREACH) continue;
+            printf("xdgram recv fd %d error: %s\n", (int)d->fd, strerror(errno));
+            return 0;
+        }
+#if defined(__linux__)
+        d->busy = 1;
+        for (int i = 0; i < n; i++) {
+            struct msghdr* h = &io->rmsg[i].msg_hdr;
+            int len = (int)io->rmsg[i].msg_len;
+            if (h->msg_flags & MSG_TRUNC) {
+                d->rtrunc++;
+                continue;
+            }
+            int seg = 0;
+            if (d->gro) {
+                for (struct cmsghdr* c = CMSG_FIRSTHDR(h); c; c = CMSG_NXTHDR(h, c)) {
+                    if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO)
+                        memcpy(&seg, CMSG_DATA(c), sizeof(seg));
+                }
+            }
+            if (dgram_deliver(d, io->rbuf + (size_t)cap * i, len, seg, i) < 0) break;
+        }
+        d->busy = 0;
+        if (d->closing) return -1;
+        if (n < XDGRAM_BATCH) return 0;     // 取空了, 边缘触发下也不用再试
+#endif
+        (void)cap;
+        total += n;
+        if (total >= XDGRAM_BUDGET) {
+            aeMarkPending(el, d->fd, d->ev, AE_READABLE);
+            return 0;
+        }
+    }
+}
+
+static int dgram_event(aeEventLoop* el, xSocket fd, void* privdata, int mask, int trans) {
+    xDgramChannel* d = (xDgramChannel*)privdata;
+    if (!d || d->closing) return AE_ERR;
+    if ((mask & AE_READABLE) && dgram_read(el, d) < 0) {
+        dgram_free(d);
+        return AE_ERR;
+    }
+    // 可写只在队列非空时开着, 写完就关
+    if ((mask & AE_WRITABLE) && (d->ev->mask & AE_WRITABLE) && dgram_write(d) == 0)
+        aeDeleteFileEvent(el, d->fd, d->ev, AE_WRITABLE);
+    return AE_OK;
+}
+
+// 写出的数据报从队列里去掉, 全部写完清空, 否则前面空出一半以上时搬一次
+static void dgram_consume(xDgramIo* io, int cnt) {
+    for (int i = 0; i < cnt; i++)
+        io->wbytes -= io->wq[io->whead++].len;
+    if (io->whead == io->wq.size()) {
+        io->wq.clear();
+        io->wdata.clear();
+        io->whead = 0;
+        io->wbytes = 0;
+    } else if (io->whead >= 1024 && io->whead * 2 >= io->wq.size()) {
+        int base = io->wq[io->whead].off;
+        io->wq.erase(io->wq.begin(), io->wq.begin() + io->whead);
+        io->wdata.erase(io->wdata.begin(), io->wdata.begin() + base);
+        for (auto& o : io->wq) o.off -= base;
+        io->whead = 0;
+    }
+}
+
+// 返回还没写出的数据报数
+static int dgram_write(xDgramChannel* d) {
+    xDgramIo* io = d->io;
+    while (io->whead < io->wq.size()) {
+#if defined(__linux__)
+        int m = 0, k = 0;
+        size_t i = io->whead;
+        while (m < XDGRAM_BATCH && i < io->wq.size()) {
+            dgram_out_t* o = &io->wq[i];
+            struct msghdr* h = &io->wmsg[m].msg_hdr;
+            memset(h, 0, sizeof(*h));
+            h->msg_name = o->alen ? &o->addr : NULL;
+            h->msg_namelen = o->alen;
+            h->msg_iov = &io->wiov[k];
+            // GSO: 除最后一段外都等于分段大小, 目的地相同
+            int segs = 0, total = 0;
+            for (;;) {
+                dgram_out_t* c = &io->wq[i];
+                io->wiov[k].iov_base = io->wdata.data() + c->off;
+                io->wiov[k].iov_len = c->len;
+                k++, segs++, i++;
+                total += c->len;
+                if (!d->gso || c->len != d->gso || segs >= DGRAM_GSO_SEGS || i >= io->wq.size()) break;
+                dgram_out_t* nx = &io->wq[i];
+                if (nx->len > d->gso || total + nx->len > DGRAM_GSO_MAX || !dgram_same_dest(o, nx)) break;
+            }
+            h->msg_iovlen = segs;
+            if (segs > 1) {
+                uint16_t gso = (uint16_t)d->gso;
+                h->msg_control = io->wctl[m];
+                h->msg_controllen = sizeof(io->wctl[m]);
+                struct cmsghdr* c = CMSG_FIRSTHDR(h);
+                c->cmsg_level = SOL_UDP;
+                c->cmsg_type = UDP_SEGMENT;
+                c->cmsg_len = CMSG_LEN(sizeof(gso));
+                memcpy(CMSG_DATA(c), &gso, sizeof(gso));
+            }
+            io->wsegs[m++] = segs;
+        }
+        int n = sendmmsg(d->fd, io->wmsg, m, 0);
+        if (n < 0) {
+            if (errno == EINTR || errno == ECONNREFUSED) continue;    // 对端不可达的异步错误, 这次调用已清掉
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) break;
+            if (io->wsegs[0] > 1 && (errno == EIO || errno == EINVAL)) {
+                // 网卡/路径不支持这个分段, 退回逐个发送
+                printf("xdgram fd %d gso %d failed: %s, disabled\n", (int)d->fd, d->gso, strerror(errno));
+                d->gso = 0;
+                continue;
+            }
+            // 第一条发不出去(EMSGSIZE/ENETUNREACH...), 丢掉它接着发
+            d->wdrop += io->wsegs[0];
+            dgram_consume(io, io->wsegs[0]);
+            continue;
+        }
+        int cnt = 0;
+        for (int j = 0; j < n; j++) cnt += io->wsegs[j];
+        dgram_consume(io, cnt);
+        if (n < m) break;   // socket缓冲区满了
+#else
+        dgram_out_t* o = &io->wq[io->whead];
+        int n = (int)sendto(d->fd, io->wdata.data() + o->off, o->len, 0,
+            o->alen ? (struct sockaddr*)&o->addr : NULL, o->alen);
+        if (n < 0) {
+            if (errno == EINTR || errno == ECONNREFUSED) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) break;
+            d->wdrop++;
+        }
+        dgram_consume(io, 1);
+#endif
+    }
+    return (int)(io->wq.size() - io->whead);
+}
+
+static xDgramChannel* dgram_create(xSocket fd, xdgram_proc* fpack, void* userdata, int connected) {
+    aeEventLoop* el = aeGetCurEventLoop();
+    xDgramChannel* d = (xDgramChannel*)zmalloc(sizeof(xDgramChannel));
+    memset(d, 0, sizeof(xDgramChannel));
+    d->fd = fd;
+    d->fpack = fpack;
+    d->userdata = userdata;
+    d->rsize = XDGRAM_RSIZE;
+    d->wmax = XDGRAM_WMAX;
+    d->connected = (uint8_t)connected;
+    d->io = new xDgramIo();
+    d->io->rbuf = NULL;
+    d->io->rcap = 0;
+    d->io->whead = 0;
+    d->io->wbytes = 0;
+    if (aeCreateFileEvent(el, fd, AE_READABLE | AE_WRITABLE, dgram_event, d, &d->ev) == AE_ERR) {
+        printf("xdgram fd %d create event failed\n", (int)fd);
+        dgram_free(d);
+        return NULL;
+    }
+    return d;
+}
+#endif // !_WIN32
+
+static xDgramChannel* dgram_open(const char* addr, int port, xdgram_proc* fpack, void* userdata, int connect) {
+#if defined(_WIN32) || defined(HAVE_IOCP)
+    printf("xdgram not supported\n");
+    return NULL;
+#else
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (!el) {
+        printf("No event loop available\n");
+        return NULL;
+    }
+    if (!fpack) {
+        printf("xdgram fpack Invalid callback\n");
+        return NULL;
+    }
+    char err[ANET_ERR_LEN];
+    xSocket fd = connect ? anetUdpConnect(err, (char*)addr, port) : anetUdpServer(err, port, (char*)addr);
+    if (fd == (xSocket)ANET_ERR) {
+        printf("xdgram %s:%d error: %s\n", addr ? addr : "*", port, err);
+        return NULL;
+    }
+    xDgramChannel* d = dgram_create(fd, fpack, userdata, connect);
+    if (!d) anetCloseSocket(fd);
+    return d;
+#endif
+}
+
+xDgramChannel* xdgram_bind(const char* addr, int port, xdgram_proc* fpack, void* userdata) {
+    return dgram_open(addr, port, fpack, userdata, 0);
+}
+
+xDgramChannel* xdgram_connect(const char* addr, int port, xdgram_proc* fpack, void* userdata) {
+    if (!addr) return NULL;
+    return dgram_open(addr, port, fpack, userdata, 1);
+}
+
+int xdgram_sendto(xDgramChannel* d, const char* buf, int len, const struct sockaddr* to, int tolen) {
+#if defined(_WIN32)
+    return 0;
+#else
+    if (!d || d->closing || !buf || len <= 0) return 0;
+    if ((!to && !d->connected) || tolen < 0 || tolen > (int)sizeof(struct sockaddr_storage)) return 0;
+    xDgramIo* io = d->io;
+    if (len > DGRAM_LEN_MAX || io->wbytes + len > d->wmax) {
+        d->wdrop++;
+        return 0;
+    }
+    dgram_out_t o;
+    o.off = (int)io->wdata.size();
+    o.len = len;
+    o.alen = to ? (socklen_t)tolen : 0;
+    if (to) memcpy(&o.addr, to, tolen);
+    io->wdata.insert(io->wdata.end(), buf, buf + len);
+    io->wq.push_back(o);
+    io->wbytes += len;
+    if (io->wq.size() - io->whead == 1)
+        aeEnableFileEvent(aeGetCurEventLoop(), d->fd, d->ev, AE_WRITABLE);
+    return len;
+#endif
+}
+
+int xdgram_send(xDgramChannel* d, const char* buf, int len) {
+    return xdgram_sendto(d, buf, len, NULL, 0);
+}
+
+int xdgram_flush(xDgramChannel* d) {
+#if defined(_WIN32)
+    return 0;
+#else
+    if (!d || d->closing) return 0;
+    int left = dgram_write(d);
+    if (left == 0 && (d->ev->mask & AE_WRITABLE))
+        aeDeleteFileEvent(aeGetCurEventLoop(), d->fd, d->ev, AE_WRITABLE);
+    return left;
+#endif
+}
+
+int xdgram_set_gso(xDgramChannel* d, int segsize) {
+#if defined(__linux__)
+    if (!d || segsize < 0 || segsize > DGRAM_LEN_MAX) return AE_ERR;
+    if (segsize) {
+        // 内核认识这个选项就支持; socket级的默认值保持0, 只有合并的那几条msg带分段大小
+        int zero = 0;
+        if (setsockopt(d->fd, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) == -1) {
+            printf("xdgram fd %d gso not supported: %s\n", (int)d->fd, strerror(errno));
+            return AE_ERR;
+        }
+    }
+    d->gso = segsize;
+    return AE_OK;
+#else
+    return segsize ? AE_ERR : AE_OK;
+#endif
+}
+
+int xdgram_set_gro(xDgramChannel* d, int on) {
+#if defined(__linux__)
+    if (!d) return AE_ERR;
+    on = on ? 1 : 0;
+    if (setsockopt(d->fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == -1) {
+        printf("xdgram fd %d gro not supported: %s\n", (int)d->fd, strerror(errno));
+        return AE_ERR;
+    }
+    d->gro = (uint8_t)on;
+    return AE_OK;
+#else
+    return on ? AE_ERR : AE_OK;
+#endif
+}
+
+void xdgram_set_rsize(xDgramChannel* d, int size) {
+    if (!d) return;
+    if (size < 64) size = 64;
+    if (size > DGRAM_GRO_SIZE) size = DGRAM_GRO_SIZE;
+    d->rsize = size;
+}
+
+void xdgram_set_wmax(xDgramChannel* d, int max) {
+    if (d && max > 0) d->wmax = max;
+}
+
+int xdgram_wpending(xDgramChannel* d) {
+#if defined(_WIN32)
+    return 0;
+#else
+    return d ? (int)(d->io->wq.size() - d->io->whead) : 0;
+#endif
+}
+
+int xdgram_port(xDgramChannel* d) {
+#if defined(_WIN32)
+    return 0;
+#else
+    struct sockaddr_storage sa;
+    socklen_t len = sizeof(sa);
+    if (!d || getsockname(d->fd, (struct sockaddr*)&sa, &len) == -1) return 0;
+    if (sa.ss_family == AF_INET6) return ntohs(((struct sockaddr_in6*)&sa)->sin6_port);
+    return ntohs(((struct sockaddr_in*)&sa)->sin_port);
+#endif
+}
+
+// 排队的先尽量写出; 回调里关闭时释放推迟到回调返回
+void xdgram_close(xDgramChannel* d) {
+#if !defined(_WIN32)
+    if (!d || d->closing) return;
+    dgram_write(d);
+    d->closing = 1;
+    if (d->ev) {
+        aeDeleteFileEvent(aeGetCurEventLoop(), d->fd, d->ev, AE_READABLE | AE_WRITABLE);
+        d->ev = NULL;
+    }
+    anetCloseSocket(d->fd);
+    if (!d->busy) dgram_free(d);
+#endif
+}
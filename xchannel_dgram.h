@@ -0,0 +1,60 @@
+// xchannel_dgram.h
+#ifndef _XCHANNEL_DGRAM_H
+#define _XCHANNEL_DGRAM_H
+#include "ae.h"
+
+#include <stdint.h>
+
+// UDP数据报channel: 挂在当前线程的loop上, 每个数据报回调一次, 不分帧.
+// linux下读用recvmmsg, 写用sendmmsg, 每次最多XDGRAM_BATCH个; 可选UDP GSO/GRO.
+// 发送先拷进队列, 等下一次poll可写时一起写出. 只支持就绪模式(epoll/kqueue/select/io_uring的poll),
+// iocp下创建失败
+struct sockaddr;
+struct xDgramChannel;
+struct xDgramIo;
+// from/fromlen是对端地址, 回复时原样传给xdgram_sendto; connect的channel为NULL/0. 返回值忽略
+typedef int xdgram_proc(struct xDgramChannel* d, char* buf, int len, const struct sockaddr* from, int fromlen);
+
+#define XDGRAM_BATCH    32          // 一次recvmmsg/sendmmsg的数据报数
+#define XDGRAM_RSIZE    2048        // 默认单个数据报的接收上限, 超过的截断丢弃
+#define XDGRAM_BUDGET   256         // 每次唤醒最多处理的数据报, 剩下的排到loop下一轮
+#define XDGRAM_WMAX     (4*1024*1024)   // 默认发送队列上限(字节), 超过的丢弃
+
+typedef struct xDgramChannel {
+    xSocket fd;
+    aeFileEvent* ev;
+    xdgram_proc* fpack;
+    void*   userdata;
+    struct xDgramIo* io;    // 收发批量用的数组和发送队列
+    int     rsize;          // 单个数据报的接收上限
+    int     wmax;           // 发送队列上限
+    int     gso;            // UDP GSO分段大小, 0不用
+    uint8_t gro;            // 开了UDP GRO
+    uint8_t connected;      // xdgram_connect创建, 发送可以不带地址
+    uint8_t busy;           // 在回调里, 关闭推迟到回调返回
+    uint8_t closing;
+    uint32_t rtrunc;        // 超过rsize被丢弃的数据报数
+    uint32_t wdrop;         // 队列满或发送出错丢弃的数据报数
+} xDgramChannel;
+
+// 绑定addr:port收发(addr为NULL绑全部IPv4地址, port为0由系统分配, 见xdgram_port). 失败返回NULL
+xDgramChannel* xdgram_bind(const char* addr, int port, xdgram_proc* fpack, void* userdata);
+// connect到对端: 只收它的数据报, 发送可以不带地址; 对端不可达时(ICMP)读到的错误忽略
+xDgramChannel* xdgram_connect(const char* addr, int port, xdgram_proc* fpack, void* userdata);
+// 拷进发送队列, 下一次poll时批量写出. to为NULL发给connect的对端. 返回len, 丢弃返回0
+int         xdgram_sendto(xDgramChannel* d, const char* buf, int len, const struct sockaddr* to, int tolen);
+int         xdgram_send(xDgramChannel* d, const char* buf, int len);
+// 立即写出队列, 返回还没写出的数据报数(socket缓冲区满), 出错的丢弃
+int         xdgram_flush(xDgramChannel* d);
+// UDP GSO: 队列里连续发给同一地址、长度都等于segsize的数据报(最后一个可以短)合成一次发送, 由内核/网卡分段.
+// 要求linux 4.18+, 不支持返回AE_ERR; 0关闭
+int         xdgram_set_gso(xDgramChannel* d, int segsize);
+// UDP GRO: 内核把同一流的数据报合并交上来, 这里按段拆开逐个回调. 开启时接收上限至少64K. 要求linux 5.0+
+int         xdgram_set_gro(xDgramChannel* d, int on);
+void        xdgram_set_rsize(xDgramChannel* d, int size);
+void        xdgram_set_wmax(xDgramChannel* d, int max);
+int         xdgram_wpending(xDgramChannel* d);
+int         xdgram_port(xDgramChannel* d);
+void        xdgram_close(xDgramChannel* d);
+
+#endif
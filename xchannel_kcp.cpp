@@ -0,0 +1,957 @@
+// xchannel_kcp.cpp
+#include "xchannel_kcp.h"
+#include "anet.h"
+#include "zmalloc.h"
+#include "xtimer.h"
+
+#ifdef XCHANNEL_KCP
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <deque>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+// 段头24字节, 小端: conv(4) cmd(1) frg(1) wnd(2) ts(4) sn(4) una(4) len(4). 流模式, frg总是0
+#define KCP_OVERHEAD    24
+#define KCP_CMD_PUSH    81      // 数据
+#define KCP_CMD_ACK     82
+#define KCP_CMD_WASK    83      // 窗口探测, 对端回WINS
+#define KCP_CMD_WINS    84      // 通告窗口
+#define KCP_CMD_RST     85      // 关闭, 发送端的数据都已确认或放弃
+#define KCP_ASK_SEND    1
+#define KCP_ASK_TELL    2
+#define KCP_RTO_NODELAY 30
+#define KCP_RTO_MIN     100
+#define KCP_RTO_DEF     200
+#define KCP_RTO_MAX     60000
+#define KCP_PROBE_INIT  7000    // 对端窗口为0时第一次探测的等待
+#define KCP_PROBE_LIMIT 120000
+#define KCP_THRESH_MIN  2
+#define KCP_RST_COPIES  3       // RST不重传, 多发几份, 都丢了靠对端超时
+#define KCP_DEAD_LINK   20      // 单个段发了这么多次算断开
+#define KCP_FASTLIMIT   5       // 单个段最多快速重传的次数
+#define KCP_BUDGET      256     // 每次唤醒最多读的数据报
+#define KCP_RBUF        2048    // 接收数据报的缓冲, 大于XKCP_MTU
+#define KCP_SOCKBUF     (4*1024*1024)
+
+typedef struct kcp_seg_t {
+    uint32_t sn;
+    uint32_t ts;            // 最近一次发送的时间, 对端在ack里带回来算RTT
+    uint32_t resendts;
+    uint32_t rto;
+    uint32_t fastack;       // 被后面的ack跨过的次数
+    uint32_t xmit;          // 发送次数
+    int      len;
+    int      off;           // 接收: 已读走的字节
+    char     data[1];
+} kcp_seg_t;
+
+typedef struct kcp_ack_t {
+    uint32_t sn;
+    uint32_t ts;
+} kcp_ack_t;
+
+struct kcp_listener_t;
+
+struct xChannelKcp {
+    uint32_t conv;
+    uint32_t mss;
+    uint32_t snd_una;       // 最早没确认的sn
+    uint32_t snd_nxt;
+    uint32_t rcv_nxt;       // 下一个按序要收的sn
+    uint32_t ssthresh;
+    int32_t  rx_rttval;
+    int32_t  rx_srtt;
+    int32_t  rx_rto;
+    int32_t  rx_minrto;
+    uint32_t snd_wnd;
+    uint32_t rcv_wnd;
+    uint32_t rmt_wnd;       // 对端通告的接收窗口
+    uint32_t cwnd;
+    uint32_t incr;
+    uint32_t probe;         // KCP_ASK_*
+    uint32_t ts_probe;
+    uint32_t probe_wait;
+    uint32_t interval;
+    uint32_t nodelay;
+    uint32_t fastresend;
+    uint32_t nocwnd;
+    uint32_t current;       // 本次处理的时间(ms)
+    uint32_t last_send;
+    uint32_t last_recv;
+    uint32_t linger_ts;
+    std::deque<kcp_seg_t*> snd_queue;   // 还没进窗口, 最后一段没满时send接着往里拷
+    std::deque<kcp_seg_t*> snd_buf;     // 已发出等确认, 按sn排
+    std::deque<kcp_seg_t*> rcv_buf;     // 乱序到的, 按sn排
+    std::deque<kcp_seg_t*> rcv_queue;   // 按序的, 等channel读
+    std::vector<kcp_ack_t> acklist;
+    int      nrcv;          // rcv_queue里没读的字节
+    char*    obuf;          // 拼一个数据报
+    int      olen;
+    xSocket  fd;            // 发送: 客户端是connect的socket, 服务端是监听socket
+    int      efd;           // 服务端会话占位的fd, 挂上后归channel关
+    int      efd2;
+    struct sockaddr_storage addr;   // 服务端: 对端地址
+    socklen_t alen;
+    struct kcp_listener_t* listener;
+    std::string key;
+    xChannel* s;
+    xtimerHandler timer;
+    uint32_t tdue;
+    aeFileEvent* lev;       // 客户端close后收ack的事件, fd是dup出来的
+    uint8_t  wblocked;
+    uint8_t  gone;
+    uint8_t  rst;           // 对端发来了RST, 不用再回
+    uint8_t  lingering;
+    uint8_t  touched;
+};
+
+typedef struct kcp_listener_t {
+    xSocket fd;
+    aeFileEvent* ev;
+    xkcp_accept_proc* faccept;
+    void* ud;
+    std::unordered_map<std::string, xChannelKcp*> sessions;
+    std::vector<xChannelKcp*> touched;
+} kcp_listener_t;
+
+// 之后新建channel的默认值
+static int _nodelay = 0, _interval = 40, _resend = 0, _nc = 0;
+static int _sndwnd = XKCP_WND, _rcvwnd = XKCP_WND;
+
+static void kcp_destroy(xChannelKcp* k);
+
+static inline uint32_t kcp_now() {
+    return (uint32_t)time_get_ms();
+}
+
+static inline int32_t kcp_diff(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b);
+}
+
+static inline char* kcp_put16(char* p, uint16_t v) {
+    p[0] = (char)v;
+    p[1] = (char)(v >> 8);
+    return p + 2;
+}
+
+static inline char* kcp_put32(char* p, uint32_t v) {
+    p[0] = (char)v;
+    p[1] = (char)(v >> 8);
+    p[2] = (char)(v >> 16);
+    p[3] = (char)(v >> 24);
+    return p + 4;
+}
+
+static inline uint16_t kcp_get16(const char* p) {
+    const unsigned char* u = (const unsigned char*)p;
+    return (uint16_t)(u[0] | (u[1] << 8));
+}
+
+static inline uint32_t kcp_get32(const char* p) {
+    const unsigned char* u = (const unsigned char*)p;
+    return (uint32_t)u[0] | ((uint32_t)u[1] << 8) | ((uint32_t)u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+static kcp_seg_t* kcp_seg_new(int cap) {
+    kcp_seg_t* seg = (kcp_seg_t*)zmalloc(offsetof(kcp_seg_t, data) + (cap > 0 ? cap : 1));
+    memset(seg, 0, offsetof(kcp_seg_t, data));
+    return seg;
+}
+
+static void kcp_seg_clear(std::deque<kcp_seg_t*>& q) {
+    for (kcp_seg_t* seg : q) zfree(seg);
+    q.clear();
+}
+
+static void kcp_set_nodelay(xChannelKcp* k, int nodelay, int interval, int resend, int nc) {
+    if (nodelay >= 0) {
+        k->nodelay = (uint32_t)nodelay;
+        k->rx_minrto = nodelay ? KCP_RTO_NODELAY : KCP_RTO_MIN;
+    }
+    if (interval >= 0) {
+        if (interval < 10) interval = 10;
+        if (interval > 5000) interval = 5000;
+        k->interval = (uint32_t)interval;
+    }
+    if (resend >= 0) k->fastresend = (uint32_t)resend;
+    if (nc >= 0) k->nocwnd = (uint32_t)nc;
+}
+
+static xChannelKcp* kcp_create(uint32_t conv, xSocket fd) {
+    xChannelKcp* k = new xChannelKcp();
+    k->conv = conv;
+    k->mss = XKCP_MTU - KCP_OVERHEAD;
+    k->snd_una = k->snd_nxt = k->rcv_nxt = 0;
+    k->ssthresh = (uint32_t)_sndwnd;    // 慢启动到丢包或窗口上限
+    k->rx_rttval = k->rx_srtt = 0;
+    k->rx_rto = KCP_RTO_DEF;
+    k->snd_wnd = (uint32_t)_sndwnd;
+    k->rcv_wnd = (uint32_t)_rcvwnd;
+    k->rmt_wnd = XKCP_WND;
+    k->cwnd = 1;
+    k->incr = k->mss;
+    k->probe = k->ts_probe = k->probe_wait = 0;
+    kcp_set_nodelay(k, _nodelay, _interval, _resend, _nc);
+    k->current = k->last_send = k->last_recv = kcp_now();
+    k->linger_ts = 0;
+    k->nrcv = 0;
+    k->obuf = (char*)zmalloc(XKCP_MTU);
+    k->olen = 0;
+    k->fd = fd;
+    k->efd = k->efd2 = -1;
+    memset(&k->addr, 0, sizeof(k->addr));
+    k->alen = 0;
+    k->listener = NULL;
+    k->s = NULL;
+    k->timer = NULL;
+    k->tdue = 0;
+    k->lev = NULL;
+    k->wblocked = k->gone = k->rst = k->lingering = k->touched = 0;
+    return k;
+}
+
+// ---- 输出 ----
+
+static void kcp_flush_out(xChannelKcp* k) {
+    if (k->olen == 0) return;
+    ssize_t n;
+    do {
+        if (k->listener) n = sendto(k->fd, k->obuf, k->olen, 0, (struct sockaddr*)&k->addr, k->alen);
+        else n = send(k->fd, k->obuf, k->olen, 0);
+    } while (n == -1 && errno == EINTR);
+    // socket缓冲区满或出错的直接丢掉, 由重传补上
+    k->olen = 0;
+    k->last_send = k->current;
+}
+
+static inline uint32_t kcp_wnd_unused(xChannelKcp* k) {
+    size_t used = k->rcv_queue.size();
+    uint32_t wnd = used < k->rcv_wnd ? k->rcv_wnd - (uint32_t)used : 0;
+    return wnd > 0xffff ? 0xffff : wnd;
+}
+
+static void kcp_emit(xChannelKcp* k, uint8_t cmd, uint32_t ts, uint32_t sn, const char* data, int len) {
+    if (k->olen + KCP_OVERHEAD + len > XKCP_MTU)
+        kcp_flush_out(k);
+    char* p = k->obuf + k->olen;
+    p = kcp_put32(p, k->conv);
+    *p++ = (char)cmd;
+    *p++ = 0;
+    p = kcp_put16(p, (uint16_t)kcp_wnd_unused(k));
+    p = kcp_put32(p, ts);
+    p = kcp_put32(p, sn);
+    p = kcp_put32(p, k->rcv_nxt);
+    p = kcp_put32(p, (uint32_t)len);
+    if (len > 0) memcpy(p, data, len);
+    k->olen += KCP_OVERHEAD + len;
+}
+
+// 服务端已经没有这个会话(超时/关闭/重启): 回RST让对端关掉
+static void kcp_reset(xSocket fd, const struct sockaddr* to, socklen_t tolen, uint32_t conv) {
+    char buf[KCP_OVERHEAD];
+    memset(buf, 0, sizeof(buf));
+    kcp_put32(buf, conv);
+    buf[4] = (char)KCP_CMD_RST;
+    sendto(fd, buf, sizeof(buf), 0, to, tolen);
+}
+
+static void kcp_flush(xChannelKcp* k) {
+    uint32_t current = k->current;
+    for (const kcp_ack_t& a : k->acklist)
+        kcp_emit(k, KCP_CMD_ACK, a.ts, a.sn, NULL, 0);
+    k->acklist.clear();
+
+    // 对端窗口为0时隔一段时间探测, 等它通告新窗口
+    if (k->rmt_wnd == 0) {
+        if (k->probe_wait == 0) {
+            k->probe_wait = KCP_PROBE_INIT;
+            k->ts_probe = current + k->probe_wait;
+        } else if (kcp_diff(current, k->ts_probe) >= 0) {
+            k->probe_wait += k->probe_wait / 2;
+            if (k->probe_wait > KCP_PROBE_LIMIT) k->probe_wait = KCP_PROBE_LIMIT;
+            k->ts_probe = current + k->probe_wait;
+            k->probe |= KCP_ASK_SEND;
+        }
+    } else {
+        k->ts_probe = 0;
+        k->probe_wait = 0;
+    }
+    if (!k->lingering && kcp_diff(current, k->last_send) >= XKCP_PING_MS)
+        k->probe |= KCP_ASK_SEND;       // 保活, 对端回WINS
+    if (k->probe & KCP_ASK_SEND) kcp_emit(k, KCP_CMD_WASK, 0, 0, NULL, 0);
+    if (k->probe & KCP_ASK_TELL) kcp_emit(k, KCP_CMD_WINS, 0, 0, NULL, 0);
+    k->probe = 0;
+
+    uint32_t cwnd = k->snd_wnd < k->rmt_wnd ? k->snd_wnd : k->rmt_wnd;
+    if (!k->nocwnd && k->cwnd < cwnd) cwnd = k->cwnd;
+    while (!k->snd_queue.empty() && kcp_diff(k->snd_nxt, k->snd_una + cwnd) < 0) {
+        kcp_seg_t* seg = k->snd_queue.front();
+        k->snd_queue.pop_front();
+        seg->sn = k->snd_nxt++;
+        seg->xmit = 0;
+        seg->fastack = 0;
+        k->snd_buf.push_back(seg);
+    }
+
+    uint32_t resent = k->fastresend > 0 ? k->fastresend : 0xffffffff;
+    uint32_t rtomin = k->nodelay == 0 ? (uint32_t)(k->rx_rto >> 3) : 0;
+    int change = 0, lost = 0;
+    for (kcp_seg_t* seg : k->snd_buf) {
+        if (seg->xmit == 0) {
+            seg->xmit = 1;
+            seg->rto = (uint32_t)k->rx_rto;
+            seg->resendts = current + seg->rto + rtomin;
+        } else if (kcp_diff(current, seg->resendts) >= 0) {
+            // 超时重传, RTO退避
+            seg->xmit++;
+            if (k->nodelay == 0) seg->rto += seg->rto > (uint32_t)k->rx_rto ? seg->rto : (uint32_t)k->rx_rto;
+            else seg->rto += (k->nodelay < 2 ? seg->rto : (uint32_t)k->rx_rto) / 2;
+            if (seg->rto > KCP_RTO_MAX) seg->rto = KCP_RTO_MAX;
+            seg->resendts = current + seg->rto;
+            lost = 1;
+        } else if (seg->fastack >= resent && seg->xmit <= KCP_FASTLIMIT) {
+            // 快速重传: 后面的段都确认了它还没有
+            seg->xmit++;
+            seg->fastack = 0;
+            seg->resendts = current + seg->rto;
+            change++;
+        } else {
+            continue;
+        }
+        seg->ts = current;
+        kcp_emit(k, KCP_CMD_PUSH, seg->ts, seg->sn, seg->data, seg->len);
+        if (seg->xmit >= KCP_DEAD_LINK) k->gone = 1;
+    }
+    kcp_flush_out(k);
+
+    if (change) {
+        uint32_t inflight = k->snd_nxt - k->snd_una;
+        k->ssthresh = inflight / 2;
+        if (k->ssthresh < KCP_THRESH_MIN) k->ssthresh = KCP_THRESH_MIN;
+        k->cwnd = k->ssthresh + resent;
+        k->incr = k->cwnd * k->mss;
+    }
+    if (lost) {
+        k->ssthresh = k->cwnd / 2;
+        if (k->ssthresh < KCP_THRESH_MIN) k->ssthresh = KCP_THRESH_MIN;
+        k->cwnd = 1;
+        k->incr = k->mss;
+    }
+    if (k->cwnd < 1) {
+        k->cwnd = 1;
+        k->incr = k->mss;
+    }
+}
+
+// ---- 输入 ----
+
+static void kcp_shrink_buf(xChannelKcp* k) {
+    k->snd_una = k->snd_buf.empty() ? k->snd_nxt : k->snd_buf.front()->sn;
+}
+
+static void kcp_update_ack(xChannelKcp* k, int32_t rtt) {
+    if (k->rx_srtt == 0) {
+        k->rx_srtt = rtt;
+        k->rx_rttval = rtt / 2;
+    } else {
+        int32_t delta = rtt > k->rx_srtt ? rtt - k->rx_srtt : k->rx_srtt - rtt;
+        k->rx_rttval = (3 * k->rx_rttval + delta) / 4;
+        k->rx_srtt = (7 * k->rx_srtt + rtt) / 8;
+        if (k->rx_srtt < 1) k->rx_srtt = 1;
+    }
+    int32_t var = 4 * k->rx_rttval;
+    int32_t rto = k->rx_srtt + ((int32_t)k->interval > var ? (int32_t)k->interval : var);
+    if (rto < k->rx_minrto) rto = k->rx_minrto;
+    if (rto > KCP_RTO_MAX) rto = KCP_RTO_MAX;
+    k->rx_rto = rto;
+}
+
+static void kcp_parse_una(xChannelKcp* k, uint32_t una) {
+    while (!k->snd_buf.empty() && kcp_diff(una, k->snd_buf.front()->sn) > 0) {
+        zfree(k->snd_buf.front());
+        k->snd_buf.pop_front();
+    }
+}
+
+static void kcp_parse_ack(xChannelKcp* k, uint32_t sn) {
+    if (kcp_diff(sn, k->snd_una) < 0 || kcp_diff(sn, k->snd_nxt) >= 0) return;
+    for (auto it = k->snd_buf.begin(); it != k->snd_buf.end(); ++it) {
+        if ((*it)->sn == sn) {
+            zfree(*it);
+            k->snd_buf.erase(it);
+            break;
+        }
+        if (kcp_diff(sn, (*it)->sn) < 0) break;
+    }
+}
+
+static void kcp_parse_fastack(xChannelKcp* k, uint32_t sn) {
+    if (kcp_diff(sn, k->snd_una) < 0 || kcp_diff(sn, k->snd_nxt) >= 0) return;
+    for (kcp_seg_t* seg : k->snd_buf) {
+        if (kcp_diff(sn, seg->sn) <= 0) break;
+        seg->fastack++;
+    }
+}
+
+// rcv_buf里接上的移进rcv_queue, rcv_queue满了(channel没读)先留着
+static void kcp_move_rcv(xChannelKcp* k) {
+    while (!k->rcv_buf.empty() && k->rcv_buf.front()->sn == k->rcv_nxt && k->rcv_queue.size() < k->rcv_wnd) {
+        kcp_seg_t* seg = k->rcv_buf.front();
+        k->rcv_buf.pop_front();
+        k->rcv_queue.push_back(seg);
+        k->nrcv += seg->len;
+        k->rcv_nxt++;
+    }
+}
+
+static void kcp_parse_data(xChannelKcp* k, uint32_t sn, const char* data, int len) {
+    if (!k->s) return;      // 已经close, 只回ack
+    // 从后往前找位置, 大多是按序到的
+    size_t i = k->rcv_buf.size();
+    while (i > 0 && kcp_diff(k->rcv_buf[i - 1]->sn, sn) >= 0) {
+        if (k->rcv_buf[i - 1]->sn == sn) return;    // 重复
+        i--;
+    }
+    kcp_seg_t* seg = kcp_seg_new(len);
+    seg->sn = sn;
+    seg->len = len;
+    if (len > 0) memcpy(seg->data, data, len);
+    k->rcv_buf.insert(k->rcv_buf.begin() + i, seg);
+    kcp_move_rcv(k);
+}
+
+// 一个数据报里的段, 格式不对的整个丢掉
+static int kcp_input(xChannelKcp* k, const char* data, int size) {
+    if (size < KCP_OVERHEAD) return -1;
+    uint32_t prev_una = k->snd_una;
+    uint32_t maxack = 0;
+    int flag = 0;
+    while (size >= KCP_OVERHEAD) {
+        uint32_t conv = kcp_get32(data);
+        uint8_t cmd = (uint8_t)data[4];
+        uint16_t wnd = kcp_get16(data + 6);
+        uint32_t ts = kcp_get32(data + 8);
+        uint32_t sn = kcp_get32(data + 12);
+        uint32_t una = kcp_get32(data + 16);
+        uint32_t len = kcp_get32(data + 20);
+        data += KCP_OVERHEAD;
+        size -= KCP_OVERHEAD;
+        if (conv != k->conv || len > (uint32_t)size) return -1;
+        if (cmd < KCP_CMD_PUSH || cmd > KCP_CMD_RST) return -1;
+
+        k->last_recv = k->current;
+        if (cmd == KCP_CMD_RST) {
+            k->gone = 1;
+            k->rst = 1;
+            return 0;
+        }
+        k->rmt_wnd = wnd;
+        kcp_parse_una(k, una);
+        kcp_shrink_buf(k);
+        if (cmd == KCP_CMD_ACK) {
+            int32_t rtt = kcp_diff(k->current, ts);
+            if (rtt >= 0) kcp_update_ack(k, rtt);
+            kcp_parse_ack(k, sn);
+            kcp_shrink_buf(k);
+            if (!flag || kcp_diff(sn, maxack) > 0) maxack = sn;
+            flag = 1;
+        } else if (cmd == KCP_CMD_PUSH) {
+            if (kcp_diff(sn, k->rcv_nxt + k->rcv_wnd) < 0) {
+                k->acklist.push_back({ sn, ts });
+                if (kcp_diff(sn, k->rcv_nxt) >= 0) kcp_parse_data(k, sn, data, (int)len);
+            }
+        } else if (cmd == KCP_CMD_WASK) {
+            k->probe |= KCP_ASK_TELL;
+        }
+        data += len;
+        size -= (int)len;
+    }
+    if (flag) kcp_parse_fastack(k, maxack);
+
+    // 有新确认时增长拥塞窗口: 慢启动每次加一段, 之后约每个RTT加一段
+    if (kcp_diff(k->snd_una, prev_una) > 0 && k->cwnd < k->rmt_wnd) {
+        uint32_t mss = k->mss;
+        if (k->cwnd < k->ssthresh) {
+            k->cwnd++;
+            k->incr += mss;
+        } else {
+            if (k->incr < mss) k->incr = mss;
+            k->incr += (mss * mss) / k->incr + mss / 16;
+            if ((k->cwnd + 1) * mss <= k->incr) k->cwnd = (k->incr + mss - 1) / mss;
+        }
+        if (k->cwnd > k->rmt_wnd) {
+            k->cwnd = k->rmt_wnd;
+            k->incr = k->rmt_wnd * mss;
+        }
+    }
+    return 0;
+}
+
+// ---- 定时 ----
+
+static void kcp_on_timer(void* ud);
+
+// 下一次要醒来的时间: 有数据在途时不超过interval, 否则只剩保活和超时
+static void kcp_schedule(xChannelKcp* k) {
+    if (k->gone) {
+        // 重传到上限等: 马上醒来让channel读到结束
+        if (k->s && !k->timer) k->timer = xtimer_add(1, "chan:kcp", kcp_on_timer, k, 1);
+        return;
+    }
+    uint32_t current = k->current;
+    int32_t wait;
+    if (!k->snd_buf.empty() || !k->snd_queue.empty() || k->rmt_wnd == 0) {
+        wait = (int32_t)k->interval;
+        for (kcp_seg_t* seg : k->snd_buf) {
+            int32_t d = kcp_diff(seg->resendts, current);
+            if (d < wait) wait = d;
+        }
+        if (k->rmt_wnd == 0 && k->ts_probe) {
+            int32_t d = kcp_diff(k->ts_probe, current);
+            if (d < wait) wait = d;
+        }
+    } else {
+        wait = kcp_diff(k->last_send + XKCP_PING_MS, current);
+        int32_t d = kcp_diff(k->last_recv + XKCP_IDLE_MS, current);
+        if (d < wait) wait = d;
+    }
+    if (k->lingering) {
+        int32_t d = kcp_diff(k->linger_ts, current);
+        if (d < wait) wait = d;
+    }
+    if (wait < 1) wait = 1;
+    uint32_t due = current + (uint32_t)wait;
+    if (k->timer) {
+        if (kcp_diff(k->tdue, due) <= 0) return;    // 已经排了更早的
+        xtimer_del(k->timer);
+    }
+    k->timer = xtimer_add(wait, "chan:kcp", kcp_on_timer, k, 1);
+    k->tdue = due;
+}
+
+// 发RST后释放; 对端发来的RST不用回
+static void kcp_close_out(xChannelKcp* k) {
+    for (int i = 0; !k->rst && i < KCP_RST_COPIES; i++) {
+        kcp_emit(k, KCP_CMD_RST, 0, 0, NULL, 0);
+        kcp_flush_out(k);
+    }
+    kcp_destroy(k);
+}
+
+// 服务端会话和定时器里: 有数据可读/对端关闭时让channel读, 发送队列腾出空间时让channel写
+static void kcp_notify(xChannelKcp* k) {
+    xChannel* s = k->s;
+    if (!s || !s->ev) return;
+    aeEventLoop* el = aeGetCurEventLoop();
+    if (k->nrcv > 0 || k->gone)
+        aeMarkPending(el, s->fd, s->ev, AE_READABLE);
+    if (k->wblocked && k->snd_queue.size() < 2 * k->snd_wnd)
+        aeEnableFileEvent(el, s->fd, s->ev, AE_WRITABLE);
+}
+
+// 一批数据报输入完: 立即回ack, 窗口变大了接着发
+static void kcp_after_input(xChannelKcp* k, int notify) {
+    if (k->lingering) {
+        if (k->gone || (k->snd_buf.empty() && k->snd_queue.empty())) {
+            kcp_close_out(k);
+            return;
+        }
+        kcp_flush(k);
+        kcp_schedule(k);
+        return;
+    }
+    kcp_flush(k);
+    kcp_schedule(k);
+    if (notify) kcp_notify(k);
+}
+
+static void kcp_on_timer(void* ud) {
+    xChannelKcp* k = (xChannelKcp*)ud;
+    k->timer = NULL;        // 触发中的timer不再删除
+    k->current = kcp_now();
+    if (kcp_diff(k->current, k->last_recv) >= XKCP_IDLE_MS) k->gone = 1;
+    if (k->lingering && (k->gone || kcp_diff(k->current, k->linger_ts) >= 0)) {
+        kcp_close_out(k);
+        return;
+    }
+    if (!k->gone) {
+        kcp_flush(k);
+        if (k->lingering && k->gone) {
+            kcp_close_out(k);
+            return;
+        }
+        kcp_schedule(k);
+    }
+    kcp_notify(k);
+}
+
+// ---- socket ----
+
+static void kcp_sockbuf(xSocket fd) {
+    int size = KCP_SOCKBUF;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+}
+
+// 客户端: 读connect的socket里的数据报, 返回1时到了预算还没读完
+static int kcp_sock_read(xChannelKcp* k) {
+    char buf[KCP_RBUF];
+    k->current = kcp_now();
+    int n = 0;
+    for (; n < KCP_BUDGET; n++) {
+        ssize_t r = recv(k->fd, buf, sizeof(buf), 0);
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            continue;       // 对端不可达(ICMP)等, 由重传/超时处理
+        }
+        kcp_input(k, buf, (int)r);
+    }
+    return n == KCP_BUDGET;
+}
+
+static int kcp_linger_proc(aeEventLoop* el, xSocket fd, void* privdata, int mask, int trans) {
+    (void)el; (void)fd; (void)mask; (void)trans;
+    xChannelKcp* k = (xChannelKcp*)privdata;
+    kcp_sock_read(k);
+    kcp_after_input(k, 0);
+    return AE_OK;
+}
+
+static std::string kcp_key(const struct sockaddr_storage* ss, uint32_t conv) {
+    std::string key((const char*)&conv, sizeof(conv));
+    if (ss->ss_family == AF_INET) {
+        const struct sockaddr_in* a = (const struct sockaddr_in*)ss;
+        key.append((const char*)&a->sin_port, sizeof(a->sin_port));
+        key.append((const char*)&a->sin_addr, sizeof(a->sin_addr));
+    } else if (ss->ss_family == AF_INET6) {
+        const struct sockaddr_in6* a = (const struct sockaddr_in6*)ss;
+        key.append((const char*)&a->sin6_port, sizeof(a->sin6_port));
+        key.append((const char*)&a->sin6_addr, sizeof(a->sin6_addr));
+        key.append((const char*)&a->sin6_scope_id, sizeof(a->sin6_scope_id));
+    }
+    return key;
+}
+
+// 数据报里有客户端的第一个探测或sn 0的数据段
+static int kcp_opening(const char* data, int size) {
+    while (size >= KCP_OVERHEAD) {
+        uint8_t cmd = (uint8_t)data[4];
+        uint32_t len = kcp_get32(data + 20);
+        if (cmd == KCP_CMD_WASK || (cmd == KCP_CMD_PUSH && kcp_get32(data + 12) == 0)) return 1;
+        if (len > (uint32_t)(size - KCP_OVERHEAD)) break;
+        data += KCP_OVERHEAD + len;
+        size -= KCP_OVERHEAD + (int)len;
+    }
+    return 0;
+}
+
+// 新会话: 占位fd作为channel的fd, 只靠aeMarkPending触发读, 一直可写
+static xChannelKcp* kcp_session(aeEventLoop* el, kcp_listener_t* L, uint32_t conv,
+    const struct sockaddr_storage* from, socklen_t alen, std::string& key) {
+    xChannelKcp* k = kcp_create(conv, L->fd);
+#if defined(__linux__)
+    k->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (k->efd == -1) {
+#else
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) == 0) {
+        k->efd = sv[0];
+        k->efd2 = sv[1];
+        anetNonBlock(NULL, k->efd);
+    } else {
+#endif
+        printf("kcp session fd error: %s\n", strerror(errno));
+        kcp_destroy(k);
+        return NULL;
+    }
+    memcpy(&k->addr, from, alen);
+    k->alen = alen;
+    k->listener = L;
+    k->key = key;
+    L->sessions[key] = k;
+    if (!L->faccept(el, k, L->ud)) return NULL;    // 失败时已释放
+    return k;
+}
+
+static int kcp_listen_proc(aeEventLoop* el, xSocket fd, void* privdata, int mask, int trans) {
+    (void)mask; (void)trans;
+    kcp_listener_t* L = (kcp_listener_t*)privdata;
+    char buf[KCP_RBUF];
+    struct sockaddr_storage from;
+    uint32_t now = kcp_now();
+    int n = 0;
+    for (; n < KCP_BUDGET; n++) {
+        socklen_t alen = sizeof(from);
+        ssize_t r = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr*)&from, &alen);
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            continue;
+        }
+        if (r < KCP_OVERHEAD) continue;
+        uint32_t conv = kcp_get32(buf);
+        std::string key = kcp_key(&from, conv);
+        xChannelKcp* k;
+        auto it = L->sessions.find(key);
+        if (it != L->sessions.end()) {
+            k = it->second;
+        } else {
+            // 对端收到过数据(una>0)说明是已经结束的会话, 回RST; 否则等它的探测或sn 0(可能在重传)来建会话
+            uint8_t cmd = (uint8_t)buf[4];
+            if (conv == 0 || cmd == KCP_CMD_RST) continue;
+            if (kcp_get32(buf + 16) != 0) {
+                kcp_reset(fd, (struct sockaddr*)&from, alen, conv);
+                continue;
+            }
+            if (!kcp_opening(buf, (int)r)) continue;
+            k = kcp_session(el, L, conv, &from, alen, key);
+            if (!k) continue;
+        }
+        k->current = now;
+        if (kcp_input(k, buf, (int)r) == 0 && !k->touched) {
+            k->touched = 1;
+            L->touched.push_back(k);
+        }
+    }
+    for (xChannelKcp* k : L->touched) {
+        k->touched = 0;
+        kcp_after_input(k, 1);
+    }
+    L->touched.clear();
+    if (n == KCP_BUDGET) aeMarkPending(el, fd, L->ev, AE_READABLE);
+    return AE_OK;
+}
+
+static void kcp_destroy(xChannelKcp* k) {
+    if (k->timer) xtimer_del(k->timer);
+    if (k->lev) {
+        aeDeleteFileEvent(aeGetCurEventLoop(), k->fd, k->lev, AE_READABLE);
+        anetCloseSocket(k->fd);     // close时dup出来的
+    }
+    if (k->listener) k->listener->sessions.erase(k->key);
+    if (!k->s && k->efd != -1) close(k->efd);
+    if (k->efd2 != -1) close(k->efd2);
+    kcp_seg_clear(k->snd_queue);
+    kcp_seg_clear(k->snd_buf);
+    kcp_seg_clear(k->rcv_buf);
+    kcp_seg_clear(k->rcv_queue);
+    zfree(k->obuf);
+    delete k;
+}
+
+// ---- xchannel.cpp调用 ----
+
+int _xkcp_listen(aeEventLoop* el, xSocket fd, xkcp_accept_proc* faccept, void* ud) {
+    kcp_listener_t* L = new kcp_listener_t();
+    L->fd = fd;
+    L->ev = NULL;
+    L->faccept = faccept;
+    L->ud = ud;
+    kcp_sockbuf(fd);
+    if (aeCreateFileEvent(el, fd, AE_READABLE, kcp_listen_proc, L, &L->ev) == AE_ERR) {
+        delete L;
+        return AE_ERR;
+    }
+    return AE_OK;
+}
+
+xChannelKcp* _xkcp_connect(xSocket fd) {
+    static uint32_t seq = 0;
+    uint32_t conv = 0;
+    while (conv == 0)
+        conv = (uint32_t)time_get_us() ^ ((uint32_t)getpid() << 16) ^ (++seq * 2654435761u);
+    kcp_sockbuf(fd);
+    return kcp_create(conv, fd);
+}
+
+xSocket _xkcp_fd(xChannelKcp* k) {
+    return k->listener ? (xSocket)k->efd : k->fd;
+}
+
+void _xkcp_destroy(xChannelKcp* k) {
+    if (!k) return;
+    if (!k->listener) anetCloseSocket(k->fd);   // 客户端还没挂上, socket一起关
+    kcp_destroy(k);
+}
+
+int _xkcp_attach(aeEventLoop* el, xChannel* s, xChannelKcp* k) {
+    (void)el;
+    s->kcp = k;
+    k->s = s;
+    s->zcmin = 0;
+    k->current = kcp_now();
+    if (!k->listener) k->probe |= KCP_ASK_SEND;     // 让服务端建会话
+    kcp_flush(k);
+    kcp_schedule(k);
+    return AE_OK;
+}
+
+void _xkcp_free(xChannel* s) {
+    xChannelKcp* k = s->kcp;
+    if (!k) return;
+    s->kcp = NULL;
+    k->s = NULL;
+    k->efd = -1;    // 归channel关
+    kcp_seg_clear(k->rcv_buf);
+    kcp_seg_clear(k->rcv_queue);
+    k->nrcv = 0;
+    k->current = kcp_now();
+    if (k->gone || (k->snd_buf.empty() && k->snd_queue.empty())) {
+        kcp_close_out(k);
+        return;
+    }
+    // 还有没确认的数据: 继续重传到确认完或超时再发RST
+    if (!k->listener) {
+        aeEventLoop* el = aeGetCurEventLoop();
+        xSocket fd = el ? dup(k->fd) : -1;     // channel马上关socket
+        if (fd == -1 || aeCreateFileEvent(el, fd, AE_READABLE, kcp_linger_proc, k, &k->lev) == AE_ERR) {
+            k->lev = NULL;
+            if (fd != -1) anetCloseSocket(fd);
+            kcp_close_out(k);
+            return;
+        }
+        k->fd = fd;
+    }
+    k->lingering = 1;
+    k->linger_ts = k->current + XKCP_LINGER_MS;
+    kcp_flush(k);
+    kcp_schedule(k);
+}
+
+int _xkcp_input(xChannel* s) {
+    xChannelKcp* k = s->kcp;
+    if (k->listener) return 0;      // 服务端由监听socket分发
+    int more = kcp_sock_read(k);
+    kcp_after_input(k, 0);
+    return more;
+}
+
+int _xkcp_wblocked(xChannel* s) {
+    return s->kcp->wblocked;
+}
+
+int _xkcp_gone(xChannel* s) {
+    return s->kcp->gone;
+}
+
+int _xkcp_pending(xChannel* s) {
+    return s->kcp->nrcv;
+}
+
+int _xkcp_recv(xChannel* s, char* buf, int len) {
+    xChannelKcp* k = s->kcp;
+    if (k->nrcv == 0) return k->gone ? 0 : ANET_EAGAIN;
+    int full = k->rcv_queue.size() >= k->rcv_wnd;
+    int n = 0;
+    while (n < len && !k->rcv_queue.empty()) {
+        kcp_seg_t* seg = k->rcv_queue.front();
+        int c = seg->len - seg->off;
+        if (c > len - n) c = len - n;
+        memcpy(buf + n, seg->data + seg->off, c);
+        seg->off += c;
+        n += c;
+        if (seg->off == seg->len) {
+            k->rcv_queue.pop_front();
+            zfree(seg);
+        }
+    }
+    k->nrcv -= n;
+    kcp_move_rcv(k);
+    if (full && k->rcv_queue.size() < k->rcv_wnd && !k->gone) {
+        // 窗口从0打开, 马上告诉对端
+        k->probe |= KCP_ASK_TELL;
+        k->current = kcp_now();
+        kcp_flush(k);
+        kcp_schedule(k);
+    }
+    return n;
+}
+
+int _xkcp_sendv(xChannel* s, char** bufs, int* lens, int count) {
+    xChannelKcp* k = s->kcp;
+    if (k->gone) {
+        k->wblocked = 1;    // 不会再发出去, 等读到结束关闭
+        return ANET_EAGAIN;
+    }
+    int mss = (int)k->mss;
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        const char* p = bufs[i];
+        int left = lens[i];
+        while (left > 0) {
+            kcp_seg_t* seg = k->snd_queue.empty() ? NULL : k->snd_queue.back();
+            if (!seg || seg->len == mss) {
+                if (k->snd_queue.size() >= 2 * k->snd_wnd) goto full;
+                seg = kcp_seg_new(mss);
+                k->snd_queue.push_back(seg);
+            }
+            int c = mss - seg->len;
+            if (c > left) c = left;
+            memcpy(seg->data + seg->len, p, c);
+            seg->len += c;
+            p += c;
+            left -= c;
+            total += c;
+        }
+    }
+full:
+    if (total == 0) {
+        k->wblocked = 1;
+        return ANET_EAGAIN;
+    }
+    k->wblocked = 0;
+    k->current = kcp_now();
+    kcp_flush(k);
+    kcp_schedule(k);
+    return total;
+}
+
+int xchannel_kcp_nodelay(xChannel* s, int nodelay, int interval, int resend, int nc) {
+    if (!s) {
+        if (nodelay >= 0) _nodelay = nodelay;
+        if (interval >= 0) _interval = interval;
+        if (resend >= 0) _resend = resend;
+        if (nc >= 0) _nc = nc;
+        return AE_OK;
+    }
+    if (!s->kcp) return AE_ERR;
+    kcp_set_nodelay(s->kcp, nodelay, interval, resend, nc);
+    return AE_OK;
+}
+
+int xchannel_kcp_wndsize(xChannel* s, int sndwnd, int rcvwnd) {
+    if (!s) {
+        if (sndwnd > 0) _sndwnd = sndwnd;
+        if (rcvwnd > 0) _rcvwnd = rcvwnd;
+        return AE_OK;
+    }
+    if (!s->kcp) return AE_ERR;
+    if (sndwnd > 0) s->kcp->snd_wnd = (uint32_t)sndwnd;
+    if (rcvwnd > 0) s->kcp->rcv_wnd = (uint32_t)rcvwnd;
+    return AE_OK;
+}
+
+#else
+
+int xchannel_kcp_nodelay(xChannel* s, int nodelay, int interval, int resend, int nc) {
+    (void)s; (void)nodelay; (void)interval; (void)resend; (void)nc;
+    return AE_ERR;
+}
+
+int xchannel_kcp_wndsize(xChannel* s, int sndwnd, int rcvwnd) {
+    (void)s; (void)sndwnd; (void)rcvwnd;
+    return AE_ERR;
+}
+
+#endif
@@ -0,0 +1,51 @@
+// xchannel_kcp.h
+#ifndef _XCHANNEL_KCP_H
+#define _XCHANNEL_KCP_H
+#include "xchannel.h"
+
+// UDP上的可靠流(KCP式ARQ): 每个收到的段单独ack(选择确认), una累计确认, 被后面的ack跨过resend次就快速重传,
+// RTO按平滑RTT算, 可关拥塞控制. 对上是字节流, 分帧/RPC(xhandle_on_pack, xrpc_pcall)/send系列和TCP channel一样.
+// 重传/探测/保活由当前线程的xtimer驱动, 收到数据后立即回ack.
+// 客户端channel的fd就是connect的UDP socket; 服务端一个UDP socket按(对端地址, conv)分给会话, 会话的fd是占位的eventfd.
+// 对端close时发RST, 还没确认的数据最多再重传XKCP_LINGER_MS; 对端XKCP_IDLE_MS没有任何包算断开.
+// 只支持就绪模式(epoll/kqueue/select), 其他返回失败. 不支持splice转发和zerocopy
+#if !defined(_WIN32) && !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+#define XCHANNEL_KCP
+#endif
+
+#define XKCP_MTU        1400        // 单个UDP数据报上限(含24字节段头)
+#define XKCP_WND        128         // 默认收发窗口(段)
+#define XKCP_PING_MS    10000       // 这么久没发过包就发一个窗口探测当保活
+#define XKCP_IDLE_MS    30000       // 这么久没收到包算对端断开
+#define XKCP_LINGER_MS  3000        // close后继续重传没确认数据的时限
+
+struct xChannelKcp;
+
+int         xchannel_listen_kcp(int port, char* bindaddr, xchannel_proc* proc, xchannel_proc* on_close, void* userdata, xProto proto = xProto::xproto_blp4);
+// 不等握手, 马上返回channel(发出一个探测让服务端建会话); 服务端不在时XKCP_IDLE_MS后关闭
+xChannel*   xchannel_conn_kcp(char* addr, int port, xchannel_proc* on_pack, xchannel_proc* on_close, void* userdata, xProto proto = xProto::xproto_blp4);
+// 普通模式(0, 40, 0, 0)是默认值, 低延迟(1, 10, 2, 1).
+// nodelay: 0 RTO下限100ms, 超时翻倍; 1 下限30ms, 超时增加一半; 2 同1, 增加的是平滑RTO的一半
+// interval: 没确认数据时多久检查一次重传(ms, 10~5000), 也是RTO计算里的时钟粒度
+// resend: 被后面的ack跨过多少次就快速重传, 0关闭. nc: 1关闭拥塞控制, 只受收发窗口限制.
+// s为NULL时设置之后新建channel的默认值(全进程共用, 在启动网络线程前设置), 不是KCP channel返回AE_ERR
+int         xchannel_kcp_nodelay(xChannel* s, int nodelay, int interval, int resend, int nc);
+// 收发窗口(段数), <=0不变, s为NULL时同上设默认值. 发送队列到发送窗口的两倍时send阻塞(同写满), 等ack腾出空间
+int         xchannel_kcp_wndsize(xChannel* s, int sndwnd, int rcvwnd);
+
+// 内部: xchannel.cpp的握手和读写路径调用, 返回值同anetRecv/anetSend(>0字节, 0对端关闭, ANET_EAGAIN, ANET_ERR)
+typedef xChannel* xkcp_accept_proc(aeEventLoop* el, struct xChannelKcp* k, void* ud);
+int         _xkcp_listen(aeEventLoop* el, xSocket fd, xkcp_accept_proc* faccept, void* ud);
+struct xChannelKcp* _xkcp_connect(xSocket fd);         // 客户端: fd是connect的UDP socket
+xSocket     _xkcp_fd(struct xChannelKcp* k);           // 作为channel的fd
+void        _xkcp_destroy(struct xChannelKcp* k);      // 还没挂到channel上时释放
+int         _xkcp_attach(aeEventLoop* el, xChannel* s, struct xChannelKcp* k);
+void        _xkcp_free(xChannel* s);
+int         _xkcp_input(xChannel* s);                  // 客户端读socket里的数据报, 返回1时还有没读的
+int         _xkcp_wblocked(xChannel* s);               // 上次写时发送队列满, 在等ack
+int         _xkcp_gone(xChannel* s);                   // 对端已关闭/超时, 收到的读完就结束
+int         _xkcp_pending(xChannel* s);                // 已按序收到还没读的字节
+int         _xkcp_recv(xChannel* s, char* buf, int len);
+int         _xkcp_sendv(xChannel* s, char** bufs, int* lens, int count);
+
+#endif
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <limits.h>
 #include "xchannel.h"
 #include "xchannel.inl"
 #include "xpack_redis.h"
@@ -36,8 +37,8 @@ static int blp2_write_header(xChannel* channel, size_t data_len) {
     if (!channel || !channel->wbuf) {
         return PACKET_FD_INVALD;
     }
-    // 检查缓冲区空间
-    if (channel->wlen - (int)(channel->wpos - channel->wbuf) < (int)data_len + 2) {
+    // 只检查包头的空间, 数据可能转交给channel另外排队
+    if (channel->wlen - (int)(channel->wpos - channel->wbuf) < 2) {
         return PACKET_BUF_LEAK;
     }
 
@@ -99,8 +100,8 @@ static int blp4_write_header(xChannel* channel, size_t data_len) {
         return PACKET_FD_INVALD;
     }
 
-    // 检查缓冲区空间
-    if (channel->wlen - (channel->wpos - channel->wbuf) < (int)data_len + 4) {
+    // 只检查包头的空间, 数据可能转交给channel另外排队
+    if (channel->wlen - (channel->wpos - channel->wbuf) < 4) {
         return PACKET_BUF_LEAK;
     }
 
@@ -137,63 +138,119 @@ static int blp4_read_header(xChannel* channel, size_t* data_len) {
     return 4;
 }
 
-// ==================== RESP2协议实现 ====================
-
-static xChannelErrCode resp2_check_complete(xChannel* channel) {
-    if (!channel)
-        return PACKET_FD_INVALD;
-    if (redis::redis_check_complete(channel->rbuf, (int)(channel->rpos-channel->rbuf), RedisProtocol::RESP2))
-        return PACKET_SUCCESS;
-    return PACKET_INCOMPLETE;
-}
-
-static int resp2_write_header(xChannel* channel, size_t data_len) {
-    if (!channel || !channel->wbuf) {
-        return PACKET_FD_INVALD;
-    }
-
-    // 检查缓冲区空间
-    if (channel->wlen - (channel->wpos - channel->wbuf) < (int)data_len + 4) {
-        return PACKET_BUF_LEAK;
+// ==================== RESP2/RESP3协议实现 ====================
+// 增量分帧: 一次切出一个完整回复, 从channel->fscan接着扫新到的字节, 大的管道回复不再每次从头扫.
+// fstate[0]: 还差的元素数(含嵌套的), fstate[1]: bulk还要跳过的字节(含\r\n). 不支持RESP3的流式类型(?)
+
+static int resp_int(const char* b, const char* e, long long* out) {
+    long long v = 0;
+    int neg = 0;
+    if (b < e && *b == '-') { neg = 1; b++; }
+    if (b == e) return -1;
+    for (; b < e; b++) {
+        if (*b < '0' || *b > '9' || v > INT_MAX) return -1;
+        v = v * 10 + (*b - '0');
     }
+    *out = neg ? -v : v;
     return 0;
 }
 
-static int resp2_read_header(xChannel* channel, size_t* data_len) {
-    if (!channel || !channel->rbuf || !channel->rpos || !data_len) {
-        return PACKET_FD_INVALD;
+// 返回一个完整回复的长度, 不完整返回0, 格式错误返回-1
+static int resp_frame(xChannel* channel) {
+    const char* p = channel->rbuf;
+    int len = (int)(channel->rpos - channel->rbuf);
+    int off = channel->fscan;
+    int need = channel->fstate[0];
+    int skip = channel->fstate[1];
+    if (off == 0 && need == 0) need = 1;   // 新的回复
+
+    for (;;) {
+        if (skip > 0) {
+            if (len - off < skip) {
+                skip -= len - off;
+                off = len;
+                break;
+            }
+            off += skip;
+            skip = 0;
+        }
+        if (need == 0) break;
+
+        // 行不完整时下次从行首再扫, 只多扫这一行
+        const char* eol = (const char*)memchr(p + off, '\n', len - off);
+        if (!eol) break;
+        int next = (int)(eol - p) + 1;
+        if (next - off < 3 || eol[-1] != '\r') return -1;
+
+        long long n = 0;
+        char type = p[off];
+        if (type == '$' || type == '!' || type == '=' || type == '*' || type == '~' ||
+            type == '>' || type == '%' || type == '|') {
+            if (resp_int(p + off + 1, eol - 1, &n) != 0 || n < -1 || n > (INT_MAX - 2) / 2)
+                return -1;
+        }
+        switch (type) {
+        case '+': case '-': case ':': case '_': case '#': case ',': case '(':
+            need--;
+            break;
+        case '$': case '!': case '=':   // bulk, -1为null
+            need--;
+            if (n >= 0) skip = (int)n + 2;
+            break;
+        case '*': case '~': case '>':
+            need--;
+            if (n > 0) need += (int)n;
+            break;
+        case '%':
+            need--;
+            if (n > 0) need += (int)(2 * n);
+            break;
+        case '|':                       // 属性后面还跟着真正的值, 不算一个元素
+            if (n > 0) need += (int)(2 * n);
+            break;
+        default:
+            return -1;
+        }
+        if (need < 0 || need > INT_MAX / 4) return -1;
+        off = next;
     }
-    *data_len = (int)(channel->rpos - channel->rbuf);
-    return 0;
-}
 
-// ==================== RESP3协议实现 ====================
+    // 完整时也保留状态, fpack这次没取走的话下次直接返回
+    channel->fscan = off;
+    channel->fstate[0] = need;
+    channel->fstate[1] = skip;
+    return (need == 0 && skip == 0) ? off : 0;
+}
 
-static xChannelErrCode resp3_check_complete(xChannel* channel) {
+static xChannelErrCode resp_check_complete(xChannel* channel) {
     if (!channel)
         return PACKET_FD_INVALD;
-    if (redis::redis_check_complete(channel->rbuf, (int)(channel->rpos - channel->rbuf), RedisProtocol::RESP3))
-        return PACKET_SUCCESS;
-    return PACKET_INCOMPLETE;
+    int n = resp_frame(channel);
+    if (n < 0) return PACKET_INVALID;
+    return n > 0 ? PACKET_SUCCESS : PACKET_INCOMPLETE;
 }
 
-static int resp3_write_header(xChannel* channel, size_t data_len) {
+static int resp_write_header(xChannel* channel, size_t data_len) {
     if (!channel || !channel->wbuf) {
         return PACKET_FD_INVALD;
     }
 
-    // 检查缓冲区空间
-    if (channel->wlen - (channel->wpos - channel->wbuf) < (int)data_len + 4) {
+    // 检查缓冲区空间, 没有包头
+    if (channel->wlen - (channel->wpos - channel->wbuf) < (int)data_len) {
         return PACKET_BUF_LEAK;
     }
     return 0;
 }
 
-static int resp3_read_header(xChannel* channel, size_t* data_len) {
+// 每次交给fpack一个完整的回复
+static int resp_read_header(xChannel* channel, size_t* data_len) {
     if (!channel || !channel->rbuf || !channel->rpos || !data_len) {
         return PACKET_FD_INVALD;
     }
-    *data_len = (int)(channel->rpos - channel->rbuf);
+    int n = resp_frame(channel);
+    if (n == 0) return PACKET_INCOMPLETE;
+    if (n < 0) return PACKET_INVALID;
+    *data_len = n;
     return 0;
 }
 
@@ -272,9 +329,133 @@ static int nats_read_header(xChannel* channel, size_t* data_len) {
     return 0;
 }
 
+// ==================== VARINT协议实现 ====================
+// 长度字段是LEB128无符号varint(protobuf分隔格式), 1~5字节, 小包的包头只要1字节
+
+static int varint_read_header(xChannel* channel, size_t* data_len) {
+    if (!channel || !channel->rbuf || !channel->rpos || !data_len) {
+        return PACKET_FD_INVALD;
+    }
+
+    int len = (int)(channel->rpos - channel->rbuf);
+    uint8_t* b = (uint8_t*)channel->rbuf;
+    uint32_t pkg_len = 0;
+    for (int i = 0; i < 5; i++) {
+        if (i >= len) return PACKET_INCOMPLETE;
+        pkg_len |= (uint32_t)(b[i] & 0x7F) << (7 * i);
+        if (b[i] & 0x80) continue;
+        if (pkg_len > (uint32_t)(INT_MAX - 5)) return PACKET_INVALID;
+        if (len < (int)pkg_len + i + 1) return PACKET_INCOMPLETE;
+        *data_len = pkg_len;
+        return i + 1;
+    }
+    return PACKET_INVALID;
+}
+
+static xChannelErrCode varint_check_complete(xChannel* channel) {
+    size_t data_len = 0;
+    int ret = varint_read_header(channel, &data_len);
+    return ret < 0 ? (xChannelErrCode)ret : PACKET_SUCCESS;
+}
+
+static int varint_write_header(xChannel* channel, size_t data_len) {
+    if (!channel || !channel->wbuf) {
+        return PACKET_FD_INVALD;
+    }
+
+    uint8_t b[5];
+    int n = 0;
+    do {
+        b[n] = data_len & 0x7F;
+        data_len >>= 7;
+        if (data_len) b[n] |= 0x80;
+        n++;
+    } while (data_len && n < 5);
+    if (channel->wlen - (int)(channel->wpos - channel->wbuf) < n) {
+        return PACKET_BUF_LEAK;
+    }
+    memcpy(channel->wpos, b, n);
+    channel->wpos += n;
+    return n;
+}
+
+// ==================== 定长包头协议(xchannel_proto_fixed注册) ====================
+
+typedef struct {
+    int hdr_size;       // 包头字节数
+    int len_off;        // 长度字段在包头里的偏移
+    int len_bytes;      // 长度字段字节数, 1~4
+    int flags;          // XPROTO_*
+} FixedHeader;
+
+static FixedHeader _fixed_hdrs[XCHANNEL_PROTO_MAX];
+
+static int fixed_read_header(xChannel* channel, size_t* data_len) {
+    if (!channel || !channel->rbuf || !channel->rpos || !data_len) {
+        return PACKET_FD_INVALD;
+    }
+
+    const FixedHeader* f = &_fixed_hdrs[channel->pproto];
+    int len = (int)(channel->rpos - channel->rbuf);
+    if (len < f->hdr_size) {
+        return PACKET_INCOMPLETE;
+    }
+
+    uint8_t* b = (uint8_t*)channel->rbuf + f->len_off;
+    uint32_t v = 0;
+    for (int i = 0; i < f->len_bytes; i++)
+        v = (v << 8) | b[(f->flags & XPROTO_LEN_LE) ? f->len_bytes - 1 - i : i];
+    long long body = (f->flags & XPROTO_LEN_WHOLE) ? (long long)v - f->hdr_size : (long long)v;
+    if (body < 0 || body > INT_MAX - f->hdr_size) {
+        return PACKET_INVALID;
+    }
+    if (len < f->hdr_size + (int)body) {
+        return PACKET_INCOMPLETE;
+    }
+
+    if (f->flags & XPROTO_KEEP_HDR) {
+        *data_len = f->hdr_size + (size_t)body;
+        return 0;
+    }
+    *data_len = (size_t)body;
+    return f->hdr_size;
+}
+
+static xChannelErrCode fixed_check_complete(xChannel* channel) {
+    size_t data_len = 0;
+    int ret = fixed_read_header(channel, &data_len);
+    return ret < 0 ? (xChannelErrCode)ret : PACKET_SUCCESS;
+}
+
+static int fixed_write_header(xChannel* channel, size_t data_len) {
+    if (!channel || !channel->wbuf) {
+        return PACKET_FD_INVALD;
+    }
+
+    // 包头由调用方和数据一起写
+    const FixedHeader* f = &_fixed_hdrs[channel->pproto];
+    if (f->flags & XPROTO_KEEP_HDR) {
+        return 0;
+    }
+    if (channel->wlen - (int)(channel->wpos - channel->wbuf) < f->hdr_size) {
+        return PACKET_BUF_LEAK;
+    }
+
+    uint32_t v = (uint32_t)((f->flags & XPROTO_LEN_WHOLE) ? data_len + f->hdr_size : data_len);
+    uint8_t* b = (uint8_t*)channel->wpos;
+    memset(b, 0, f->hdr_size);
+    for (int i = 0; i < f->len_bytes; i++) {
+        int k = (f->flags & XPROTO_LEN_LE) ? i : f->len_bytes - 1 - i;
+        b[f->len_off + k] = (uint8_t)(v >> (8 * i));
+    }
+    channel->wpos += f->hdr_size;
+    return f->hdr_size;
+}
+
 // ==================== 全局操作对象数组 ====================
+// 内置协议在前, 之后是运行时注册的; 注册只在启动网络线程前做, 读不加锁
 
-const PacketOps _g_pack_ops[xproto_max] = {
+static PacketOps _g_pack_ops[XCHANNEL_PROTO_MAX] = {
     // xproto_blp2 = 0
     {
         blp2_check_complete,    // check_complete
@@ -293,17 +474,17 @@ const PacketOps _g_pack_ops[xproto_max] = {
     },
     // xproto_crlf_resp2 = 2
     {
-        resp2_check_complete,    // check_complete
-        resp2_write_header,      // write_header
-        resp2_read_header,       // read_header
+        resp_check_complete,     // check_complete
+        resp_write_header,       // write_header
+        resp_read_header,        // read_header
         0,                       // header_size
         "RESP2"                  // proto_name
     },
     // xproto_crlf_resp3 = 3
     {
-        resp3_check_complete,    // check_complete
-        resp3_write_header,      // write_header
-        resp3_read_header,       // read_header
+        resp_check_complete,     // check_complete
+        resp_write_header,       // write_header
+        resp_read_header,        // read_header
         0,                       // header_size
         "RESP3"                  // proto_name
     },
@@ -315,10 +496,51 @@ const PacketOps _g_pack_ops[xproto_max] = {
         0,                      // header_size
         "NATS"                  // proto_name
     },
+    // xproto_varint = 5
+    {
+        varint_check_complete,  // check_complete
+        varint_write_header,    // write_header
+        varint_read_header,     // read_header
+        5,                      // header_size, 最长的包头, 预留空间用
+        "VARINT"                // proto_name
+    },
 };
+static int _g_pack_count = xproto_max;
+
+int xchannel_proto_register(const PacketOps* ops) {
+    if (!ops || !ops->read_header || _g_pack_count >= XCHANNEL_PROTO_MAX) {
+        return -1;
+    }
+    _g_pack_ops[_g_pack_count] = *ops;
+    return _g_pack_count++;
+}
+
+int xchannel_proto_fixed(const char* name, int hdr_size, int len_off, int len_bytes, int flags) {
+    if (len_bytes < 1 || len_bytes > 4 || len_off < 0 || len_off + len_bytes > hdr_size) {
+        return -1;
+    }
+    if (_g_pack_count >= XCHANNEL_PROTO_MAX) {
+        return -1;
+    }
+
+    FixedHeader* f = &_fixed_hdrs[_g_pack_count];
+    f->hdr_size = hdr_size;
+    f->len_off = len_off;
+    f->len_bytes = len_bytes;
+    f->flags = flags;
+
+    PacketOps ops = {
+        fixed_check_complete,
+        fixed_write_header,
+        fixed_read_header,
+        (size_t)((flags & XPROTO_KEEP_HDR) ? 0 : hdr_size),
+        name ? name : "FIXED"
+    };
+    return xchannel_proto_register(&ops);
+}
 
 const PacketOps* _xchannel_get_ops(xChannel* channel) {
-    if (!channel || channel->pproto >= xproto_max) {
+    if (!channel || (int)channel->pproto < 0 || (int)channel->pproto >= _g_pack_count) {
         return NULL;
     }
     return &_g_pack_ops[channel->pproto];
@@ -0,0 +1,362 @@
+// xchannel_shm.cpp
+#include "xchannel_shm.h"
+#include "anet.h"
+#include "zmalloc.h"
+
+#ifdef XCHANNEL_SHM
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <atomic>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#define SHM_MAGIC       0x4d485358u     // "XSHM"
+#define SHM_VERSION     1
+#define SHM_HDR_SIZE    4096            // 头一页放两个环的游标, 数据区从这里开始
+#define SHM_RING_MIN    (64*1024)
+#define SHM_RING_MAX    (1024*1024*1024)
+
+// 一个方向的环. head/tail单调增长, 取模定位; 两端各写自己的游标, 分在不同cache line
+typedef struct shm_ring_t {
+    alignas(64) std::atomic<uint64_t> tail;     // 写端推进
+    std::atomic<uint32_t> want_space;           // 写端环满在等, 读端消费后敲写端的门铃
+    alignas(64) std::atomic<uint64_t> head;     // 读端推进
+    std::atomic<uint32_t> need_wake;            // 读端读空在等, 写端写入后敲读端的门铃
+} shm_ring_t;
+
+typedef struct shm_hdr_t {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    rsize;                          // 每个环的字节数, 2的幂
+    alignas(64) shm_ring_t ring[2];             // [0] 连接端->监听端, [1] 监听端->连接端
+} shm_hdr_t;
+
+static_assert(sizeof(shm_hdr_t) <= SHM_HDR_SIZE, "shm header too large");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shm ring needs lock-free 64-bit atomics");
+
+// 握手消息, 随SCM_RIGHTS带上[memfd, 监听端门铃, 连接端门铃]
+typedef struct shm_hello_t {
+    uint32_t    magic;
+    uint32_t    rsize;
+} shm_hello_t;
+
+struct xChannelShm {
+    shm_hdr_t*  hdr;
+    size_t      mapsize;
+    shm_ring_t* rx;
+    shm_ring_t* tx;
+    char*       rdata;
+    char*       tdata;
+    uint64_t    mask;           // rsize - 1
+    int         efd;            // 自己的门铃, 交给channel做fd
+    int         peer;           // 对端的门铃
+    xSocket     ctl;            // 握手的unix socket, 对端关闭/退出时读到EOF
+    aeFileEvent* ctlev;
+    xChannel*   s;
+    uint8_t     wblocked;
+    uint8_t     gone;
+};
+
+static void shm_bell(int efd) {
+    uint64_t one = 1;
+    // 计数满(EAGAIN)时对端本来就可读
+    while (write(efd, &one, sizeof(one)) == -1 && errno == EINTR) {}
+}
+
+static xChannelShm* shm_map(int memfd, uint32_t rsize, int efd, int peer, xSocket ctl, int side, int init) {
+    size_t mapsize = SHM_HDR_SIZE + (size_t)rsize * 2;
+    void* p = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (p == MAP_FAILED) {
+        printf("shm mmap %zu error: %s\n", mapsize, strerror(errno));
+        return NULL;
+    }
+    shm_hdr_t* hdr = (shm_hdr_t*)p;
+    if (init) {
+        hdr->magic = SHM_MAGIC;
+        hdr->version = SHM_VERSION;
+        hdr->rsize = rsize;
+        for (int i = 0; i < 2; i++) {
+            shm_ring_t* r = &hdr->ring[i];
+            r->tail.store(0, std::memory_order_relaxed);
+            r->head.store(0, std::memory_order_relaxed);
+            r->want_space.store(0, std::memory_order_relaxed);
+            r->need_wake.store(1, std::memory_order_relaxed);   // 对端还没开始读, 第一次写就敲门铃
+        }
+    } else if (hdr->magic != SHM_MAGIC || hdr->version != SHM_VERSION || hdr->rsize != rsize) {
+        printf("shm bad header, magic %x version %u size %u\n", hdr->magic, hdr->version, hdr->rsize);
+        munmap(p, mapsize);
+        return NULL;
+    }
+
+    xChannelShm* sh = (xChannelShm*)zmalloc(sizeof(xChannelShm));
+    memset(sh, 0, sizeof(xChannelShm));
+    sh->hdr = hdr;
+    sh->mapsize = mapsize;
+    sh->rx = &hdr->ring[side ? 0 : 1];
+    sh->tx = &hdr->ring[side ? 1 : 0];
+    sh->rdata = (char*)p + SHM_HDR_SIZE + (size_t)rsize * (side ? 0 : 1);
+    sh->tdata = (char*)p + SHM_HDR_SIZE + (size_t)rsize * (side ? 1 : 0);
+    sh->mask = rsize - 1;
+    sh->efd = efd;
+    sh->peer = peer;
+    sh->ctl = ctl;
+    return sh;
+}
+
+xChannelShm* _xshm_connect(xSocket ctl, int ring_size) {
+    uint32_t rsize = SHM_RING_MIN;
+    if (ring_size <= 0) ring_size = XCHANNEL_SHM_RING;
+    while ((int)rsize < ring_size && rsize < SHM_RING_MAX) rsize <<= 1;
+
+    int memfd = memfd_create("xchannel_shm", MFD_CLOEXEC);
+    if (memfd == -1) {
+        printf("shm memfd_create error: %s\n", strerror(errno));
+        return NULL;
+    }
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int peer = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    xChannelShm* sh = NULL;
+    if (efd == -1 || peer == -1 || ftruncate(memfd, SHM_HDR_SIZE + (off_t)rsize * 2) == -1) {
+        printf("shm setup error: %s\n", strerror(errno));
+        goto fail;
+    }
+    sh = shm_map(memfd, rsize, efd, peer, ctl, 0, 1);
+    if (!sh) goto fail;
+
+    {
+        shm_hello_t hello = { SHM_MAGIC, rsize };
+        int fds[3] = { memfd, peer, efd };
+        char ctrl[CMSG_SPACE(sizeof(fds))];
+        struct iovec iov = { &hello, sizeof(hello) };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        memset(ctrl, 0, sizeof(ctrl));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(c), fds, sizeof(fds));
+        ssize_t n;
+        while ((n = sendmsg(ctl, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR) {}
+        if (n != (ssize_t)sizeof(hello)) {
+            printf("shm send hello error: %s\n", n < 0 ? strerror(errno) : "short write");
+            goto fail;
+        }
+    }
+    close(memfd);       // 映射还在, 对端收到的是它的副本
+    return sh;
+
+fail:
+    if (sh) {
+        sh->ctl = -1;   // 握手socket由调用方关
+        _xshm_destroy(sh);
+    } else {
+        if (efd != -1) close(efd);
+        if (peer != -1) close(peer);
+    }
+    close(memfd);
+    return NULL;
+}
+
+int _xshm_accept(xSocket ctl, xChannelShm** out) {
+    shm_hello_t hello;
+    int fds[3] = { -1, -1, -1 };
+    char ctrl[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { &hello, sizeof(hello) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    ssize_t n;
+    while ((n = recvmsg(ctl, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR) {}
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return ANET_EAGAIN;
+
+    int nfds = 0;
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+            nfds = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            if (nfds > 3) nfds = 3;
+            memcpy(fds, CMSG_DATA(c), nfds * sizeof(int));
+        }
+    }
+    xChannelShm* sh = NULL;
+    struct stat st;
+    if (n != (ssize_t)sizeof(hello) || nfds != 3 || hello.magic != SHM_MAGIC ||
+        hello.rsize < SHM_RING_MIN || hello.rsize > SHM_RING_MAX || (hello.rsize & (hello.rsize - 1)) ||
+        fstat(fds[0], &st) == -1 || st.st_size < (off_t)(SHM_HDR_SIZE + (size_t)hello.rsize * 2)) {
+        printf("shm bad hello on fd %d\n", (int)ctl);
+    } else {
+        sh = shm_map(fds[0], hello.rsize, fds[1], fds[2], ctl, 1, 0);
+    }
+    if (fds[0] != -1) close(fds[0]);
+    if (!sh) {
+        if (fds[1] != -1) close(fds[1]);
+        if (fds[2] != -1) close(fds[2]);
+        return ANET_ERR;
+    }
+    anetNonBlock(NULL, sh->efd);
+    anetNonBlock(NULL, sh->peer);
+    *out = sh;
+    return ANET_OK;
+}
+
+xSocket _xshm_fd(xChannelShm* sh) {
+    return sh->efd;
+}
+
+void _xshm_destroy(xChannelShm* sh) {
+    if (!sh) return;
+    if (sh->ctlev) aeDeleteFileEvent(aeGetCurEventLoop(), sh->ctl, sh->ctlev, AE_READABLE);
+    if (sh->ctl != (xSocket)-1) anetCloseSocket(sh->ctl);
+    if (!sh->s && sh->efd != -1) close(sh->efd);     // 挂上后归channel关
+    if (sh->peer != -1) close(sh->peer);
+    munmap(sh->hdr, sh->mapsize);
+    zfree(sh);
+}
+
+// 握手socket只用来发现对端关闭: 读到EOF后让channel把环里剩下的读完再结束
+static int shm_ctl_proc(aeEventLoop* el, xSocket fd, void* privdata, int mask, int trans) {
+    (void)mask; (void)trans;
+    xChannelShm* sh = (xChannelShm*)privdata;
+    char buf[64];
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n > 0) continue;
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return AE_OK;
+        break;
+    }
+    sh->gone = 1;
+    aeDeleteFileEvent(el, fd, sh->ctlev, AE_READABLE);
+    sh->ctlev = NULL;
+    xChannel* s = sh->s;
+    if (s && s->ev) aeMarkPending(el, s->fd, s->ev, AE_READABLE);
+    return AE_OK;
+}
+
+int _xshm_attach(aeEventLoop* el, xChannel* s, xChannelShm* sh) {
+    s->shm = sh;
+    sh->s = s;
+    s->zcmin = 0;
+    if (aeCreateFileEvent(el, sh->ctl, AE_READABLE, shm_ctl_proc, sh, &sh->ctlev) == AE_ERR) {
+        sh->ctlev = NULL;
+        return AE_ERR;
+    }
+    return AE_OK;
+}
+
+void _xshm_free(xChannel* s) {
+    if (!s->shm) return;
+    _xshm_destroy(s->shm);
+    s->shm = NULL;
+}
+
+void _xshm_ack(xChannel* s) {
+    uint64_t v;
+    while (read(s->shm->efd, &v, sizeof(v)) == -1 && errno == EINTR) {}
+}
+
+int _xshm_wblocked(xChannel* s) {
+    return s->shm->wblocked;
+}
+
+int _xshm_gone(xChannel* s) {
+    return s->shm->gone;
+}
+
+int _xshm_pending(xChannel* s) {
+    shm_ring_t* r = s->shm->rx;
+    uint64_t n = r->tail.load(std::memory_order_seq_cst) - r->head.load(std::memory_order_relaxed);
+    if (n > s->shm->mask + 1) return 1;     // 游标坏了, 让读去报错
+    return (int)n;
+}
+
+int _xshm_recv(xChannel* s, char* buf, int len) {
+    xChannelShm* sh = s->shm;
+    shm_ring_t* r = sh->rx;
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    uint64_t tail = r->tail.load(std::memory_order_acquire);
+    if (tail == head) {
+        // 先登记在等再复查, 和写端的"先发布再查登记"配对, 不会漏掉门铃
+        r->need_wake.store(1, std::memory_order_seq_cst);
+        tail = r->tail.load(std::memory_order_seq_cst);
+        if (tail == head) return sh->gone ? 0 : ANET_EAGAIN;
+        r->need_wake.store(0, std::memory_order_relaxed);
+    }
+    // 游标在共享内存里, 对端能随便写: 超出环大小(含head跑到tail前面)按对端出错处理
+    uint64_t n = tail - head;
+    if (n > sh->mask + 1) {
+        printf("shm bad rx cursor, head %llu tail %llu, fd: %d\n",
+            (unsigned long long)head, (unsigned long long)tail, (int)s->fd);
+        return ANET_ERR;
+    }
+    if (n > (uint64_t)len) n = (uint64_t)len;
+    size_t off = (size_t)(head & sh->mask);
+    size_t first = (size_t)(sh->mask + 1) - off;
+    if (first > n) first = (size_t)n;
+    memcpy(buf, sh->rdata + off, first);
+    if (n > first) memcpy(buf + first, sh->rdata, (size_t)n - first);
+    r->head.store(head + n, std::memory_order_release);
+    // 读空了就登记在等: 水平触发一次只读一段, 不一定再读到EAGAIN; 之后新写入的由_xshm_pending复查
+    if (head + n == tail)
+        r->need_wake.store(1, std::memory_order_seq_cst);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (r->want_space.load(std::memory_order_relaxed) && r->want_space.exchange(0))
+        shm_bell(sh->peer);
+    return (int)n;
+}
+
+int _xshm_sendv(xChannel* s, char** bufs, int* lens, int count) {
+    xChannelShm* sh = s->shm;
+    if (sh->gone) return ANET_ERR;
+    shm_ring_t* r = sh->tx;
+    uint64_t size = sh->mask + 1;
+    uint64_t tail = r->tail.load(std::memory_order_relaxed);
+    uint64_t head = r->head.load(std::memory_order_acquire);
+    if (tail - head == size) {
+        r->want_space.store(1, std::memory_order_seq_cst);
+        head = r->head.load(std::memory_order_seq_cst);
+        if (tail - head == size) {
+            sh->wblocked = 1;
+            return ANET_EAGAIN;
+        }
+        r->want_space.store(0, std::memory_order_relaxed);
+    }
+    if (tail - head > size) {
+        printf("shm bad tx cursor, head %llu tail %llu, fd: %d\n",
+            (unsigned long long)head, (unsigned long long)tail, (int)s->fd);
+        return ANET_ERR;
+    }
+    sh->wblocked = 0;
+    uint64_t room = size - (tail - head);
+    uint64_t n = 0;
+    for (int i = 0; i < count && n < room; i++) {
+        size_t len = (size_t)lens[i];
+        if (len > room - n) len = (size_t)(room - n);
+        size_t off = (size_t)((tail + n) & sh->mask);
+        size_t first = (size_t)size - off;
+        if (first > len) first = len;
+        memcpy(sh->tdata + off, bufs[i], first);
+        if (len > first) memcpy(sh->tdata, bufs[i] + first, len - first);
+        n += len;
+    }
+    r->tail.store(tail + n, std::memory_order_release);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (r->need_wake.load(std::memory_order_relaxed) && r->need_wake.exchange(0))
+        shm_bell(sh->peer);
+    return (int)n;
+}
+#endif
@@ -0,0 +1,37 @@
+// xchannel_shm.h
+#ifndef _XCHANNEL_SHM_H
+#define _XCHANNEL_SHM_H
+#include "xchannel.h"
+
+// 同机进程间的共享内存channel: 连接端建一段memfd, 里面每个方向一个SPSC字节环, 再建两个eventfd做门铃,
+// 经unix socket(SCM_RIGHTS)交给监听端. 之后收发只拷内存, 对端读空在等或写满在等时才敲一次门铃.
+// 分帧/RPC(xhandle_on_pack, xrpc_pcall)/send系列和socket channel一样, 握手用的unix socket留着发现对端退出.
+// 只支持linux就绪模式(epoll/select), 其他返回失败. 不支持splice转发和zerocopy
+#if defined(__linux__) && !defined(HAVE_IOCP) && !defined(HAVE_IOURING)
+#define XCHANNEL_SHM
+#endif
+
+#define XCHANNEL_SHM_RING (1024*1024)   // 默认每个方向的环大小
+
+struct xChannelShm;
+
+// path同xchannel_listen_unix('@'开头是抽象命名空间)
+int         xchannel_listen_shm(const char* path, xchannel_proc* on_pack, xchannel_proc* on_close, void* userdata, xProto proto = xProto::xproto_blp4, int perm = 0);
+// ring_size是每个方向的环字节数, 取整到2的幂, <=0用XCHANNEL_SHM_RING; 由连接端决定
+xChannel*   xchannel_conn_shm(const char* path, xchannel_proc* on_pack, xchannel_proc* on_close, void* userdata, xProto proto = xProto::xproto_blp4, int ring_size = 0);
+
+// 内部: xchannel.cpp的握手和读写路径调用, 返回值同anetRecv/anetSend(>0字节, 0对端关闭, ANET_EAGAIN, ANET_ERR)
+struct xChannelShm* _xshm_connect(xSocket ctl, int ring_size);     // 连接端: 建段并把fd发给对端
+int         _xshm_accept(xSocket ctl, struct xChannelShm** out);   // 监听端: 收fd并映射, 还没到返回ANET_EAGAIN
+xSocket     _xshm_fd(struct xChannelShm* sh);          // 自己的门铃eventfd, 作为channel的fd
+void        _xshm_destroy(struct xChannelShm* sh);     // 还没挂到channel上时释放
+int         _xshm_attach(aeEventLoop* el, xChannel* s, struct xChannelShm* sh);
+void        _xshm_free(xChannel* s);
+void        _xshm_ack(xChannel* s);                    // 读空门铃计数
+int         _xshm_wblocked(xChannel* s);               // 上次写时环满, 在等对端腾出空间敲门铃
+int         _xshm_gone(xChannel* s);                   // 对端已关闭/退出, 环里剩下的读完就结束
+int         _xshm_pending(xChannel* s);                // 环里还没读的字节
+int         _xshm_recv(xChannel* s, char* buf, int len);
+int         _xshm_sendv(xChannel* s, char** bufs, int* lens, int count);
+
+#endif
@@ -0,0 +1,335 @@
+// xchannel_tls.cpp
+#include "xchannel_tls.h"
+#include "anet.h"
+#include "zmalloc.h"
+
+#include "mbedtls/ssl.h"
+#include "mbedtls/ssl_internal.h"
+#include "mbedtls/ssl_ticket.h"
+#include "mbedtls/ssl_cache.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/error.h"
+#include "xhttpc_cacert.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#define TLS_TICKET_SECS 86400       // ticket默认有效期, 也是ticket密钥的轮换周期
+
+struct xTlsConfig {
+    mbedtls_ssl_config          conf;
+    mbedtls_entropy_context     entropy;
+    mbedtls_ctr_drbg_context    drbg;
+    mbedtls_x509_crt            cert;       // 服务端: 自己的证书链; 客户端: 根证书
+    mbedtls_pk_context          key;
+    mbedtls_ssl_ticket_context  ticket;
+#if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_cache_context   cache;
+#endif
+    int                         endpoint;
+    // mbedtls没开MBEDTLS_THREADING_C, 多个loop线程共用的随机数/ticket/会话缓存都在锁里用
+    std::mutex                  lock;
+    std::unordered_map<std::string, mbedtls_ssl_session*> sessions;    // 客户端: 主机名:端口 -> 上次的会话
+};
+
+struct xChannelTls {
+    mbedtls_ssl_context ssl;
+    xTlsConfig*         conf;
+    int                 wpend;      // 上次WANT_WRITE时交给ssl_write的长度, 记录已加密, 重试必须同样长
+    uint8_t             ready;      // 握手完成
+    uint8_t             wantw;      // 握手在等可写
+    uint8_t             resumed;    // 握手是恢复的会话
+    std::string         sesskey;    // 客户端: 会话缓存的键
+};
+
+static void tls_print_err(const char* what, int fd, int ret) {
+    char buf[128];
+    mbedtls_strerror(ret, buf, sizeof(buf));
+    printf("%s on fd: %d, -0x%04x %s\n", what, fd, (unsigned int)-ret, buf);
+}
+
+// ============================================================================
+// 配置
+// ============================================================================
+static int tls_rng(void* p, unsigned char* out, size_t len) {
+    xTlsConfig* c = (xTlsConfig*)p;
+    std::lock_guard<std::mutex> g(c->lock);
+    return mbedtls_ctr_drbg_random(&c->drbg, out, len);
+}
+
+// ticket上下文用的随机数直接取drbg, 调用时已经在锁里
+static int tls_ticket_write(void* p, const mbedtls_ssl_session* session, unsigned char* start,
+    const unsigned char* end, size_t* tlen, uint32_t* lifetime) {
+    xTlsConfig* c = (xTlsConfig*)p;
+    std::lock_guard<std::mutex> g(c->lock);
+    return mbedtls_ssl_ticket_write(&c->ticket, session, start, end, tlen, lifetime);
+}
+
+static int tls_ticket_parse(void* p, mbedtls_ssl_session* session, unsigned char* buf, size_t len) {
+    xTlsConfig* c = (xTlsConfig*)p;
+    std::lock_guard<std::mutex> g(c->lock);
+    return mbedtls_ssl_ticket_parse(&c->ticket, session, buf, len);
+}
+
+#if defined(MBEDTLS_SSL_CACHE_C)
+static int tls_cache_get(void* p, mbedtls_ssl_session* session) {
+    xTlsConfig* c = (xTlsConfig*)p;
+    std::lock_guard<std::mutex> g(c->lock);
+    return mbedtls_ssl_cache_get(&c->cache, session);
+}
+
+static int tls_cache_set(void* p, const mbedtls_ssl_session* session) {
+    xTlsConfig* c = (xTlsConfig*)p;
+    std::lock_guard<std::mutex> g(c->lock);
+    return mbedtls_ssl_cache_set(&c->cache, session);
+}
+#endif
+
+static xTlsConfig* tls_config_new(int endpoint) {
+    xTlsConfig* c = new xTlsConfig();
+    c->endpoint = endpoint;
+    mbedtls_ssl_config_init(&c->conf);
+    mbedtls_entropy_init(&c->entropy);
+    mbedtls_ctr_drbg_init(&c->drbg);
+    mbedtls_x509_crt_init(&c->cert);
+    mbedtls_pk_init(&c->key);
+    mbedtls_ssl_ticket_init(&c->ticket);
+#if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_cache_init(&c->cache);
+#endif
+    const char* pers = endpoint == MBEDTLS_SSL_IS_SERVER ? "xnet_tls_server" : "xnet_tls_client";
+    int ret = mbedtls_ctr_drbg_seed(&c->drbg, mbedtls_entropy_func, &c->entropy, (const unsigned char*)pers, strlen(pers));
+    if (ret == 0)
+        ret = mbedtls_ssl_config_defaults(&c->conf, endpoint, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) {
+        tls_print_err("TLS config init failed", -1, ret);
+        xtls_config_free(c);
+        return NULL;
+    }
+    mbedtls_ssl_conf_rng(&c->conf, tls_rng, c);
+    return c;
+}
+
+xTlsConfig* xtls_server_config(const char* cert_file, const char* key_file, const char* key_pwd, int ticket_secs) {
+    if (!cert_file || !key_file) return NULL;
+    xTlsConfig* c = tls_config_new(MBEDTLS_SSL_IS_SERVER);
+    if (!c) return NULL;
+
+    int ret = mbedtls_x509_crt_parse_file(&c->cert, cert_file);
+    if (ret != 0) {
+        tls_print_err("TLS load cert failed", -1, ret);
+        xtls_config_free(c);
+        return NULL;
+    }
+    ret = mbedtls_pk_parse_keyfile(&c->key, key_file, key_pwd);
+    if (ret == 0) ret = mbedtls_ssl_conf_own_cert(&c->conf, &c->cert, &c->key);
+    if (ret != 0) {
+        tls_print_err("TLS load key failed", -1, ret);
+        xtls_config_free(c);
+        return NULL;
+    }
+
+    // 会话恢复: ticket由服务端密钥加密交给客户端保存, 服务端不存状态
+    ret = mbedtls_ssl_ticket_setup(&c->ticket, mbedtls_ctr_drbg_random, &c->drbg, MBEDTLS_CIPHER_AES_256_GCM,
+        ticket_secs > 0 ? (uint32_t)ticket_secs : TLS_TICKET_SECS);
+    if (ret != 0) {
+        tls_print_err("TLS ticket setup failed", -1, ret);
+        xtls_config_free(c);
+        return NULL;
+    }
+    mbedtls_ssl_conf_session_tickets_cb(&c->conf, tls_ticket_write, tls_ticket_parse, c);
+#if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_conf_session_cache(&c->conf, c, tls_cache_get, tls_cache_set);
+#endif
+    return c;
+}
+
+xTlsConfig* xtls_client_config(const char* ca_file, int verify) {
+    xTlsConfig* c = tls_config_new(MBEDTLS_SSL_IS_CLIENT);
+    if (!c) return NULL;
+
+    if (verify) {
+        int ret = ca_file ? mbedtls_x509_crt_parse_file(&c->cert, ca_file)
+                          : mbedtls_x509_crt_parse(&c->cert, httpc_cacert_get_data(), httpc_cacert_get_len());
+        if (ret < 0) {
+            tls_print_err("TLS load ca failed", -1, ret);
+            xtls_config_free(c);
+            return NULL;
+        }
+        mbedtls_ssl_conf_ca_chain(&c->conf, &c->cert, NULL);
+    }
+    mbedtls_ssl_conf_authmode(&c->conf, verify ? MBEDTLS_SSL_VERIFY_REQUIRED : MBEDTLS_SSL_VERIFY_NONE);
+    mbedtls_ssl_conf_session_tickets(&c->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+    return c;
+}
+
+void xtls_config_free(xTlsConfig* c) {
+    if (!c) return;
+    for (auto& it : c->sessions) {
+        mbedtls_ssl_session_free(it.second);
+        zfree(it.second);
+    }
+#if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_cache_free(&c->cache);
+#endif
+    mbedtls_ssl_ticket_free(&c->ticket);
+    mbedtls_pk_free(&c->key);
+    mbedtls_x509_crt_free(&c->cert);
+    mbedtls_ssl_config_free(&c->conf);
+    mbedtls_ctr_drbg_free(&c->drbg);
+    mbedtls_entropy_free(&c->entropy);
+    delete c;
+}
+
+// ============================================================================
+// 会话: ssl直接读写非阻塞socket, EAGAIN转成WANT_READ/WANT_WRITE, 由loop的事件再推进
+// ============================================================================
+static int tls_bio_send(void* ctx, const unsigned char* buf, size_t len) {
+    xChannel* s = (xChannel*)ctx;
+    int n = anetSend(s->fd, (char*)buf, (int)len);
+    if (n == ANET_EAGAIN) return MBEDTLS_ERR_SSL_WANT_WRITE;
+    return n < 0 ? MBEDTLS_ERR_NET_SEND_FAILED : n;
+}
+
+static int tls_bio_recv(void* ctx, unsigned char* buf, size_t len) {
+    xChannel* s = (xChannel*)ctx;
+    int n = anetRecv(s->fd, (char*)buf, (int)len);
+    if (n == ANET_EAGAIN) return MBEDTLS_ERR_SSL_WANT_READ;
+    return n < 0 ? MBEDTLS_ERR_NET_RECV_FAILED : n;   // 0由mbedtls当作对端关闭
+}
+
+int _xtls_attach(xChannel* s, xTlsConfig* conf, const char* servername) {
+    xChannelTls* t = new xChannelTls();
+    t->conf = conf;
+    t->wpend = 0;
+    t->ready = t->wantw = t->resumed = 0;
+    mbedtls_ssl_init(&t->ssl);
+    int ret = mbedtls_ssl_setup(&t->ssl, &conf->conf);
+    if (ret == 0 && conf->endpoint == MBEDTLS_SSL_IS_CLIENT) {
+        char ip[ANET_IP_LEN] = {0};
+        int port = 0;
+        anetPeerToString(s->fd, ip, &port);
+        if (!servername) servername = ip;
+        ret = mbedtls_ssl_set_hostname(&t->ssl, servername);
+        t->sesskey = std::string(servername) + ":" + std::to_string(port);
+        std::lock_guard<std::mutex> g(conf->lock);
+        auto it = conf->sessions.find(t->sesskey);
+        if (ret == 0 && it != conf->sessions.end())
+            mbedtls_ssl_set_session(&t->ssl, it->second);   // 失败只是走完整握手
+    }
+    if (ret != 0) {
+        tls_print_err("TLS setup failed", (int)s->fd, ret);
+        mbedtls_ssl_free(&t->ssl);
+        delete t;
+        return AE_ERR;
+    }
+    mbedtls_ssl_set_bio(&t->ssl, s, tls_bio_send, tls_bio_recv, NULL);
+    s->tls = t;
+    return AE_OK;
+}
+
+void _xtls_free(xChannel* s) {
+    xChannelTls* t = s->tls;
+    if (!t) return;
+    s->tls = NULL;
+    if (t->ready && s->fd != (xSocket)-1)
+        mbedtls_ssl_close_notify(&t->ssl);      // 尽量告知对端, 写不出去就算了
+    mbedtls_ssl_free(&t->ssl);
+    delete t;
+}
+
+// 客户端: 握手成功的会话(含服务端发的ticket)存起来, 下次连同一服务端时恢复
+static void tls_save_session(xChannelTls* t) {
+    mbedtls_ssl_session* sess = (mbedtls_ssl_session*)zmalloc(sizeof(mbedtls_ssl_session));
+    mbedtls_ssl_session_init(sess);
+    if (mbedtls_ssl_get_session(&t->ssl, sess) != 0) {
+        mbedtls_ssl_session_free(sess);
+        zfree(sess);
+        return;
+    }
+    std::lock_guard<std::mutex> g(t->conf->lock);
+    mbedtls_ssl_session*& slot = t->conf->sessions[t->sesskey];
+    if (slot) {
+        mbedtls_ssl_session_free(slot);
+        zfree(slot);
+    }
+    slot = sess;
+}
+
+int _xtls_handshake(xChannel* s) {
+    xChannelTls* t = s->tls;
+    if (t->ready) return 1;
+    // 同mbedtls_ssl_handshake, 逐步推进好在收尾释放handshake前记下是否恢复
+    int ret = 0;
+    while (t->ssl.state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+        if (t->ssl.handshake && t->ssl.handshake->resume)
+            t->resumed = 1;
+        ret = mbedtls_ssl_handshake_step(&t->ssl);
+        if (ret != 0) break;
+    }
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        t->wantw = ret == MBEDTLS_ERR_SSL_WANT_WRITE;
+        return 0;
+    }
+    if (ret != 0) {
+        tls_print_err("TLS handshake failed", (int)s->fd, ret);
+        return -1;
+    }
+    t->ready = 1;
+    t->wantw = 0;
+    if (t->conf->endpoint == MBEDTLS_SSL_IS_CLIENT)
+        tls_save_session(t);
+    return 1;
+}
+
+int _xtls_want_write(xChannel* s) {
+    return s->tls && !s->tls->ready && s->tls->wantw;
+}
+
+int _xtls_pending(xChannel* s) {
+    return s->tls && s->tls->ready ? (int)mbedtls_ssl_get_bytes_avail(&s->tls->ssl) : 0;
+}
+
+int _xtls_recv(xChannel* s, char* buf, int len) {
+    int hs = _xtls_handshake(s);
+    if (hs <= 0) return hs < 0 ? ANET_ERR : ANET_EAGAIN;
+    int n = mbedtls_ssl_read(&s->tls->ssl, (unsigned char*)buf, (size_t)len);
+    if (n > 0) return n;
+    if (n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE) return ANET_EAGAIN;
+    if (n == 0 || n == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY || n == MBEDTLS_ERR_SSL_CONN_EOF) return 0;
+    tls_print_err("TLS read failed", (int)s->fd, n);
+    return ANET_ERR;
+}
+
+int _xtls_send(xChannel* s, const char* buf, int len) {
+    int hs = _xtls_handshake(s);
+    if (hs <= 0) return hs < 0 ? ANET_ERR : ANET_EAGAIN;
+    xChannelTls* t = s->tls;
+    if (t->wpend) len = t->wpend;   // 调用方的数据还没消费, 至少有这么长
+    int n = mbedtls_ssl_write(&t->ssl, (const unsigned char*)buf, (size_t)len);
+    if (n > 0) {
+        t->wpend = 0;
+        return n;
+    }
+    if (n == MBEDTLS_ERR_SSL_WANT_WRITE || n == MBEDTLS_ERR_SSL_WANT_READ) {
+        t->wpend = len;
+        return ANET_EAGAIN;
+    }
+    tls_print_err("TLS write failed", (int)s->fd, n);
+    return ANET_ERR;
+}
+
+int xchannel_tls_ready(xChannel* s) {
+    return s && s->tls && s->tls->ready;
+}
+
+int xchannel_tls_resumed(xChannel* s) {
+    return s && s->tls && s->tls->ready && s->tls->resumed;
+}
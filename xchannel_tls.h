@@ -0,0 +1,40 @@
+// xchannel_tls.h
+#ifndef _XCHANNEL_TLS_H
+#define _XCHANNEL_TLS_H
+#include "xchannel.h"
+
+// TLS channel(3rd/mbedtls): 握手和加解密都由loop的读写事件非阻塞推进, fpack/fclose/send和明文channel一样.
+// 编译时定义HAVE_TLS(make TLS=1). 只支持就绪模式(epoll/kqueue/select), 完成模式下返回失败.
+// TLS channel不支持splice转发, 转交所有权的发送拷进wbuf, 文件分段读出再加密
+typedef struct xTlsConfig xTlsConfig;
+
+// 服务端配置: PEM证书(链)和私钥文件, key_pwd可为NULL. 开启session ticket(密钥随ticket_secs轮换,
+// <=0取一天), 客户端带ticket时跳过完整握手; mbedtls开了MBEDTLS_SSL_CACHE_C时再加session id缓存.
+// 失败返回NULL
+xTlsConfig* xtls_server_config(const char* cert_file, const char* key_file, const char* key_pwd, int ticket_secs = 0);
+// 客户端配置: ca_file为NULL用内置根证书(xhttpc_cacert.h), verify为0不校验服务端证书(自签名/测试).
+// 握手成功的会话按"主机名:端口"缓存, 再连同一服务端时带上恢复
+xTlsConfig* xtls_client_config(const char* ca_file, int verify);
+// 用它的channel都关闭后再释放. 一个配置可以在多个loop线程共用
+void        xtls_config_free(xTlsConfig* conf);
+
+int         xchannel_listen_tls(int port, char* bindaddr, xTlsConfig* conf, xchannel_proc* on_pack, xchannel_proc* on_close, void* userdata, xProto proto = xProto::xproto_blp4);
+// 同xchannel_conn, addr同时作为SNI和证书校验的主机名
+xChannel*   xchannel_conn_tls(char* addr, int port, xTlsConfig* conf, xchannel_proc* on_pack, xchannel_proc* on_close, void* userdata, xProto proto = xProto::xproto_blp4);
+// 已连上的channel切到TLS, 端由conf决定(如xchannel_connect_async连上后). 要求还没有未处理/未写出的明文;
+// servername为NULL时用对端ip. 失败返回AE_ERR, channel由调用方关闭
+int         xchannel_starttls(xChannel* s, xTlsConfig* conf, const char* servername);
+// 握手完成返回1, 之后是否是恢复的会话见xchannel_tls_resumed
+int         xchannel_tls_ready(xChannel* s);
+int         xchannel_tls_resumed(xChannel* s);
+
+// 内部: xchannel.cpp的读写路径调用, 返回值同anetRecv/anetSend(>0字节, 0对端关闭, ANET_EAGAIN, ANET_ERR)
+int         _xtls_attach(xChannel* s, xTlsConfig* conf, const char* servername);
+void        _xtls_free(xChannel* s);
+int         _xtls_handshake(xChannel* s);   // 1完成, 0等读写(_xtls_want_write), -1失败
+int         _xtls_want_write(xChannel* s);
+int         _xtls_pending(xChannel* s);     // mbedtls里已解密还没取走的字节
+int         _xtls_recv(xChannel* s, char* buf, int len);
+int         _xtls_send(xChannel* s, const char* buf, int len);
+
+#endif
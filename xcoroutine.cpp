@@ -339,7 +339,7 @@ bool xCoroTaskT<T>::resume_safe(void* param, xCoroutineLJ* lj) {
 }
 
 // waiter timeout
-void* coroutine_timer(uint32_t wait_id, int time_ms);
+void* coroutine_timer(uint32_t wait_id, long long time_us);
 
 // ==============================================
 // Coroutine manager implementation
@@ -631,7 +631,7 @@ private:
 
 public:
     // -------------------- Wait related --------------------
-    void register_waiter(uint32_t wait_id, std_coro::coroutine_handle<> h, int coro_id, int timeout) {
+    void register_waiter(uint32_t wait_id, std_coro::coroutine_handle<> h, int coro_id, long long timeout) {
         std_coro::coroutine_handle<> to_resume = nullptr;
         int resume_coro_id = -1;
         {
@@ -802,7 +802,7 @@ void xAwaiter::await_suspend(std_coro::coroutine_handle<> h) {
 }
 
 std::vector<VariantType> xAwaiter::await_resume() {
-    if (error_code_ != 0) {
+    if (error_code_ != 0 || wait_id_ == 0) {
         std::vector<VariantType> err;
         err.emplace_back(error_code_);
         return err;
@@ -870,24 +870,26 @@ static void coroutine_wait_timeout(void* data) {
     if (_co_svs) _co_svs->resume_waiter_timeout(wait_id);
 }
 
-void* coroutine_timer(uint32_t wait_id, int time_ms) {
-    if (time_ms < 10) time_ms = 10;
-
+void* coroutine_timer(uint32_t wait_id, long long time_us) {
     char name[32];
     snprintf(name, sizeof(name), "coro:wait:%d", wait_id);
-    return (void*)xtimer_add(time_ms, name, coroutine_wait_timeout, (void*)(uintptr_t)wait_id, 0);
+    return (void*)xtimer_add_us(time_us, name, coroutine_wait_timeout, (void*)(uintptr_t)wait_id, 0);
 }
 
-xAwaiter coroutine_sleep(int time_ms) {
+xAwaiter coroutine_sleep_us(long long time_us) {
     if (_co_svs) {
         xAwaiter awaiter;
-        awaiter.set_timeout(time_ms);
+        awaiter.set_timeout_us(time_us);
         return awaiter;
     } else {
         return xAwaiter(0);
     }
 }
 
+xAwaiter coroutine_sleep(int time_ms) {
+    return coroutine_sleep_us((long long)time_ms * 1000);
+}
+
 bool coroutine_is_done(int id) {
     return _co_svs ? _co_svs->is_coroutine_done(id) : true;
 }
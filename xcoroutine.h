@@ -53,6 +53,7 @@ size_t coroutine_get_active_count();
 int coroutine_self_id();
 void coroutine_set_stacktrace_mode(int mode);
 xAwaiter coroutine_sleep(int time_ms);
+xAwaiter coroutine_sleep_us(long long time_us);
 bool coroutine_cancel(int coroutine_id);
 bool coroutine_valid(int coroutine_id);
 
@@ -463,18 +464,19 @@ public:
     xAwaiter();
     explicit xAwaiter(int err);
 
-    bool await_ready() const noexcept { return error_code_ != 0; }
+    bool await_ready() const noexcept { return error_code_ != 0 || wait_id_ == 0; }    // 无需等待: 直接返回[error_code]
     void await_suspend(std_coro::coroutine_handle<> h);
     std::vector<VariantType> await_resume();
 
     uint32_t wait_id() const noexcept { return wait_id_; }
     int error_code() const noexcept { return error_code_; }
-    void set_timeout(int timeout) { timeout_ = timeout; }
+    void set_timeout(int timeout) { timeout_ = (long long)timeout * 1000; }
+    void set_timeout_us(long long timeout) { timeout_ = timeout; }
 private:
     uint32_t wait_id_;
     int error_code_;
     int coro_id_;
-    int timeout_;
+    long long timeout_;     // us
 };
 
 #endif // _XCOROUTINE_H
\ No newline at end of file
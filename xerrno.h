@@ -22,7 +22,9 @@ enum NetworkError {
     XNET_INVALID_RESPONSE,
     XNET_SERVER_ERROR,
     XNET_CLIENT_ERROR,
-    XNET_UNKNOWN_ERROR
+    XNET_UNKNOWN_ERROR,
+    XNET_CHANNEL_CLOSED,
+    XNET_CONNECT_FAILED
 };
 
 #endif
@@ -137,13 +137,13 @@ xCoroTask coroutine_func_rpc(void* arg) {
     co_return;
 }
 
-int xhandle_on_pack(xChannel* s, char* /*buf*/, int len) {
+int xhandle_on_pack(xChannel* s, char* buf, int len) {
     uint16_t is_rpc = 0;
     uint32_t wait_id = 0;
     int co_id = 0;
     uint16_t protocol = 0;
 
-    char* cur = s->rbuf + _xchannel_header_size(s);
+    char* cur = buf;    // 包头已由分帧去掉, 变长包头(varint)不能按header_size算
     is_rpc = ntohs(*(uint16_t*)cur);
     cur += sizeof(is_rpc);
 
@@ -19,7 +19,7 @@ typedef struct xHeapMinNode {
 
 typedef int (*fnHeapMinComp)(xHeapMinNode*, xHeapMinNode*);
 static inline int xheapmin_compare(xHeapMinNode* a, xHeapMinNode* b) {
-    return (int)(a->key - b->key);
+    return (a->key > b->key) - (a->key < b->key);   // us keys, the difference overflows int
 }
 
 typedef struct {
@@ -9,6 +9,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 static const HttpServerConfig DEFAULT_CONFIG = {
     .port = 8080,
@@ -666,6 +671,41 @@ int xhttpd_send_json(xChannel* channel, int status_code, const char* json) {
     return xhttpd_send_response(channel, resp);
 }
 
+int xhttpd_send_file(xChannel* channel, int status_code, const char* path, const char* content_type) {
+    HttpConnection* conn = (HttpConnection*)channel->userdata;
+    if (!conn || !path) {
+        xlog_err("No connection context for channel");
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return xhttpd_send_error(channel, 404, "Not Found");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return xhttpd_send_error(channel, 404, "Not Found");
+    }
+
+    HttpResponse* resp = &conn->response;
+    build_default_response(resp, status_code);
+    xhttpd_set_header(resp, "Content-Type", content_type ? content_type : "application/octet-stream");
+    char content_len[32];
+    snprintf(content_len, sizeof(content_len), "%lld", (long long)st.st_size);
+    xhttpd_set_header(resp, "Content-Length", content_len);
+
+    // 头部走缓冲区, 文件内容由channel用sendfile直接从页缓存发出
+    int ret = xhttpd_send_response(channel, resp);
+    if (ret == 0 && st.st_size > 0 && xchannel_sendfile(channel, fd, 0, st.st_size) != AE_OK) {
+        xlog_err("sendfile %s failed", path);
+        xchannel_close(channel);    // 头部已发出, 只能断开
+        ret = -1;
+    }
+    close(fd);
+    return ret;
+}
+
 static inline std::string escape_json_string(const char* str) {
     if (!str) return "";
     
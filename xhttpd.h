@@ -97,6 +97,7 @@ int xhttpd_send_response(xChannel* channel, const HttpResponse* resp);
 int xhttpd_send_text(xChannel* channel, int status_code, const char* text);
 int xhttpd_send_json(xChannel* channel, int status_code, const char* json);
 int xhttpd_send_error(xChannel* channel, int status_code, const char* message);
+int xhttpd_send_file(xChannel* channel, int status_code, const char* path, const char* content_type);
 HttpResponse* xhttpd_get_response(xChannel* channel);
 
 const char* xhttpd_get_query_param(const HttpRequest* req, const char* key, size_t* value_len);
@@ -1,5 +1,6 @@
 #include "xredis.h"
 #include "xchannel.h"
+#include "xrpc.h"
 #include "xpack_redis.h"
 #include "xthread.h"
 #include "ae.h"
@@ -443,9 +444,11 @@ static xCoroTask create_and_init_connection(void*) {
     conn->pool = _pool;
     xqueue_circle_init(&conn->queue, sizeof(uint32_t), 1000);
 
-    conn->channel = xchannel_conn(
-        const_cast<char*>(_pool->config.ip.c_str()),
+    // 握手期间不阻塞事件循环
+    conn->channel = co_await xchannel_connect_async(
+        _pool->config.ip.c_str(),
         _pool->config.port,
+        _pool->config.connect_timeout_ms,
         [](xChannel* s, char* buf, int len) {
             RedisConn* conn = static_cast<RedisConn*>(s->userdata);
             return conn->handle_packet(buf, len);
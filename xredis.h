@@ -12,6 +12,7 @@ struct RedisConnConfig {
     std::string password;  // 可选，为空表示不需要认证
     int db_index = 0;      // 默认数据库0
     bool use_resp3 = true; // 默认使用RESP3
+    int connect_timeout_ms = 3000; // 建连超时
 };
 
 
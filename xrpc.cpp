@@ -8,12 +8,11 @@
 
 int _xrpc_resp(xChannel* s, int co_id, uint32_t wait_id, int retcode, XPackBuff& res) {
     uint16_t is_rpc = 2;
-    int remain = (int)s->wlen - (int)(s->wpos - s->wbuf);
     int hlen = (int)_xchannel_header_size(s);
     // 增加 sizeof(retcode)
     int plen = sizeof(is_rpc) + sizeof(wait_id) + sizeof(co_id) + sizeof(retcode) + res.len;
 
-    if (remain < hlen + plen) {
+    if (xchannel_reserve_owned(s, hlen + plen - res.len, res.len) != AE_OK) {    // 数据转交发送, 大包只预留头
         std::cout << "xrpc_resp: Buffer overflow" << std::endl;
         return XNET_BUFF_LIMIT;
     }
@@ -33,6 +32,6 @@ int _xrpc_resp(xChannel* s, int co_id, uint32_t wait_id, int retcode, XPackBuff&
     *(int*)s->wpos = htonl(retcode);
     s->wpos += sizeof(retcode);
 
-    // 写数据包
-    return xchannel_rawsend(s, res.get(), res.len);
+    // 写数据包, 大包不拷贝
+    return _xchannel_rawsend_pack(s, res);
 }
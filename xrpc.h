@@ -12,6 +12,32 @@
 #include "xchannel.inl"
 #include "xerrno.h"
 
+inline void _xpack_buff_free(char* buf, void* /*ud*/) {
+    delete[] buf;
+}
+
+// 转交XPackBuff的数据给channel发送, 大包不再拷进wbuf; 调用后buf为空
+inline int xchannel_sendv(xChannel* s, XPackBuff&& buf) {
+    int len = buf.len;
+    buf.len = 0;
+    return xchannel_send_owned(s, buf.data.release(), len, _xpack_buff_free, NULL);
+}
+
+inline int _xchannel_rawsend_pack(xChannel* s, XPackBuff& buf) {
+    int len = buf.len;
+    buf.len = 0;
+    return xchannel_rawsend_owned(s, buf.data.release(), len, _xpack_buff_free, NULL);
+}
+
+// 等发送积压降到低水位(见xchannel_set_watermark), 已经不超过时不挂起.
+// 返回[XNET_SUCCESS]; channel关闭返回[XNET_CHANNEL_CLOSED]; timeout_ms>0时超时同其他awaiter
+xAwaiter xchannel_drain(xChannel* s, int timeout_ms = 0);
+
+// 非阻塞连接, co_await得到连上的channel, 失败/超时为NULL. 域名解析出的多个地址并行尝试, 先连上的胜出;
+// 域名在注册了XTHR_IO线程时交给它解析, 否则仍在当前线程getaddrinfo. timeout_ms<=0不限时
+xCoroTaskT<xChannel*> xchannel_connect_async(const char* addr, int port, int timeout_ms,
+    xchannel_proc* on_pack, xchannel_proc* on_close, void* userdata, xProto proto = xProto::xproto_blp4);
+
 template<typename... Args>
 xAwaiter xrpc_pcall(xChannel* s, uint16_t protocol, Args&&... args) {
     xAwaiter awaiter;
@@ -28,11 +54,11 @@ xAwaiter xrpc_pcall(xChannel* s, uint16_t protocol, Args&&... args) {
     uint16_t is_rpc = 1;
     XPackBuff packed = xpack_pack(true, std::forward<Args>(args)...);
 
-    int remain = (int)s->wlen - (int)(s->wpos - s->wbuf);
     int hlen = (int)_xchannel_header_size(s);
     int plen = packed.len + sizeof(wait_id) + sizeof(co_id) + sizeof(is_rpc) + sizeof(protocol);
 
-    if (remain < hlen + plen) {
+    // 数据由_xchannel_rawsend_pack转交, 大包不进wbuf, 只预留包头和RPC头
+    if (xchannel_reserve_owned(s, hlen + plen - packed.len, packed.len) != AE_OK) {
         return xAwaiter(XNET_BUFF_LIMIT);
     }
     _xchannel_write_header(s, plen);
@@ -47,8 +73,9 @@ xAwaiter xrpc_pcall(xChannel* s, uint16_t protocol, Args&&... args) {
     *(uint16_t*)s->wpos = htons(protocol);
     s->wpos += sizeof(protocol);
 
-    int sendlen = xchannel_rawsend(s, packed.get(), packed.len);
-    if (sendlen != packed.len) {
+    int packlen = packed.len;
+    int sendlen = _xchannel_rawsend_pack(s, packed);
+    if (sendlen != packlen) {
         return xAwaiter(XNET_BUFF_LIMIT);
     } else {
         awaiter.set_timeout(10000); // TODO: using param
@@ -62,10 +89,9 @@ NetworkError xchannel_post(xChannel* s, uint16_t protocol, Args&&... args) {
     uint16_t is_rpc = 0;
     XPackBuff packed = xpack_pack(true, std::forward<Args>(args)...);
 
-    int remain = (int)s->wlen - (int)(s->wpos - s->wbuf);
     int hlen = (int)_xchannel_header_size(s);
     int plen = packed.len + sizeof(is_rpc) + sizeof(protocol);
-    if (remain < hlen + plen)
+    if (xchannel_reserve_owned(s, hlen + plen - packed.len, packed.len) != AE_OK)    // 同xrpc_pcall
         return XNET_BUFF_LIMIT;
     _xchannel_write_header(s, plen);
 
@@ -75,7 +101,7 @@ NetworkError xchannel_post(xChannel* s, uint16_t protocol, Args&&... args) {
     *(uint16_t*)s->wpos = htons(protocol);
     s->wpos += sizeof(protocol);
 
-    xchannel_rawsend(s, packed.get(), packed.len);
+    _xchannel_rawsend_pack(s, packed);
     return XNET_SUCCESS;
 }
 
@@ -104,6 +130,7 @@ inline bool xrpc_ok(const std::vector<VariantType>& result) {
     return !result.empty() && std::get<int>(result[0]) == 0;
 }
 
+// res的数据转交给channel发送, 返回后res为空
 int _xrpc_resp(xChannel* s, int co_id, uint32_t wait_id, int retcode, XPackBuff& res);
 
 inline int _xrpc_resp_ok(xChannel* s, int co_id, uint32_t wait_id, XPackBuff& res) {
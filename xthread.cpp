@@ -71,7 +71,9 @@ xthrQueue::xthrQueue(bool xwait_) : pending_(0), xwait_(xwait_) {
 #ifdef _WIN32
     iocp_ = nullptr;
 #else
-    fds_[0] = fds_[1] = -1;
+    waker_.fd[0] = waker_.fd[1] = -1;
+    waker_.state = 0;
+    notify_ = nullptr;
 #endif
 }
 
@@ -87,16 +89,15 @@ bool xthrQueue::init() {
         iocp_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
         return iocp_ != nullptr;
 #else
-        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds_) != 0) return false;
-        fcntl(fds_[0], F_SETFL, O_NONBLOCK);
-        fcntl(fds_[1], F_SETFL, O_NONBLOCK);
+        if (aeWakerInit(&waker_) != AE_OK) return false;
+        notify_ = &waker_;
         return true;
 #endif
     } else {
 #ifdef _WIN32
         iocp_ = nullptr;            // 等待外部设置
 #else
-        fds_[0] = fds_[1] = -1;     // 等待外部设置
+        notify_ = nullptr;          // 等待外部设置
 #endif
         return true;
     }
@@ -110,7 +111,8 @@ void xthrQueue::uninit() {
 #ifdef _WIN32
     if (iocp_) { CloseHandle(iocp_); iocp_ = nullptr; }
 #else
-    if (fds_[0] >= 0) { close(fds_[0]); close(fds_[1]); fds_[0] = fds_[1] = -1; }
+    aeWakerFree(&waker_);
+    notify_ = nullptr;
 #endif
     xnet_mutex_uninit(&lock_);
 }
@@ -141,13 +143,10 @@ bool xthrQueue::push(xthrTask&& task, int* out_new_size) {
         }
     }
 #else
-    if (need_notify && fds_[0] > 0) {
-        if (write(fds_[0], "!", 1) < 1){
-            xnet_mutex_lock(&lock_);
-            pending_ = 0;
-            xnet_mutex_unlock(&lock_);
-        }
-    }
+    // 对端醒着或已被唤醒时不写fd, 由它睡前自己检查
+    (void)need_notify;
+    aeWaker* waker = notify_;
+    if (waker) aeWakerSignal(waker);
 #endif
     return true;
 }
@@ -172,11 +171,15 @@ bool xthrQueue::wait(int timeout_ms) {
     DWORD trans; ULONG_PTR key; LPOVERLAPPED ov;
     return GetQueuedCompletionStatus(iocp_, &trans, &key, &ov, timeout) != FALSE;
 #else
-    char buf[64];
-    while (recv(fds_[1], buf, sizeof(buf), 0) > 0);
-
-    struct pollfd pfd = { fds_[1], POLLIN, 0 };
-    return poll(&pfd, 1, timeout_ms) > 0;
+    if (aeWakerSleep(&waker_)) {
+        aeWakerAwake(&waker_);
+        return true;
+    }
+    struct pollfd pfd = { waker_.fd[0], POLLIN, 0 };
+    int n = poll(&pfd, 1, timeout_ms);
+    bool signaled = aeWakerAwake(&waker_) != 0;
+    if (n > 0) aeWakerDrain(&waker_);
+    return n > 0 || signaled;
 #endif
 }
 
@@ -254,7 +257,7 @@ static void* worker_func(void* arg) {
     while (ctx->running) {
         if (ctx->queue.get_xwait()) {
             if (ctx->on_update) ctx->on_update(ctx);
-            xlog_warn("Thread[%s] weakup & process tasks", ctx->name);
+            xlog_debug("Thread[%s] weakup & process tasks", ctx->name);
             process_tasks(ctx);
         } else {
             if (ctx->queue.wait(100)) {
@@ -400,6 +403,10 @@ void xthread_unregister(int id) {
     xnet_mutex_unlock(&_lock);
 
     if (ctx->handle) {
+        // 唤醒阻塞在事件循环里的xwait线程, 让其看到running=false
+        ctx->queue.push(xthrTask::make_normal([](xThread*, std::vector<VariantType>&) {
+            return std::vector<VariantType>();
+        }));
 #ifdef _WIN32
         WaitForSingleObject(ctx->handle, INFINITE);
         CloseHandle(ctx->handle);
@@ -421,23 +428,20 @@ int xthread_current_id() { return tls_get(); }
 
 xThread* xthread_current() { return xthread_get(tls_get()); }
 
-int xthread_set_notify(void* fd) {
+int xthread_set_notify(void* handle) {
     xThread* ctx = xthread_current();
     if (!ctx) return -1;
     
 #ifdef _WIN32
-    ctx->queue.set_iocp((HANDLE)fd);
-    xlog_warn("xthread_set_notify:%s, %p", ctx->name ? ctx->name : "", fd);
+    ctx->queue.set_iocp((HANDLE)handle);
+    xlog_warn("xthread_set_notify:%s, %p", ctx->name ? ctx->name : "", handle);
 #else
-    int fd_int = -1;
-    if (fd != nullptr) {
-        fd_int = static_cast<int>(reinterpret_cast<intptr_t>(fd));
-    }
-    if (fd_int > 0) {
+    aeWaker* waker = (aeWaker*)handle;
+    if (waker) {
         assert(ctx->queue.get_xwait());
     }
-    ctx->queue.set_notify_fd(fd_int);
-    xlog_warn("xthread_set_notify:%s, %d", ctx->name ? ctx->name : "", (fd_int));
+    ctx->queue.set_notify(waker);
+    xlog_warn("xthread_set_notify:%s, %d", ctx->name ? ctx->name : "", waker ? waker->fd[0] : -1);
 #endif
     xthread_update(); // to process tasks created when thread initing
     
@@ -622,6 +626,8 @@ void xThreadSet::update_queue_size(int id, int size) {
 // 线程组注册
 // ============================================================================
 
+static char _group_names[XTHR_MAX][32];
+
 bool xthread_register_group(int base_id, int count, ThreadSelStrategy strategy, bool xwait_,
                            const char* name_pattern,
                            void (*on_init)(xThread*),
@@ -636,8 +642,8 @@ bool xthread_register_group(int base_id, int count, ThreadSelStrategy strategy,
     xThreadSet* pool = new xThreadSet(base_id, strategy, name_pattern);
     for (int i = 0; i < count; i++) {
         int thread_id = base_id + i;
-        char name[32];
-        snprintf(name, sizeof(name), "%s:%02d", name_pattern, i);
+        char* name = _group_names[thread_id];     // ctx->name只存指针, 不能用栈上的buffer
+        snprintf(name, sizeof(_group_names[0]), "%s:%02d", name_pattern, i);
         
         if (!xthread_register(thread_id, xwait_, name, on_init, on_update, on_cleanup)) {
             xlog_err("Failed to register thread %d", thread_id);
@@ -17,9 +17,10 @@
 #include "xmutex.h"
 #include "xerrno.h"
 #include "xlog.h"
+#include "ae.h"
 
 // ============================================================================
-// 预定义线程ID (0-99)
+// 预定义线程ID (0-127)
 // ============================================================================
 
 #define XTHR_INVALID        0
@@ -32,9 +33,10 @@
 #define XTHR_WORKER_GRP1    10  // 工作线程起始
 #define XTHR_WORKER_GRP2    20  // 工作线程组1
 #define XTHR_WORKER_GRP3    30  // 工作线程组2
+#define XTHR_NET_GRP        64  // 网络reactor线程组(xchannel_listen_mt)
 
-#define XTHR_MAX            100
-#define XTHR_GROUP_MAX      20
+#define XTHR_MAX            128
+#define XTHR_GROUP_MAX      32
 
 // 错误码
 #define XTHR_ERR_NO_THREAD  -101
@@ -85,7 +87,7 @@ void xthread_unregister(int id);
 xThread* xthread_get(int id);
 int xthread_current_id();
 xThread* xthread_current();
-int xthread_set_notify(void* fd);
+int xthread_set_notify(void* handle);      // xwait线程: aeGetWakeHandle(el)
 
 // 主线程调用：处理任务队列
 int xthread_update();
@@ -165,7 +167,7 @@ struct xthrTask {
 };
 
 // ============================================================================
-// 任务队列(线程安全，支持IOCP/socketpair唤醒)
+// 任务队列(线程安全，支持IOCP/eventfd唤醒)
 // ============================================================================
 
 class xthrQueue {
@@ -183,8 +185,8 @@ public:
     HANDLE get_iocp() const { return iocp_; }
     void set_iocp(HANDLE iocp) { iocp_ = iocp; }
 #else
-    int get_notify_fd() const { return fds_[0]; }
-    void set_notify_fd(int fd) { fds_[0] = fd; }
+    aeWaker* get_notify() const { return notify_; }
+    void set_notify(aeWaker* waker) { notify_ = waker ? waker : (xwait_ ? nullptr : &waker_); }
 #endif
     void set_xwait(bool wait) { xwait_ = wait; }
     bool get_xwait() const { return xwait_; }
@@ -197,7 +199,8 @@ private:
 #ifdef _WIN32
     HANDLE                  iocp_;
 #else
-    int                     fds_[2];
+    aeWaker                 waker_;         // 非xwait线程自己的唤醒fd
+    aeWaker*                notify_;        // xwait线程指向所在aeEventLoop的waker
 #endif
 };
 
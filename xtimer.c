@@ -8,17 +8,17 @@ typedef struct xTimerNode {
     fnOnTime callback;
     void* user_data;
     int repeat_num;
-    int repeat_interval;
+    long64 repeat_interval;     // us
     char name[32];
 } xTimerNode;
 
 typedef struct xTimerSet {
     xHeapMin* timer_heap;
     int next_timer_id;
-    long64 current_time;
+    long64 current_time;        // us, monotonic
 } xTimerSet;
 
-xTimerNode* xtimer_node_new(int id, long64 timeout, int interval_ms, fnOnTime callback
+xTimerNode* xtimer_node_new(int id, long64 timeout, long64 interval_us, fnOnTime callback
         , void* ud, int num, const char* name) {
     xTimerNode* timer = (xTimerNode*)malloc(sizeof(xTimerNode));
     timer->base.heap_index = -1;
@@ -28,7 +28,7 @@ xTimerNode* xtimer_node_new(int id, long64 timeout, int interval_ms, fnOnTime ca
     timer->callback = callback;
     timer->user_data = ud;
     timer->repeat_num = num;
-    timer->repeat_interval = interval_ms;
+    timer->repeat_interval = interval_us;
     if (name) {
         strncpy(timer->name, name, sizeof(timer->name) - 1);
         timer->name[sizeof(timer->name) - 1] = '\0';
@@ -48,7 +48,7 @@ xTimerSet* xtimer_pool_create(int capacity) {
     xTimerSet* tm = (xTimerSet*)malloc(sizeof(xTimerSet));
     tm->timer_heap = xheapmin_create(capacity, xheapmin_compare);
     tm->next_timer_id = 1;
-    tm->current_time = time_get_ms();
+    tm->current_time = time_get_mono_us();
 
     return tm;
 }
@@ -65,13 +65,14 @@ void xtimer_pool_destroy(xTimerSet* tm) {
     free(tm);
 }
 
-xTimerNode* xtimer_create(xTimerSet* tm, int interval_ms, const char* name, fnOnTime callback, void* ud, int repeat_num) {
+xTimerNode* xtimer_create(xTimerSet* tm, long64 interval_us, const char* name, fnOnTime callback, void* ud, int repeat_num) {
     if (!tm) return NULL;
     if (repeat_num == -1) {
         repeat_num = 0x7FFFFFFF;
     }
-    long64 timeout = tm->current_time + interval_ms;
-    xTimerNode* timer = xtimer_node_new(tm->next_timer_id++, timeout, interval_ms, callback, ud, repeat_num, name);
+    // current_time只在poll时刷新, 亚毫秒定时器从现在算起
+    long64 timeout = time_get_mono_us() + interval_us;
+    xTimerNode* timer = xtimer_node_new(tm->next_timer_id++, timeout, interval_us, callback, ud, repeat_num, name);
     xheapmin_insert(tm->timer_heap, (xHeapMinNode*)timer);
 
     return timer;
@@ -90,24 +91,48 @@ void xtimer_destroy(xTimerSet* tm, xTimerNode* timer) {
 void timer_refresh(xTimerSet* tm, xTimerNode* timer) {
     if (!tm || !timer || timer->repeat_interval <= 0) return;
 
-    long64 new_expire_time = tm->current_time + timer->repeat_interval;
+    // 按上次到期时间推进, 迟到不累积; 落后超过一个周期就不追了, 免得突发
+    long64 new_expire_time = timer->base.key + timer->repeat_interval;
+    if (new_expire_time <= tm->current_time)
+        new_expire_time = tm->current_time + timer->repeat_interval;
     xheapmin_refresh(tm->timer_heap, (xHeapMinNode*)timer, new_expire_time);
 }
 
+#ifdef _WIN32
+static __declspec(thread) fnOnLate _on_late = NULL;
+static __declspec(thread) void* _late_ud = NULL;
+#else
+static __thread fnOnLate _on_late = NULL;
+static __thread void* _late_ud = NULL;
+#endif
+
+void xtimer_set_observer(fnOnLate on_late, void* ud) {
+    _on_late = on_late;
+    _late_ud = ud;
+}
+
+void xtimer_clear_observer(void* ud) {
+    if (_late_ud != ud) return;
+    _on_late = NULL;
+    _late_ud = NULL;
+}
+
 int xtimer_poll(xTimerSet* tm) {
-    tm->current_time = time_get_ms();
+    tm->current_time = time_get_mono_us();
 
     int triggered_count = 0;
     int next_timeout = 0;
     while (xheapmin_size(tm->timer_heap) > 0) {
         xTimerNode* next_timer = (xTimerNode*)xheapmin_peek(tm->timer_heap);
         if (next_timer->base.key > tm->current_time) {
-            next_timeout = (int)(next_timer->base.key - tm->current_time);
+            next_timeout = (int)((next_timer->base.key - tm->current_time + 999) / 1000);
             break;
         }
 
         xTimerNode* expired_timer = next_timer;
         --expired_timer->repeat_num;
+        if (_on_late)
+            _on_late(_late_ud, tm->current_time - expired_timer->base.key);
 
         fnOnTime callback = expired_timer->callback;
         void* ud = expired_timer->user_data;
@@ -130,12 +155,12 @@ void xtimer_print(xTimerSet* tm) {
     if (!tm) return;
 
     printf("\n=== 定时器管理器状态 ===\n");
-    printf("当前时间: %lld\n", tm->current_time);
+    printf("当前时间: %lldus\n", tm->current_time);
     printf("活动定时器数量: %d\n", xheapmin_size(tm->timer_heap));
 
     xTimerNode* next_timer = (xTimerNode*)xheapmin_peek(tm->timer_heap);
     if (next_timer) {
-        printf("下一个到期定时器: ID=%d, 名称=%s, %lldms后到期\n",
+        printf("下一个到期定时器: ID=%d, 名称=%s, %lldus后到期\n",
             next_timer->id, next_timer->name,
             next_timer->base.key - tm->current_time);
     }
@@ -143,7 +168,7 @@ void xtimer_print(xTimerSet* tm) {
     printf("所有定时器:\n");
     for (int i = 0; i < tm->timer_heap->size; i++) {
         xTimerNode* timer = (xTimerNode*)tm->timer_heap->data[i];
-        printf("  [%d] ID=%d, 名称=%s, 过期时间=%lld (%lldms后), 重复=%d, 堆索引=%d\n",
+        printf("  [%d] ID=%d, 名称=%s, 过期时间=%lld (%lldus后), 间隔=%lldus, 堆索引=%d\n",
             i, timer->id, timer->name, timer->base.key,
             timer->base.key - tm->current_time,
             timer->repeat_interval, timer->base.heap_index);
@@ -172,26 +197,35 @@ void xtimer_update() {
         xtimer_poll(_cur);
 }
 
-int xtimer_last() {
+long64 xtimer_last_us() {
     if (_cur) {
-        long64 time_now = time_get_ms();
+        long64 time_now = time_get_mono_us();
         xTimerNode* next_timer = (xTimerNode*)xheapmin_peek(_cur->timer_heap);
         if(next_timer)
-            return next_timer->base.key> time_now?(int)(next_timer->base.key - time_now):0;
+            return next_timer->base.key > time_now ? next_timer->base.key - time_now : 0;
     }
     return -1;
 }
 
+int xtimer_last() {
+    long64 us = xtimer_last_us();
+    return us < 0 ? -1 : (int)((us + 999) / 1000);     // 向上取整, 不要提前醒来空转
+}
+
 void xtimer_show() {
     xtimer_print(_cur);
 }
 
-xtimerHandler xtimer_add(int interval_ms, const char* name, fnOnTime callback, void* ud, int repeat_num) {
+xtimerHandler xtimer_add_us(long64 interval_us, const char* name, fnOnTime callback, void* ud, int repeat_num) {
     if (!_cur) {
         _cur = xtimer_pool_create(100);
     }
 
-    return (xtimerHandler)xtimer_create(_cur, interval_ms, name, callback, ud, repeat_num);
+    return (xtimerHandler)xtimer_create(_cur, interval_us, name, callback, ud, repeat_num);
+}
+
+xtimerHandler xtimer_add(int interval_ms, const char* name, fnOnTime callback, void* ud, int repeat_num) {
+    return xtimer_add_us((long64)interval_ms * 1000, name, callback, ud, repeat_num);
 }
 
 void xtimer_del(xtimerHandler handler) {
@@ -8,6 +8,7 @@ extern "C" {
 #include "xheapmin.h"
 
 typedef void (*fnOnTime)(void*);
+typedef void (*fnOnLate)(void* ud, long64 late_us);
 typedef void* xtimerHandler;
 
 // api
@@ -15,9 +16,14 @@ void xtimer_init(int cap);
 void xtimer_uninit();
 void xtimer_update();
 int  xtimer_last();
+long64 xtimer_last_us();                                  // 到下一个定时器的us, -1 没有
 void xtimer_show();
+void xtimer_set_observer(fnOnLate on_late, void* ud);     // 当前线程每次触发回调前报告迟到us
+void xtimer_clear_observer(void* ud);                     // 当前线程的观察者还是ud时才清掉
 
+// 内部按单调时钟us计时, 亚毫秒精度需要事件循环支持(epoll_pwait2/timerfd/kqueue)
 xtimerHandler xtimer_add(int interval_ms, const char* name, fnOnTime callback, void* ud, int repeat_num);
+xtimerHandler xtimer_add_us(long64 interval_us, const char* name, fnOnTime callback, void* ud, int repeat_num);
 void          xtimer_del(xtimerHandler handler);
 
 // utils
@@ -44,6 +50,15 @@ static long64 time_get_us() {
 
     return (uli.QuadPart / 10);
 }
+
+static inline long64 time_get_mono_us() {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (long64)(now.QuadPart / freq.QuadPart * 1000000 +
+        now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+}
 #else
 #include <sys/time.h>
 #include <time.h>
@@ -62,6 +77,13 @@ static long64 time_get_us() {
 
     return (long64)tv.tv_sec * 1000000LL + tv.tv_usec;
 }
+
+static inline long64 time_get_mono_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long64)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
 #endif
 
 static void time_get_dt(long64 millis, char out[24]) {